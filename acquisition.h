@@ -0,0 +1,520 @@
+#pragma once
+
+#include "link_health.h"
+#include <esphome/components/modbus_controller/modbus_controller.h>
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#define TAG_ACQUISITION "Acquisition"
+
+#define ACQUISITION_TIMEOUT_MARGIN 200 // ms to wait for a response after the controller has given up on it
+#define ACQUISITION_MAX_LOAD 0.8       // Share of bus time the admitted classes may take
+#define ACQUISITION_LOAD_HYSTERESIS 0.1 // A shed class is admitted again below ACQUISITION_MAX_LOAD minus this.
+#define ACQUISITION_MAX_SKIPS 4        // A shed read is still done after this many skipped releases.
+#define ACQUISITION_RATE_WINDOW 60000  // ms
+
+namespace acquisition
+{
+  using esphome::modbus_controller::ModbusCommandItem;
+  using esphome::modbus_controller::ModbusController;
+  using esphome::modbus_controller::ModbusRegisterType;
+
+  enum Channel
+  {
+    VOLTAGE_A = 0,
+    VOLTAGE_B,
+    VOLTAGE_C,
+    CURRENT_A,
+    CURRENT_B,
+    CURRENT_C,
+    POWER_A,
+    POWER_B,
+    POWER_C,
+    APPARENT_POWER_A,
+    APPARENT_POWER_B,
+    APPARENT_POWER_C,
+    REACTIVE_POWER_A,
+    REACTIVE_POWER_B,
+    REACTIVE_POWER_C,
+    POWER_FACTOR_A,
+    POWER_FACTOR_B,
+    POWER_FACTOR_C,
+    POWER_TOTAL,
+    APPARENT_POWER_TOTAL,
+    REACTIVE_POWER_TOTAL,
+    POWER_FACTOR_TOTAL,
+    LINE_FREQUENCY,
+    ENERGY_COUNTER,
+    CHANNEL_COUNT
+  };
+
+  // Input register address (FP32, big-endian) of each channel.
+  static constexpr uint16_t CHANNEL_ADDRESSES[CHANNEL_COUNT] = {
+      0x0000, 0x0002, 0x0004, // Voltage
+      0x0006, 0x0008, 0x000A, // Current
+      0x000C, 0x000E, 0x0010, // Power
+      0x0012, 0x0014, 0x0016, // Apparent power
+      0x0018, 0x001A, 0x001C, // Reactive power
+      0x001E, 0x0020, 0x0022, // Power factor
+      0x0034, 0x0038, 0x003C, 0x003E, // Totals
+      0x0046, // Frequency
+      0x0156, // Energy counter
+  };
+
+  /// @brief Priority class of meter reads, lower value is more important.
+  enum PollClass
+  {
+    CLASS_PROTECTION = 0,
+    CLASS_POWER,
+    CLASS_QUALITY,
+    CLASS_COUNTER,
+    CLASSES_COUNT
+  };
+
+  static const char *const CLASS_NAMES[CLASSES_COUNT] = {"protection", "power", "quality", "counter"};
+
+  // Release period of each class, ms. A read is due before the next release of its block.
+  static constexpr uint32_t CLASS_PERIODS[CLASSES_COUNT] = {1000, 5000, 30000, 60000};
+
+  /// @brief Contiguous range of input registers read by one request
+  struct Block
+  {
+    uint16_t start;
+    uint16_t count;
+    PollClass pollClass;
+  };
+
+  // Edit together with CHANNEL_ADDRESSES, every channel should be covered by a block.
+  static constexpr Block BLOCKS[] = {
+      {0x0000, 12, CLASS_PROTECTION}, // Voltage, current
+      {0x0046, 2, CLASS_PROTECTION},  // Frequency
+      {0x000C, 12, CLASS_POWER},      // Power, apparent power
+      {0x0034, 6, CLASS_POWER},       // Total power, total apparent power
+      {0x0018, 12, CLASS_QUALITY},    // Reactive power, power factor
+      {0x003C, 4, CLASS_QUALITY},     // Total reactive power, total power factor
+      {0x0156, 2, CLASS_COUNTER},     // Energy counter
+  };
+  static const int BLOCKS_COUNT = sizeof(BLOCKS) / sizeof(BLOCKS[0]);
+
+  constexpr bool blockCovers(const Block &block, uint16_t address)
+  {
+    return address >= block.start && address + 2 <= block.start + block.count;
+  }
+
+  constexpr bool channelIsCovered(int channel, int block = 0)
+  {
+    return block < BLOCKS_COUNT &&
+           (blockCovers(BLOCKS[block], CHANNEL_ADDRESSES[channel]) || channelIsCovered(channel, block + 1));
+  }
+
+  constexpr bool allChannelsCovered(int channel = 0)
+  {
+    return channel >= CHANNEL_COUNT || (channelIsCovered(channel) && allChannelsCovered(channel + 1));
+  }
+
+  static_assert(allChannelsCovered(), "Every meter channel should be read by a block.");
+  static_assert(CHANNEL_COUNT <= 32, "Channel masks are 32-bit.");
+
+  constexpr uint32_t channelBit(Channel channel)
+  {
+    return 1u << channel;
+  }
+
+  /// @brief Latest meter readings
+  struct Frame
+  {
+    uint32_t timestamp; // millis() of the last response
+    uint32_t requested; // millis() the last request was sent
+    float values[CHANNEL_COUNT];
+  };
+
+  /// @brief Called on every response with the bit mask of updated channels (see channelBit).
+  typedef std::function<void(const Frame &, uint32_t)> FrameCallback;
+
+  /// @brief Scheduling state of one block
+  struct Task
+  {
+    uint32_t release;  // millis() of the next release
+    uint32_t deadline; // millis() by which the pending read should be done
+    bool pending;      // Released, waiting for the bus
+    bool expedited;    // Pending read requested out of schedule, no deadline to miss
+    bool fresh;        // Read since the last cycle of its class
+    uint8_t skips;     // Releases shed in a row
+    float requestTime; // ms, moving average of the response time
+    uint32_t mask;     // Channels decoded from the block
+    uint32_t released;    // millis() of the release of the pending read
+    uint32_t readRelease; // millis() of the release of the last completed read
+  };
+
+  /// @brief Counters of one priority class
+  struct ClassStats
+  {
+    uint32_t reads;
+    uint32_t missed; // Reads done after the deadline or not started before the next release
+    uint32_t shed;   // Releases skipped because the bus is overloaded
+    float rate;      // Reads per minute in the last window
+    float cycleTime; // ms from a release to the response of the last block of the class, moving average
+    bool admitted;
+  };
+
+  /// @brief Counters of requests
+  struct AcquisitionStats
+  {
+    uint32_t requests;
+    uint32_t completed;
+    uint32_t timedOut;
+    uint32_t lastRequestTime; // ms
+    float averageRequestTime; // ms, moving average
+    float load;               // Share of bus time all classes need at their periods
+  };
+
+  static ModbusController *controller = nullptr;
+  static uint32_t requestTimeout = 0; // ms, the controller drops a command without calling back after that.
+  static FrameCallback onFrame;
+  static Task tasks[BLOCKS_COUNT]{};
+  static int activeTask = -1; // Block of the request in flight
+  static uint32_t activeSequence = 0;
+  static uint32_t activeStart = 0;
+  static uint32_t activeDeadline = 0;
+  static uint32_t activeRelease = 0;
+  static bool activeExpedited = false;
+  static uint32_t windowStart = 0;
+  static uint32_t windowReads[CLASSES_COUNT]{};
+  static Frame frame{};
+  static ClassStats classStats[CLASSES_COUNT]{};
+  static AcquisitionStats stats{};
+
+  /// @brief Decodes big-endian FP32 at the byte offset.
+  float decodeFloat(const std::vector<uint8_t> &data, size_t offset)
+  {
+    if (offset + 4 > data.size())
+      return NAN;
+    uint32_t raw = static_cast<uint32_t>(data[offset]) << 24 | static_cast<uint32_t>(data[offset + 1]) << 16 |
+                   static_cast<uint32_t>(data[offset + 2]) << 8 | static_cast<uint32_t>(data[offset + 3]);
+    float value;
+    memcpy(&value, &raw, sizeof(value));
+    return value;
+  };
+
+  /// @brief Checks if the time has come, millis() overflow safe.
+  bool isDue(uint32_t now, uint32_t time)
+  {
+    return static_cast<int32_t>(now - time) >= 0;
+  };
+
+  /// @brief Admits classes in priority order while their bus time fits ACQUISITION_MAX_LOAD.
+  /// Protection reads are always admitted.
+  void updateAdmission()
+  {
+    float classLoad[CLASSES_COUNT]{};
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+      classLoad[BLOCKS[i].pollClass] += tasks[i].requestTime / CLASS_PERIODS[BLOCKS[i].pollClass];
+
+    float load = 0;
+    for (int i = 0; i < CLASSES_COUNT; i++)
+    {
+      load += classLoad[i];
+      ClassStats &item = classStats[i];
+      bool admitted = i == CLASS_PROTECTION ||
+                      load <= (item.admitted ? ACQUISITION_MAX_LOAD : ACQUISITION_MAX_LOAD - ACQUISITION_LOAD_HYSTERESIS);
+      if (admitted == item.admitted)
+        continue;
+      if (admitted)
+        ESP_LOGI(TAG_ACQUISITION, "Bus load is %.0f%%. Reads of class %s are resumed.", load * 100, CLASS_NAMES[i]);
+      else
+        ESP_LOGW(TAG_ACQUISITION, "Bus load is %.0f%%. Reads of class %s are shed.", load * 100, CLASS_NAMES[i]);
+      item.admitted = admitted;
+    };
+    stats.load = load;
+  };
+
+  /// @brief Completes the cycle of the class once every block of it has been read since the last cycle.
+  /// Cycle time is the age of the oldest class channel counted from its release, when the last block arrives.
+  void updateCycle(PollClass pollClass, uint32_t now)
+  {
+    uint32_t oldest = 0;
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+    {
+      if (BLOCKS[i].pollClass != pollClass)
+        continue;
+      if (!tasks[i].fresh)
+        return;
+      if (now - tasks[i].readRelease > oldest)
+        oldest = now - tasks[i].readRelease;
+    };
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+    {
+      if (BLOCKS[i].pollClass == pollClass)
+        tasks[i].fresh = false;
+    };
+    ClassStats &item = classStats[pollClass];
+    item.cycleTime = item.cycleTime == 0 ? oldest : item.cycleTime * 0.9f + oldest * 0.1f;
+  };
+
+  /// @brief Ends the request in flight and updates the response time estimates.
+  void finishRequest(uint32_t now, bool is_success)
+  {
+    Task &task = tasks[activeTask];
+    PollClass pollClass = BLOCKS[activeTask].pollClass;
+    uint32_t elapsed = now - activeStart;
+    activeTask = -1;
+
+    task.requestTime = task.requestTime == 0 ? elapsed : task.requestTime * 0.875f + elapsed * 0.125f;
+    stats.lastRequestTime = elapsed;
+    stats.averageRequestTime =
+        stats.averageRequestTime == 0 ? elapsed : stats.averageRequestTime * 0.9f + elapsed * 0.1f;
+    if (!is_success)
+      return;
+
+    stats.completed++;
+    classStats[pollClass].reads++;
+    windowReads[pollClass]++;
+    if (activeExpedited)
+      return;
+    if (!isDue(activeDeadline, now))
+      classStats[pollClass].missed++;
+    task.fresh = true;
+    task.readRelease = activeRelease;
+    updateCycle(pollClass, now);
+  };
+
+  /// @brief Releases due reads. Reads of shed classes are skipped.
+  void release(uint32_t now)
+  {
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+    {
+      Task &task = tasks[i];
+      if (!isDue(now, task.release))
+        continue;
+
+      PollClass pollClass = BLOCKS[i].pollClass;
+      uint32_t period = CLASS_PERIODS[pollClass];
+      // The previous read has not started before its deadline, the new one takes its place.
+      if (task.pending)
+        classStats[pollClass].missed++;
+
+      if (!classStats[pollClass].admitted && task.skips < ACQUISITION_MAX_SKIPS)
+      {
+        task.skips++;
+        task.pending = false;
+        classStats[pollClass].shed++;
+      }
+      else
+      {
+        // A read not started yet keeps its release, the cycle time counts the wait.
+        if (!task.pending)
+          task.released = task.release;
+        task.skips = 0;
+        task.pending = true;
+        task.expedited = false;
+        task.deadline = task.release + period;
+      }
+
+      task.release += period;
+      // Resynchronize after a stall instead of releasing a burst of reads.
+      if (isDue(now, task.release))
+      {
+        task.release = now + period;
+        task.deadline = task.release;
+      }
+    };
+  };
+
+  void onBlock(int block, uint32_t sequence, const std::vector<uint8_t> &data);
+
+  /// @brief Sends the pending read with the earliest deadline if the bus is free.
+  /// Ties go to the more important class.
+  void dispatch(uint32_t now)
+  {
+    if (activeTask >= 0)
+      return;
+
+    int next = -1;
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+    {
+      if (!tasks[i].pending)
+        continue;
+      int32_t slack = next < 0 ? -1 : static_cast<int32_t>(tasks[i].deadline - tasks[next].deadline);
+      if (slack < 0 || (slack == 0 && BLOCKS[i].pollClass < BLOCKS[next].pollClass))
+        next = i;
+    };
+    if (next < 0)
+      return;
+
+    tasks[next].pending = false;
+    activeTask = next;
+    activeSequence++;
+    activeStart = now;
+    activeDeadline = tasks[next].deadline;
+    activeRelease = tasks[next].released;
+    activeExpedited = tasks[next].expedited;
+    tasks[next].expedited = false;
+    stats.requests++;
+    linkhealth::onRequest();
+
+    uint32_t sequence = activeSequence;
+    controller->queue_command(ModbusCommandItem::create_read_command(
+        controller, ModbusRegisterType::READ, BLOCKS[next].start, BLOCKS[next].count,
+        [next, sequence](ModbusRegisterType register_type, uint16_t start_address, const std::vector<uint8_t> &data)
+        { onBlock(next, sequence, data); }));
+  };
+
+  /// @brief Decodes all channels of the block in one pass and sends the next read right away.
+  void onBlock(int block, uint32_t sequence, const std::vector<uint8_t> &data)
+  {
+    // Late response of a timed out request.
+    if (block != activeTask || sequence != activeSequence)
+      return;
+
+    uint32_t now = esphome::millis();
+    for (int i = 0; i < CHANNEL_COUNT; i++)
+    {
+      if (tasks[block].mask & channelBit(static_cast<Channel>(i)))
+        frame.values[i] = decodeFloat(data, (CHANNEL_ADDRESSES[i] - BLOCKS[block].start) * 2);
+    };
+    frame.timestamp = now;
+    frame.requested = activeStart;
+    linkhealth::onResponse(now - activeStart);
+    finishRequest(now, true);
+
+    if (onFrame)
+      onFrame(frame, tasks[block].mask);
+    dispatch(now);
+  };
+
+  void updateRates(uint32_t now)
+  {
+    uint32_t elapsed = now - windowStart;
+    if (elapsed < ACQUISITION_RATE_WINDOW)
+      return;
+    for (int i = 0; i < CLASSES_COUNT; i++)
+    {
+      classStats[i].rate = windowReads[i] * 60000.0f / elapsed;
+      windowReads[i] = 0;
+    };
+    windowStart = now;
+  };
+
+  /// @brief Binds acquisition to the meter controller. All blocks are released right away.
+  /// @param sendWaitTime ms, send_wait_time of the modbus bus
+  /// @param retries max_cmd_retries of the controller
+  /// @param callback called with the readings after every response
+  void setup(ModbusController *meter, uint32_t sendWaitTime, uint32_t retries, FrameCallback &&callback)
+  {
+    controller = meter;
+    requestTimeout = sendWaitTime * (retries + 1) + ACQUISITION_TIMEOUT_MARGIN;
+    onFrame = std::move(callback);
+
+    uint32_t now = esphome::millis();
+    windowStart = now;
+    for (auto &value : frame.values)
+      value = NAN;
+    for (auto &item : classStats)
+      item.admitted = true;
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+    {
+      tasks[i] = Task{};
+      tasks[i].release = now;
+      for (int j = 0; j < CHANNEL_COUNT; j++)
+      {
+        if (blockCovers(BLOCKS[i], CHANNEL_ADDRESSES[j]))
+          tasks[i].mask |= channelBit(static_cast<Channel>(j));
+      };
+    };
+  };
+
+  /// @brief Releases and sends reads. Should be called from main loop.
+  void loop()
+  {
+    if (controller == nullptr)
+      return;
+
+    uint32_t now = esphome::millis();
+    if (activeTask >= 0 && now - activeStart >= requestTimeout)
+    {
+      ESP_LOGW(TAG_ACQUISITION, "Read of %u registers at 0x%04X has timed out.",
+               static_cast<unsigned>(BLOCKS[activeTask].count), static_cast<unsigned>(BLOCKS[activeTask].start));
+      stats.timedOut++;
+      linkhealth::onTimeout();
+      finishRequest(now, false);
+    }
+
+    updateAdmission();
+    release(now);
+    dispatch(now);
+    updateRates(now);
+  };
+
+  /// @brief Reads the block of the channel before any other pending read, right away if the bus is free.
+  /// Regular releases of the block are not changed.
+  void expedite(Channel channel)
+  {
+    if (controller == nullptr)
+      return;
+
+    uint32_t now = esphome::millis();
+    for (int i = 0; i < BLOCKS_COUNT; i++)
+    {
+      if (!(tasks[i].mask & channelBit(channel)) || i == activeTask)
+        continue;
+      tasks[i].pending = true;
+      tasks[i].expedited = true;
+      tasks[i].deadline = now;
+      break;
+    };
+    dispatch(now);
+  };
+
+  /// @brief ms since the request in flight has been sent, 0 if the bus is free.
+  uint32_t requestAge()
+  {
+    return activeTask < 0 ? 0 : esphome::millis() - activeStart;
+  };
+
+  /// @brief Counts CRC failures and exception responses logged by ESPHome modbus components.
+  /// The controller drops the command on exception, so the request is over without waiting for timeout.
+  /// Should be called from logger on_message trigger.
+  void onLogMessage(const char *tag, const char *message)
+  {
+    switch (linkhealth::parseLogMessage(tag, message))
+    {
+    case linkhealth::LOG_CRC_ERROR:
+      linkhealth::onCrcError();
+      break;
+    case linkhealth::LOG_EXCEPTION:
+      linkhealth::onException();
+      if (activeTask >= 0)
+      {
+        uint32_t now = esphome::millis();
+        finishRequest(now, false);
+        dispatch(now);
+      }
+      break;
+    default:
+      break;
+    }
+  };
+
+  /// @brief Missed deadlines of all classes
+  uint32_t missedDeadlines()
+  {
+    uint32_t missed = 0;
+    for (const auto &item : classStats)
+      missed += item.missed;
+    return missed;
+  };
+
+  /// @brief Shed reads of all classes
+  uint32_t shedReads()
+  {
+    uint32_t shed = 0;
+    for (const auto &item : classStats)
+      shed += item.shed;
+    return shed;
+  };
+
+}; // namespace acquisition
@@ -0,0 +1,27 @@
+#pragma once
+
+// Checksums of on-card data. Shared by the firmware and host-side tools,
+// so this header must not depend on Arduino or ESPHome.
+
+#include <cstddef>
+#include <cstdint>
+
+/// @brief CRC-32 (IEEE 802.3, as in zlib) with a nibble table to keep flash usage small.
+/// @param crc CRC of the previous data to continue calculation, 0 to start
+inline uint32_t crc32Compute(const void *data, size_t size, uint32_t crc = 0)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cinttypes>
+
 #define CSV_DELIMITER ";"
 
 #define CSV_SUMMARY_DATE_FORMAT "%Y-%m-%d"
@@ -32,38 +34,104 @@
 #define CSV_SUMMARY_OVERHEATING_FAILURES "overheating_failures"
 #define CSV_SUMMARY_CASE_INTRUSIONS "case_intrusions"
 
-#define CSV_SUMMARY_HEADER                                                                                      \
-  CSV_SUMMARY_DATE CSV_DELIMITER CSV_SUMMARY_CONSUMPTION_PER_DAY CSV_DELIMITER CSV_SUMMARY_CONSUMPTION_TOTAL    \
-      CSV_DELIMITER CSV_SUMMARY_POWER_FAILURES CSV_DELIMITER CSV_SUMMARY_POWER_FAILURES_DURATION                \
-          CSV_DELIMITER CSV_SUMMARY_MIN_VOLTAGE CSV_DELIMITER CSV_SUMMARY_MAX_VOLTAGE                           \
-              CSV_DELIMITER CSV_SUMMARY_UNDERVOLTAGE_FAILURES CSV_DELIMITER CSV_SUMMARY_UNDERVOLTAGE_WARNINGS   \
-                  CSV_DELIMITER CSV_SUMMARY_OVERVOLTAGE_WARNINGS CSV_DELIMITER CSV_SUMMARY_OVERVOLTAGE_FAILURES \
-                      CSV_DELIMITER CSV_SUMMARY_MIN_CURRENT CSV_DELIMITER CSV_SUMMARY_MAX_CURRENT               \
-                          CSV_DELIMITER CSV_SUMMARY_OVERLOAD_WARNINGS CSV_DELIMITER                             \
-                              CSV_SUMMARY_OVERLOAD_FAILURES CSV_DELIMITER CSV_SUMMARY_PHASE_IMBALANCE_WARNINGS  \
-                                  CSV_DELIMITER CSV_SUMMARY_PHASE_IMBALANCE_FAILURES                            \
-                                      CSV_DELIMITER CSV_SUMMARY_MIN_FREQUENCY CSV_DELIMITER                     \
-                                          CSV_SUMMARY_MAX_FREQUENCY CSV_DELIMITER                               \
-                                              CSV_SUMMARY_FREQUENCY_WARNINGS CSV_DELIMITER                      \
-                                                  CSV_SUMMARY_FREQUENCY_FAILURES                                \
-                                                      CSV_DELIMITER CSV_SUMMARY_BREAKER_FAILURES                \
-                                                          CSV_DELIMITER CSV_SUMMARY_POWER_METER_FAILURES        \
-                                                              CSV_DELIMITER CSV_SUMMARY_OVERHEATING_WARNINGS    \
-                                                                  CSV_DELIMITER                                 \
-                                                                      CSV_SUMMARY_OVERHEATING_FAILURES          \
-                                                                          CSV_DELIMITER                         \
-                                                                              CSV_SUMMARY_CASE_INTRUSIONS
-
-#define CSV_SUMMARY_DATALINE_FORMAT                                            \
-  "%s" CSV_DELIMITER "%.3f" CSV_DELIMITER "%.3f" CSV_DELIMITER                 \
-  "%d" CSV_DELIMITER "%.2f" CSV_DELIMITER "%.3f" CSV_DELIMITER                 \
-  "%.3f" CSV_DELIMITER "%d" CSV_DELIMITER "%d" CSV_DELIMITER                   \
-  "%d" CSV_DELIMITER "%d" CSV_DELIMITER "%.3f" CSV_DELIMITER                   \
-  "%.3f" CSV_DELIMITER "%d" CSV_DELIMITER "%d" CSV_DELIMITER                   \
-  "%d" CSV_DELIMITER "%d" CSV_DELIMITER "%.5f" CSV_DELIMITER                   \
-  "%.5f" CSV_DELIMITER "%d" CSV_DELIMITER "%d" CSV_DELIMITER                   \
-  "%d" CSV_DELIMITER "%d" CSV_DELIMITER "%d" CSV_DELIMITER "%d" CSV_DELIMITER  \
-  "%d\n"
+// Daily summary columns after the date, in file order:
+// X(name, type, format, snapshot value, binary record value).
+// Value columns are text only: the firmware expands snapshot values (daily is SnapSlice,
+// total is consumption including previous days), tools expand DatalogRecord values.
+#define CSV_SUMMARY_COLUMNS(X)                                                                                          \
+  X(CSV_SUMMARY_CONSUMPTION_PER_DAY, double, "%.3f", daily.energyConsumption, record.consumptionPerDay)                 \
+  X(CSV_SUMMARY_CONSUMPTION_TOTAL, double, "%.3f", total, record.consumptionTotal)                                      \
+  X(CSV_SUMMARY_POWER_FAILURES, uint64_t, "%" PRIu64, daily.powerFailuresCount, record.powerFailures)                   \
+  X(CSV_SUMMARY_POWER_FAILURES_DURATION, double, "%.2f", daily.powerFailuresDuration / 60.0,                            \
+    record.powerFailuresDuration / 60.0)                                                                                \
+  X(CSV_SUMMARY_MIN_VOLTAGE, double, "%.3f", daily.minVoltage, record.minVoltage)                                       \
+  X(CSV_SUMMARY_MAX_VOLTAGE, double, "%.3f", daily.maxVoltage, record.maxVoltage)                                       \
+  X(CSV_SUMMARY_UNDERVOLTAGE_FAILURES, uint64_t, "%" PRIu64, daily.undervoltageFailures, record.undervoltageFailures)   \
+  X(CSV_SUMMARY_UNDERVOLTAGE_WARNINGS, uint64_t, "%" PRIu64, daily.undervoltageWarnings, record.undervoltageWarnings)   \
+  X(CSV_SUMMARY_OVERVOLTAGE_WARNINGS, uint64_t, "%" PRIu64, daily.overvoltageWarnings, record.overvoltageWarnings)      \
+  X(CSV_SUMMARY_OVERVOLTAGE_FAILURES, uint64_t, "%" PRIu64, daily.overvoltageFailures, record.overvoltageFailures)      \
+  X(CSV_SUMMARY_MIN_CURRENT, double, "%.3f", daily.minCurrent, record.minCurrent)                                       \
+  X(CSV_SUMMARY_MAX_CURRENT, double, "%.3f", daily.maxCurrent, record.maxCurrent)                                       \
+  X(CSV_SUMMARY_OVERLOAD_WARNINGS, uint64_t, "%" PRIu64, daily.overloadWarnings, record.overloadWarnings)               \
+  X(CSV_SUMMARY_OVERLOAD_FAILURES, uint64_t, "%" PRIu64, daily.overloadFailures, record.overloadFailures)               \
+  X(CSV_SUMMARY_PHASE_IMBALANCE_WARNINGS, uint64_t, "%" PRIu64, daily.phaseImbalanceWarnings,                           \
+    record.phaseImbalanceWarnings)                                                                                      \
+  X(CSV_SUMMARY_PHASE_IMBALANCE_FAILURES, uint64_t, "%" PRIu64, daily.phaseImbalanceFailures,                           \
+    record.phaseImbalanceFailures)                                                                                      \
+  X(CSV_SUMMARY_MIN_FREQUENCY, double, "%.5f", daily.minFrequency, record.minFrequency)                                 \
+  X(CSV_SUMMARY_MAX_FREQUENCY, double, "%.5f", daily.maxFrequency, record.maxFrequency)                                 \
+  X(CSV_SUMMARY_FREQUENCY_WARNINGS, uint64_t, "%" PRIu64, daily.frequencyWarnings, record.frequencyWarnings)            \
+  X(CSV_SUMMARY_FREQUENCY_FAILURES, uint64_t, "%" PRIu64, daily.frequencyFailures, record.frequencyFailures)            \
+  X(CSV_SUMMARY_BREAKER_FAILURES, uint64_t, "%" PRIu64, daily.breakerFailures, record.breakerFailures)                  \
+  X(CSV_SUMMARY_POWER_METER_FAILURES, uint64_t, "%" PRIu64, daily.powerMeterFailures, record.powerMeterFailures)        \
+  X(CSV_SUMMARY_OVERHEATING_WARNINGS, uint64_t, "%" PRIu64, daily.overheatingWarnings, record.overheatingWarnings)      \
+  X(CSV_SUMMARY_OVERHEATING_FAILURES, uint64_t, "%" PRIu64, daily.overheatingFailures, record.overheatingFailures)      \
+  X(CSV_SUMMARY_CASE_INTRUSIONS, uint64_t, "%" PRIu64, daily.caseIntrusionFailures, record.caseIntrusions)
+
+#define CSV_SUMMARY_HEADER_ITEM(name, type, format, snapshot, record) CSV_DELIMITER name
+#define CSV_SUMMARY_FORMAT_ITEM(name, type, format, snapshot, record) CSV_DELIMITER format
+#define CSV_SUMMARY_SNAPSHOT_ARG(name, type, format, snapshot, record) , static_cast<type>(snapshot)
+#define CSV_SUMMARY_RECORD_ARG(name, type, format, snapshot, record) , static_cast<type>(record)
+
+#define CSV_SUMMARY_HEADER CSV_SUMMARY_DATE CSV_SUMMARY_COLUMNS(CSV_SUMMARY_HEADER_ITEM)
+
+// Date string followed by CSV_SUMMARY_SNAPSHOT_ARG or CSV_SUMMARY_RECORD_ARG expansion.
+#define CSV_SUMMARY_DATALINE_FORMAT "%s" CSV_SUMMARY_COLUMNS(CSV_SUMMARY_FORMAT_ITEM) "\n"
+
+// Per-phase statistics of a channel: X(name, type, format, channel, summary field).
+#define CSV_PHASE_STATS_METRICS(X, prefix, channel)          \
+  X(prefix "_samples", uint32_t, "%" PRIu32, channel, count) \
+  X(prefix "_min", double, "%.3f", channel, min)             \
+  X(prefix "_max", double, "%.3f", channel, max)             \
+  X(prefix "_mean", double, "%.3f", channel, mean)           \
+  X(prefix "_stddev", double, "%.4f", channel, stddev)       \
+  X(prefix "_p5", double, "%.3f", channel, p5)               \
+  X(prefix "_p50", double, "%.3f", channel, p50)             \
+  X(prefix "_p95", double, "%.3f", channel, p95)
+
+// Daily per-phase statistics columns after the date. Channels are phasestats::Channel values,
+// values are expanded from phasestats::Summaries named stats.
+#define CSV_PHASE_STATS_COLUMNS(X)                                         \
+  CSV_PHASE_STATS_METRICS(X, "voltage_a", phasestats::CHANNEL_VOLTAGE_A) \
+  CSV_PHASE_STATS_METRICS(X, "voltage_b", phasestats::CHANNEL_VOLTAGE_B) \
+  CSV_PHASE_STATS_METRICS(X, "voltage_c", phasestats::CHANNEL_VOLTAGE_C) \
+  CSV_PHASE_STATS_METRICS(X, "current_a", phasestats::CHANNEL_CURRENT_A) \
+  CSV_PHASE_STATS_METRICS(X, "current_b", phasestats::CHANNEL_CURRENT_B) \
+  CSV_PHASE_STATS_METRICS(X, "current_c", phasestats::CHANNEL_CURRENT_C) \
+  CSV_PHASE_STATS_METRICS(X, "frequency", phasestats::CHANNEL_FREQUENCY)
+
+#define CSV_PHASE_STATS_HEADER_ITEM(name, type, format, channel, field) CSV_DELIMITER name
+#define CSV_PHASE_STATS_FORMAT_ITEM(name, type, format, channel, field) CSV_DELIMITER format
+#define CSV_PHASE_STATS_ARG(name, type, format, channel, field) , static_cast<type>(stats.channels[channel].field)
+
+#define CSV_PHASE_STATS_HEADER CSV_SUMMARY_DATE CSV_PHASE_STATS_COLUMNS(CSV_PHASE_STATS_HEADER_ITEM)
+
+// Date string followed by CSV_PHASE_STATS_ARG expansion.
+#define CSV_PHASE_STATS_DATALINE_FORMAT "%s" CSV_PHASE_STATS_COLUMNS(CSV_PHASE_STATS_FORMAT_ITEM) "\n"
+
+// Time-of-use energy of a TouSlice: X(name, type, format, value).
+#define CSV_TARIFF_FIELDS(X, prefix, slice)                               \
+  X(prefix "day_energy", double, "%.3f", slice.dayEnergy)                 \
+  X(prefix "night_energy", double, "%.3f", slice.nightEnergy)             \
+  X(prefix "peak_energy", double, "%.3f", slice.peakEnergy)               \
+  X(prefix "reactive_energy_a", double, "%.3f", slice.reactiveEnergyA)    \
+  X(prefix "reactive_energy_b", double, "%.3f", slice.reactiveEnergyB)    \
+  X(prefix "reactive_energy_c", double, "%.3f", slice.reactiveEnergyC)
+
+// Daily time-of-use energy columns after the date. Values are expanded from TouSlice
+// named daily (the day) and total (including previous days).
+#define CSV_TARIFF_COLUMNS(X)           \
+  CSV_TARIFF_FIELDS(X, "", daily)       \
+  CSV_TARIFF_FIELDS(X, "total_", total)
+
+#define CSV_TARIFF_HEADER_ITEM(name, type, format, value) CSV_DELIMITER name
+#define CSV_TARIFF_FORMAT_ITEM(name, type, format, value) CSV_DELIMITER format
+#define CSV_TARIFF_ARG(name, type, format, value) , static_cast<type>(value)
+
+#define CSV_TARIFF_HEADER CSV_SUMMARY_DATE CSV_TARIFF_COLUMNS(CSV_TARIFF_HEADER_ITEM)
+
+// Date string followed by CSV_TARIFF_ARG expansion.
+#define CSV_TARIFF_DATALINE_FORMAT "%s" CSV_TARIFF_COLUMNS(CSV_TARIFF_FORMAT_ITEM) "\n"
 
 #define CSV_EVENTLOG_TIMESTAMP "timestamp"
 #define CSV_EVENTLOG_EVENT_TYPE "event_type"
@@ -0,0 +1,90 @@
+#pragma once
+
+// Binary daily data log layout. Shared by the firmware and host-side tools,
+// so this header must not depend on Arduino or ESPHome.
+
+#include <cstddef>
+#include <cstdint>
+
+#define DATALOG_BIN_FILE "datalog_.bin"
+#define DATALOG_MAGIC 0x474C4443 // "CDLG" in little-endian
+#define DATALOG_VERSION 1
+#define DATALOG_DAYS_PER_FILE 31
+
+#define DATALOG_RECORD_VALID 0x01
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "Binary data log is stored in little-endian byte order.");
+
+#pragma pack(push, 1)
+
+/// @brief Header of monthly binary data log file
+struct DatalogHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint16_t year;
+    uint8_t month;
+    uint8_t daysCount;
+    uint32_t reserved;
+};
+
+/// @brief Daily record. Fields are placed in CSV column order.
+struct DatalogRecord
+{
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint32_t flags;
+    double consumptionPerDay;
+    double consumptionTotal;
+    uint32_t powerFailures;
+    uint32_t powerFailuresDuration; // seconds
+    float minVoltage;
+    float maxVoltage;
+    uint32_t undervoltageFailures;
+    uint32_t undervoltageWarnings;
+    uint32_t overvoltageWarnings;
+    uint32_t overvoltageFailures;
+    float minCurrent;
+    float maxCurrent;
+    uint32_t overloadWarnings;
+    uint32_t overloadFailures;
+    uint32_t phaseImbalanceWarnings;
+    uint32_t phaseImbalanceFailures;
+    float minFrequency;
+    float maxFrequency;
+    uint32_t frequencyWarnings;
+    uint32_t frequencyFailures;
+    uint32_t breakerFailures;
+    uint32_t powerMeterFailures;
+    uint32_t overheatingWarnings;
+    uint32_t overheatingFailures;
+    uint32_t caseIntrusions;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(DatalogHeader) == 16, "Unexpected data log header size.");
+static_assert(sizeof(DatalogRecord) == 116, "Unexpected data log record size.");
+
+/// @brief Offset of the day record (1-based day of month) in the monthly file.
+inline size_t datalogRecordOffset(uint8_t day)
+{
+    return sizeof(DatalogHeader) + (day - 1) * sizeof(DatalogRecord);
+}
+
+/// @brief Size of the monthly file with all day slots allocated.
+inline size_t datalogFileSize()
+{
+    return sizeof(DatalogHeader) + DATALOG_DAYS_PER_FILE * sizeof(DatalogRecord);
+}
+
+inline bool datalogHeaderIsValid(const DatalogHeader &header)
+{
+    return header.magic == DATALOG_MAGIC &&
+           header.version == DATALOG_VERSION &&
+           header.recordSize == sizeof(DatalogRecord) &&
+           header.daysCount == DATALOG_DAYS_PER_FILE;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <functional>
+
+#define TAG_IO_WORKER "IO Worker"
+
+#define IO_QUEUE_CAPACITY 16
+#define IO_TASK_STACK_SIZE 8192
+#define IO_TASK_PRIORITY 1
+#define IO_TASK_CORE 0 // ESPHome loop runs on core 1.
+#define IO_DEFAULT_TIMEOUT 10000 // ms
+
+namespace ioworker
+{
+  enum JobPriority
+  {
+    PRIORITY_LOW = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_HIGH = 2
+  };
+
+  enum JobStatus
+  {
+    JOB_DONE = 0,
+    JOB_FAILED = 1,
+    JOB_TIMED_OUT = 2
+  };
+
+  enum SlotState
+  {
+    SLOT_FREE = 0,
+    SLOT_QUEUED = 1,
+    SLOT_RUNNING = 2,
+    SLOT_COMPLETED = 3
+  };
+
+  typedef std::function<bool()> JobWork;
+  typedef std::function<void(JobStatus)> JobCallback;
+
+  /// @brief Slot of the bounded job queue
+  struct Job
+  {
+    SlotState state;
+    JobPriority priority;
+    uint32_t sequence;
+    uint32_t submitted;
+    uint32_t timeout;
+    uint32_t duration;
+    JobStatus status;
+    const char *name;
+    JobWork work;
+    JobCallback callback;
+  };
+
+  /// @brief Counters of the I/O worker
+  struct WorkerStats
+  {
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t timedOut;
+    uint32_t rejected;
+    uint32_t overruns;
+    uint32_t depth;
+    uint32_t maxDepth;
+    uint32_t lastDuration;
+    uint32_t maxDuration;
+  };
+
+  static Job jobs[IO_QUEUE_CAPACITY];
+  static uint32_t jobSequence = 0;
+  static WorkerStats stats{};
+  static SemaphoreHandle_t queueLock = nullptr;
+  static TaskHandle_t workerTask = nullptr;
+
+  /// @brief Picks the queued job with the highest priority (the oldest one among equals).
+  /// Must be called with queueLock taken.
+  Job *nextJob()
+  {
+    Job *selected = nullptr;
+    for (auto &job : jobs)
+    {
+      if (job.state != SlotState::SLOT_QUEUED)
+        continue;
+      if (selected == nullptr || job.priority > selected->priority ||
+          (job.priority == selected->priority &&
+           static_cast<int32_t>(job.sequence - selected->sequence) < 0))
+        selected = &job;
+    };
+    return selected;
+  };
+
+  void workerLoop(void *)
+  {
+    for (;;)
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+      for (;;)
+      {
+        xSemaphoreTake(queueLock, portMAX_DELAY);
+        Job *job = nextJob();
+        if (job != nullptr)
+        {
+          job->state = SlotState::SLOT_RUNNING;
+          stats.depth--;
+        }
+        xSemaphoreGive(queueLock);
+
+        if (job == nullptr)
+          break;
+
+        uint32_t started = esphome::millis();
+        if (started - job->submitted > job->timeout)
+        {
+          ESP_LOGW(TAG_IO_WORKER, "Job '%s' has been expired in queue after %u ms.",
+                   job->name, started - job->submitted);
+          job->status = JobStatus::JOB_TIMED_OUT;
+          job->duration = 0;
+        }
+        else
+        {
+          job->status = job->work() ? JobStatus::JOB_DONE : JobStatus::JOB_FAILED;
+          job->duration = esphome::millis() - started;
+          if (esphome::millis() - job->submitted > job->timeout)
+          {
+            ESP_LOGW(TAG_IO_WORKER, "Job '%s' has overrun its deadline (%u ms).",
+                     job->name, job->timeout);
+            stats.overruns++;
+          }
+        }
+
+        xSemaphoreTake(queueLock, portMAX_DELAY);
+        job->state = SlotState::SLOT_COMPLETED;
+        xSemaphoreGive(queueLock);
+      };
+    };
+  };
+
+  /// @brief Starts the worker task. Must be called once before any job is submitted.
+  bool setup()
+  {
+    if (workerTask != nullptr)
+      return true;
+
+    queueLock = xSemaphoreCreateMutex();
+    if (queueLock == nullptr)
+    {
+      ESP_LOGE(TAG_IO_WORKER, "Unable to create queue lock.");
+      return false;
+    }
+
+    if (xTaskCreatePinnedToCore(workerLoop, "io_worker", IO_TASK_STACK_SIZE, nullptr,
+                                IO_TASK_PRIORITY, &workerTask, IO_TASK_CORE) != pdPASS)
+    {
+      ESP_LOGE(TAG_IO_WORKER, "Unable to start I/O worker task.");
+      workerTask = nullptr;
+      return false;
+    }
+
+    ESP_LOGI(TAG_IO_WORKER, "I/O worker has been started on core %d.", IO_TASK_CORE);
+    return true;
+  };
+
+  bool isStarted() { return workerTask != nullptr; };
+
+  /// @brief Puts a job to the queue without blocking.
+  /// @param name Job name for logs
+  /// @param work Job body. Runs on the worker task, must not touch ESPHome components.
+  /// @param callback Completion callback. Runs on the main loop from ioworker::loop().
+  /// @param priority Job priority
+  /// @param timeout Time in ms the job must be completed in after submission
+  /// @return false if the queue is full or the worker is not started
+  bool submit(const char *name, JobWork &&work, JobCallback &&callback = nullptr,
+              JobPriority priority = JobPriority::PRIORITY_NORMAL,
+              uint32_t timeout = IO_DEFAULT_TIMEOUT)
+  {
+    if (!isStarted())
+    {
+      ESP_LOGW(TAG_IO_WORKER, "I/O worker is not started. Job '%s' is rejected.", name);
+      stats.rejected++;
+      return false;
+    }
+
+    // Worker holds the lock for a few instructions only.
+    if (xSemaphoreTake(queueLock, pdMS_TO_TICKS(5)) != pdTRUE)
+    {
+      ESP_LOGW(TAG_IO_WORKER, "I/O queue is locked. Job '%s' is rejected.", name);
+      stats.rejected++;
+      return false;
+    }
+
+    Job *slot = nullptr;
+    for (auto &job : jobs)
+    {
+      if (job.state == SlotState::SLOT_FREE)
+      {
+        slot = &job;
+        break;
+      }
+    };
+
+    if (slot == nullptr)
+    {
+      xSemaphoreGive(queueLock);
+      ESP_LOGW(TAG_IO_WORKER, "I/O queue is full. Job '%s' is rejected.", name);
+      stats.rejected++;
+      return false;
+    }
+
+    slot->name = name;
+    slot->priority = priority;
+    slot->sequence = jobSequence++;
+    slot->submitted = esphome::millis();
+    slot->timeout = timeout;
+    slot->duration = 0;
+    slot->work = std::move(work);
+    slot->callback = std::move(callback);
+    slot->state = SlotState::SLOT_QUEUED;
+    stats.submitted++;
+    stats.depth++;
+    stats.maxDepth = max(stats.maxDepth, stats.depth);
+    xSemaphoreGive(queueLock);
+
+    xTaskNotifyGive(workerTask);
+    return true;
+  };
+
+  /// @brief Delivers completion callbacks. Should be called from the main loop.
+  void loop()
+  {
+    if (!isStarted())
+      return;
+
+    for (auto &job : jobs)
+    {
+      xSemaphoreTake(queueLock, portMAX_DELAY);
+      bool completed = job.state == SlotState::SLOT_COMPLETED;
+      xSemaphoreGive(queueLock);
+      if (!completed)
+        continue;
+
+      switch (job.status)
+      {
+      case JobStatus::JOB_DONE:
+        stats.completed++;
+        break;
+      case JobStatus::JOB_FAILED:
+        stats.failed++;
+        break;
+      case JobStatus::JOB_TIMED_OUT:
+      default:
+        stats.timedOut++;
+        break;
+      }
+      stats.lastDuration = job.duration;
+      stats.maxDuration = max(stats.maxDuration, job.duration);
+
+      auto callback = std::move(job.callback);
+      auto status = job.status;
+      job.work = nullptr;
+      job.callback = nullptr;
+
+      xSemaphoreTake(queueLock, portMAX_DELAY);
+      job.state = SlotState::SLOT_FREE;
+      xSemaphoreGive(queueLock);
+
+      if (callback)
+        callback(status);
+    };
+  };
+
+  /// @brief Number of jobs which are queued or running
+  uint32_t pending()
+  {
+    uint32_t count = 0;
+    for (auto &job : jobs)
+    {
+      if (job.state == SlotState::SLOT_QUEUED || job.state == SlotState::SLOT_RUNNING)
+        count++;
+    };
+    return count;
+  };
+
+  /// @brief Blocks the caller until all jobs are done or timeout is expired. Used on shutdown.
+  bool drain(uint32_t timeout)
+  {
+    uint32_t started = esphome::millis();
+    while (pending() > 0 && (esphome::millis() - started) < timeout)
+    {
+      vTaskDelay(pdMS_TO_TICKS(10));
+    };
+    loop();
+    return pending() == 0;
+  };
+
+}; // namespace ioworker
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#define TAG_LINK_HEALTH "Link Health"
+
+#define LINK_RTT_BUCKETS 8
+#define LINK_MINUTES 60
+#define LINK_HOURS 24
+#define LINK_SILENT_TIMEOUTS 3  // Timeouts in a row with nothing heard to call the meter silent
+#define LINK_DEGRADED_LEVEL 0.9 // Availability of the last minute below this is degraded.
+
+namespace linkhealth
+{
+  /// @brief Modbus link state, from the best to the worst
+  enum LinkState
+  {
+    LINK_OK = 0,
+    LINK_DEGRADED, // Responses arrive, but some requests fail.
+    LINK_NOISY,    // Nothing valid in a row, but garbled frames or exceptions are received.
+    LINK_SILENT    // Nothing at all in a row: meter is unpowered or the line is cut.
+  };
+
+  static const char *const LINK_STATE_NAMES[] = {"ok", "degraded", "noisy", "silent"};
+
+  /// @brief ESPHome log message relevant to the link
+  enum LogEvent
+  {
+    LOG_OTHER = 0,
+    LOG_CRC_ERROR,
+    LOG_EXCEPTION
+  };
+
+  // Upper bound of each round-trip time bucket, ms. The last bucket is open.
+  static const uint32_t RTT_LIMITS[LINK_RTT_BUCKETS - 1] = {50, 100, 200, 300, 500, 1000, 2000};
+
+  /// @brief Request outcomes of one minute or one hour
+  struct Bucket
+  {
+    uint16_t requests;
+    uint16_t responses;
+  };
+
+  /// @brief Counters since boot
+  struct LinkStats
+  {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t crcErrors;
+    uint32_t exceptions;
+    uint32_t rtt[LINK_RTT_BUCKETS];
+  };
+
+  static LinkStats stats{};
+  static Bucket minutes[LINK_MINUTES]{};
+  static Bucket hours[LINK_HOURS]{};
+  static uint32_t currentMinute = 0; // millis() / 60000 of minutes[currentMinute % LINK_MINUTES]
+  static uint32_t failuresInRow = 0;
+  static uint32_t garbledInRow = 0; // CRC errors and exceptions since the last valid response
+  static bool paused = false;       // Meter is unpowered by a grid outage, failures say nothing about the link.
+
+  /// @brief Moves minute and hour rings to the current time, clearing skipped slots.
+  void advance(uint32_t now)
+  {
+    uint32_t minute = now / 60000;
+    if (minute == currentMinute)
+      return;
+
+    uint32_t elapsed = minute - currentMinute;
+    for (uint32_t i = 1; i <= elapsed && i <= LINK_MINUTES; i++)
+      minutes[(currentMinute + i) % LINK_MINUTES] = Bucket{};
+
+    uint32_t hour = minute / 60;
+    uint32_t lastHour = currentMinute / 60;
+    for (uint32_t i = 1; i <= hour - lastHour && i <= LINK_HOURS; i++)
+      hours[(lastHour + i) % LINK_HOURS] = Bucket{};
+    currentMinute = minute;
+  };
+
+  /// @brief Stops counting failures toward availability and link state while the grid is down.
+  /// Failures in a row start over when counting is resumed.
+  void setPaused(bool isPaused)
+  {
+    if (paused && !isPaused)
+    {
+      failuresInRow = 0;
+      garbledInRow = 0;
+    }
+    paused = isPaused;
+  };
+
+  void count(bool is_response)
+  {
+    if (paused)
+      return;
+    advance(esphome::millis());
+    Bucket &minute = minutes[currentMinute % LINK_MINUTES];
+    Bucket &hour = hours[currentMinute / 60 % LINK_HOURS];
+    minute.requests++;
+    hour.requests++;
+    if (!is_response)
+      return;
+    minute.responses++;
+    hour.responses++;
+  };
+
+  void onRequest()
+  {
+    stats.requests++;
+  };
+
+  /// @brief Valid response to the request
+  /// @param rtt ms from queueing the request to the response
+  void onResponse(uint32_t rtt)
+  {
+    int bucket = 0;
+    while (bucket < LINK_RTT_BUCKETS - 1 && rtt > RTT_LIMITS[bucket])
+      bucket++;
+    stats.rtt[bucket]++;
+    stats.responses++;
+    failuresInRow = 0;
+    garbledInRow = 0;
+    count(true);
+  };
+
+  /// @brief No valid response to the request
+  void onTimeout()
+  {
+    stats.timeouts++;
+    if (!paused)
+      failuresInRow++;
+    count(false);
+  };
+
+  /// @brief Exception response to the request. The request is over.
+  void onException()
+  {
+    stats.exceptions++;
+    if (!paused)
+    {
+      failuresInRow++;
+      garbledInRow++;
+    }
+    count(false);
+  };
+
+  void onCrcError()
+  {
+    stats.crcErrors++;
+    if (!paused)
+      garbledInRow++;
+  };
+
+  /// @brief Recognizes CRC failures and exception responses logged by ESPHome modbus components,
+  /// which don't expose them otherwise.
+  LogEvent parseLogMessage(const char *tag, const char *message)
+  {
+    if (tag == nullptr || message == nullptr)
+      return LOG_OTHER;
+    if (strcmp(tag, "modbus") == 0 && strstr(message, "CRC Check failed") != nullptr)
+      return LOG_CRC_ERROR;
+    if (strcmp(tag, "modbus_controller") == 0 && strstr(message, "Modbus error function code") != nullptr)
+      return LOG_EXCEPTION;
+    return LOG_OTHER;
+  };
+
+  /// @brief Share of answered requests in the window, NAN if there were no requests.
+  /// @param from slots back from the current one, 0 - the current slot
+  /// @param count slots in the window
+  float availability(const Bucket *ring, int size, uint32_t current, int from, int count)
+  {
+    uint32_t requests = 0;
+    uint32_t responses = 0;
+    for (int i = from; i < from + count && i < size; i++)
+    {
+      const Bucket &bucket = ring[(current + size - i) % size];
+      requests += bucket.requests;
+      responses += bucket.responses;
+    };
+    return requests == 0 ? NAN : static_cast<float>(responses) / requests;
+  };
+
+  /// @brief Availability of the last complete minute
+  float availabilityMinute()
+  {
+    advance(esphome::millis());
+    return availability(minutes, LINK_MINUTES, currentMinute, 1, 1);
+  };
+
+  /// @brief Availability of the last hour including the current minute
+  float availabilityHour()
+  {
+    advance(esphome::millis());
+    return availability(minutes, LINK_MINUTES, currentMinute, 0, LINK_MINUTES);
+  };
+
+  /// @brief Availability of the last 24 hours including the current hour
+  float availabilityDay()
+  {
+    advance(esphome::millis());
+    return availability(hours, LINK_HOURS, currentMinute / 60, 0, LINK_HOURS);
+  };
+
+  /// @brief Upper bound of the bucket holding the given share of round trips, ms. NAN if nothing is measured.
+  /// The open bucket reports twice the last limit.
+  float rttPercentile(float share)
+  {
+    uint32_t total = 0;
+    for (auto count : stats.rtt)
+      total += count;
+    if (total == 0)
+      return NAN;
+
+    uint32_t rank = ceilf(total * share);
+    uint32_t seen = 0;
+    for (int i = 0; i < LINK_RTT_BUCKETS - 1; i++)
+    {
+      seen += stats.rtt[i];
+      if (seen >= rank)
+        return RTT_LIMITS[i];
+    };
+    return RTT_LIMITS[LINK_RTT_BUCKETS - 2] * 2;
+  };
+
+  /// @brief Round-trip histogram as "<=50:12 <=100:3 ... >2000:0"
+  std::string rttHistogram()
+  {
+    std::string out;
+    char buffer[24];
+    for (int i = 0; i < LINK_RTT_BUCKETS; i++)
+    {
+      int length = i < LINK_RTT_BUCKETS - 1
+                       ? snprintf(buffer, sizeof(buffer), "%s<=%u:%u", i == 0 ? "" : " ",
+                                  static_cast<unsigned>(RTT_LIMITS[i]), static_cast<unsigned>(stats.rtt[i]))
+                       : snprintf(buffer, sizeof(buffer), " >%u:%u", static_cast<unsigned>(RTT_LIMITS[i - 1]),
+                                  static_cast<unsigned>(stats.rtt[i]));
+      out.append(buffer, length);
+    };
+    return out;
+  };
+
+  /// @brief Current link state. A line which garbles every frame is told apart from a silent meter.
+  LinkState state()
+  {
+    if (failuresInRow >= LINK_SILENT_TIMEOUTS)
+      return garbledInRow > 0 ? LINK_NOISY : LINK_SILENT;
+    float recent = availabilityMinute();
+    if (failuresInRow > 0 || (std::isfinite(recent) && recent < LINK_DEGRADED_LEVEL))
+      return LINK_DEGRADED;
+    return LINK_OK;
+  };
+
+}; // namespace linkhealth
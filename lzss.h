@@ -0,0 +1,260 @@
+#pragma once
+
+// Small-window LZSS compressor for event log archives. Shared by the firmware
+// and host-side tools, so this header must not depend on Arduino or ESPHome.
+//
+// Stream layout: LzssHeader, then groups of up to 8 tokens. Every group starts
+// with a flag byte (bit N set = token N is a literal byte). A match token is
+// 16-bit little-endian: (distance - 1) << LZSS_LENGTH_BITS | (length - LZSS_MIN_MATCH).
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define LZSS_MAGIC 0x315A4C43 // "CLZ1" in little-endian
+#define LZSS_VERSION 1
+#define LZSS_EXTENSION ".lzs"
+
+#define LZSS_WINDOW_BITS 11
+#define LZSS_LENGTH_BITS 5
+#define LZSS_WINDOW_SIZE (1 << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1)
+#define LZSS_HASH_BITS 10
+#define LZSS_HASH_SIZE (1 << LZSS_HASH_BITS)
+#define LZSS_MAX_CHAIN 16
+#define LZSS_GROUP_SIZE (1 + 8 * 2)
+#define LZSS_NO_POSITION 0xFFFF
+
+static_assert(LZSS_WINDOW_BITS + LZSS_LENGTH_BITS == 16, "Match token must fit 16 bits.");
+
+#pragma pack(push, 1)
+
+/// @brief Header of compressed file
+struct LzssHeader
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t windowBits;
+    uint8_t lengthBits;
+    uint8_t reserved;
+    uint32_t originalSize;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(LzssHeader) == 12, "Unexpected LZSS header size.");
+
+/// @brief Streaming encoder state (about 10 KiB).
+/// Input goes through lzssSink(), output is taken by lzssPoll().
+struct LzssEncoder
+{
+    uint8_t buffer[2 * LZSS_WINDOW_SIZE]; // Window followed by lookahead.
+    uint16_t head[LZSS_HASH_SIZE];
+    uint16_t prev[LZSS_WINDOW_SIZE];
+    uint16_t position; // Next byte to encode.
+    uint16_t length;   // Bytes in buffer.
+    uint8_t group[LZSS_GROUP_SIZE];
+    uint8_t groupLength;
+    uint8_t tokens;
+};
+
+inline LzssHeader lzssMakeHeader(uint32_t originalSize)
+{
+    return LzssHeader{LZSS_MAGIC, LZSS_VERSION, LZSS_WINDOW_BITS, LZSS_LENGTH_BITS, 0, originalSize};
+}
+
+inline bool lzssHeaderIsValid(const LzssHeader &header)
+{
+    return header.magic == LZSS_MAGIC &&
+           header.version == LZSS_VERSION &&
+           header.windowBits == LZSS_WINDOW_BITS &&
+           header.lengthBits == LZSS_LENGTH_BITS;
+}
+
+inline void lzssReset(LzssEncoder &encoder)
+{
+    memset(encoder.head, 0xFF, sizeof(encoder.head));
+    memset(encoder.prev, 0xFF, sizeof(encoder.prev));
+    encoder.position = 0;
+    encoder.length = 0;
+    encoder.group[0] = 0;
+    encoder.groupLength = 1;
+    encoder.tokens = 0;
+}
+
+inline uint16_t lzssHash(const uint8_t *data)
+{
+    return ((data[0] << 6) ^ (data[1] << 3) ^ data[2]) & (LZSS_HASH_SIZE - 1);
+}
+
+/// @brief Drops the oldest half of the buffer when it is full and already encoded.
+inline void lzssSlide(LzssEncoder &encoder)
+{
+    memmove(encoder.buffer, encoder.buffer + LZSS_WINDOW_SIZE, encoder.length - LZSS_WINDOW_SIZE);
+    encoder.position -= LZSS_WINDOW_SIZE;
+    encoder.length -= LZSS_WINDOW_SIZE;
+    for (auto &entry : encoder.head)
+        entry = (entry != LZSS_NO_POSITION && entry >= LZSS_WINDOW_SIZE) ? entry - LZSS_WINDOW_SIZE : LZSS_NO_POSITION;
+    for (auto &entry : encoder.prev)
+        entry = (entry != LZSS_NO_POSITION && entry >= LZSS_WINDOW_SIZE) ? entry - LZSS_WINDOW_SIZE : LZSS_NO_POSITION;
+}
+
+/// @brief Copies input into the encoder.
+/// @return Number of consumed bytes. Zero means lzssPoll() must be called first.
+inline size_t lzssSink(LzssEncoder &encoder, const uint8_t *data, size_t size)
+{
+    if (encoder.length == sizeof(encoder.buffer) && encoder.position >= LZSS_WINDOW_SIZE)
+        lzssSlide(encoder);
+
+    size_t count = sizeof(encoder.buffer) - encoder.length;
+    if (count > size)
+        count = size;
+    memcpy(encoder.buffer + encoder.length, data, count);
+    encoder.length += count;
+    return count;
+}
+
+inline void lzssInsert(LzssEncoder &encoder, uint16_t position)
+{
+    if (position + LZSS_MIN_MATCH > encoder.length)
+        return;
+    uint16_t hash = lzssHash(encoder.buffer + position);
+    encoder.prev[position % LZSS_WINDOW_SIZE] = encoder.head[hash];
+    encoder.head[hash] = position;
+}
+
+/// @brief Finds the longest match for the current position.
+/// @return Match length (less than LZSS_MIN_MATCH if there is no match)
+inline uint16_t lzssFindMatch(const LzssEncoder &encoder, uint16_t &distance)
+{
+    uint16_t position = encoder.position;
+    uint16_t limit = encoder.length - position;
+    if (limit > LZSS_MAX_MATCH)
+        limit = LZSS_MAX_MATCH;
+    if (limit < LZSS_MIN_MATCH)
+        return 0;
+
+    const uint8_t *current = encoder.buffer + position;
+    uint16_t best = 0;
+    uint16_t candidate = encoder.head[lzssHash(current)];
+    for (int chain = 0; chain < LZSS_MAX_CHAIN && candidate != LZSS_NO_POSITION; chain++)
+    {
+        // Chain entries overwritten by newer positions are not monotonic anymore.
+        if (candidate >= position || position - candidate > LZSS_WINDOW_SIZE)
+            break;
+
+        const uint8_t *match = encoder.buffer + candidate;
+        uint16_t length = 0;
+        while (length < limit && match[length] == current[length])
+            length++;
+        if (length > best)
+        {
+            best = length;
+            distance = position - candidate;
+            if (best == limit)
+                break;
+        }
+        candidate = encoder.prev[candidate % LZSS_WINDOW_SIZE];
+    }
+    return best;
+}
+
+/// @brief Encodes buffered input.
+/// @param out Output buffer
+/// @param size Output buffer size. Must be at least LZSS_GROUP_SIZE bytes.
+/// @param finish Encode the tail of the stream (no more input will be provided)
+/// @return Number of bytes put into the output buffer
+inline size_t lzssPoll(LzssEncoder &encoder, uint8_t *out, size_t size, bool finish)
+{
+    size_t written = 0;
+    for (;;)
+    {
+        if (encoder.tokens == 8)
+        {
+            if (size - written < encoder.groupLength)
+                break;
+            memcpy(out + written, encoder.group, encoder.groupLength);
+            written += encoder.groupLength;
+            encoder.group[0] = 0;
+            encoder.groupLength = 1;
+            encoder.tokens = 0;
+        }
+
+        uint16_t available = encoder.length - encoder.position;
+        if (available == 0 || (!finish && available < LZSS_MAX_MATCH))
+            break;
+
+        uint16_t distance = 0;
+        uint16_t length = lzssFindMatch(encoder, distance);
+        if (length >= LZSS_MIN_MATCH)
+        {
+            uint16_t token = ((distance - 1) << LZSS_LENGTH_BITS) | (length - LZSS_MIN_MATCH);
+            encoder.group[encoder.groupLength++] = token & 0xFF;
+            encoder.group[encoder.groupLength++] = token >> 8;
+        }
+        else
+        {
+            length = 1;
+            encoder.group[0] |= 1 << encoder.tokens;
+            encoder.group[encoder.groupLength++] = encoder.buffer[encoder.position];
+        }
+        encoder.tokens++;
+
+        for (uint16_t i = 0; i < length; i++)
+            lzssInsert(encoder, encoder.position + i);
+        encoder.position += length;
+    }
+
+    // Partial group is emitted at the end of the stream only.
+    if (finish && encoder.position == encoder.length && encoder.tokens > 0 &&
+        size - written >= encoder.groupLength)
+    {
+        memcpy(out + written, encoder.group, encoder.groupLength);
+        written += encoder.groupLength;
+        encoder.group[0] = 0;
+        encoder.groupLength = 1;
+        encoder.tokens = 0;
+    }
+    return written;
+}
+
+/// @brief True when all input has been encoded and taken by lzssPoll().
+inline bool lzssIsFinished(const LzssEncoder &encoder)
+{
+    return encoder.position == encoder.length && encoder.tokens == 0;
+}
+
+/// @brief Decodes the whole stream (without header) into the output buffer.
+/// @return Number of decoded bytes or -1 if the stream is malformed
+inline long lzssDecode(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize)
+{
+    size_t read = 0;
+    size_t written = 0;
+    while (read < inSize)
+    {
+        uint8_t flags = in[read++];
+        for (int token = 0; token < 8 && read < inSize; token++)
+        {
+            if (flags & (1 << token))
+            {
+                if (written == outSize)
+                    return -1;
+                out[written++] = in[read++];
+                continue;
+            }
+
+            if (inSize - read < 2)
+                return -1;
+            uint16_t value = in[read] | (in[read + 1] << 8);
+            read += 2;
+            size_t distance = (value >> LZSS_LENGTH_BITS) + 1;
+            size_t length = (value & ((1 << LZSS_LENGTH_BITS) - 1)) + LZSS_MIN_MATCH;
+            if (distance > written || outSize - written < length)
+                return -1;
+            for (size_t i = 0; i < length; i++, written++)
+                out[written] = out[written - distance];
+        }
+    }
+    return static_cast<long>(written);
+}
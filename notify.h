@@ -0,0 +1,264 @@
+#pragma once
+
+#include "problems.h"
+#include "tg_bot_strings.h"
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <string>
+
+#define TAG_NOTIFY "Notify"
+
+#define NOTIFY_QUEUE_CAPACITY 8
+#define NOTIFY_DIGEST_WINDOW 10000 // ms, transitions within the window are sent as one message.
+#define NOTIFY_DIGEST_SIZE 1024
+
+namespace notify
+{
+  enum Channel
+  {
+    CHANNEL_PROBLEMS = 0, // Problem alerts and digests
+    CHANNEL_REPORTS = 1,  // Daily, monthly and yearly reports
+    CHANNEL_COUNT = 2
+  };
+
+  /// @brief Token bucket. Each message takes one token, tokens are refilled over time.
+  struct TokenBucket
+  {
+    float capacity;
+    float period; // ms to refill one token
+    float tokens;
+    uint32_t updated;
+  };
+
+  /// @brief Message waiting to be sent
+  struct Message
+  {
+    Channel channel;
+    bool silent;
+    bool priority;
+    std::string text;
+  };
+
+  /// @brief Latest transition of a problem not sent yet
+  struct PendingProblem
+  {
+    bool active;
+    ProblemState state;
+    double value;
+    uint32_t transitions;
+    uint32_t since;
+  };
+
+  /// @brief Counters of the dispatcher
+  struct NotifyStats
+  {
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t merged;  // Transitions folded into another message.
+    uint32_t dropped; // Messages lost on queue overflow.
+    uint32_t depth;
+    uint32_t maxDepth;
+  };
+
+  static std::string sourceName;
+  static Message queue[NOTIFY_QUEUE_CAPACITY];
+  static NotifyStats stats{};
+  static PendingProblem pendingProblems[PROBLEMS_COUNT]{};
+  static ProblemState reportedStates[PROBLEMS_COUNT]{};
+
+  // Alerts of one problem: burst of 2, then one per 5 minutes.
+  static TokenBucket problemBuckets[PROBLEMS_COUNT];
+  // Burst of 4 messages, then one per 30 seconds per channel.
+  static TokenBucket channelBuckets[CHANNEL_COUNT];
+
+  void refill(TokenBucket &bucket, uint32_t now)
+  {
+    bucket.tokens += (now - bucket.updated) / bucket.period;
+    if (bucket.tokens > bucket.capacity)
+      bucket.tokens = bucket.capacity;
+    bucket.updated = now;
+  };
+
+  bool hasToken(TokenBucket &bucket, uint32_t now)
+  {
+    refill(bucket, now);
+    return bucket.tokens >= 1.0f;
+  };
+
+  void takeToken(TokenBucket &bucket, uint32_t now)
+  {
+    refill(bucket, now);
+    bucket.tokens = bucket.tokens >= 1.0f ? bucket.tokens - 1.0f : 0.0f;
+  };
+
+  void setup(const char *name)
+  {
+    sourceName = name;
+    uint32_t now = esphome::millis();
+    for (auto &bucket : problemBuckets)
+      bucket = TokenBucket{2, 300000, 2, now};
+    for (auto &bucket : channelBuckets)
+      bucket = TokenBucket{4, 30000, 4, now};
+  };
+
+  /// @brief Adds a message to the queue. Priority messages are put ahead of all others.
+  /// If the queue is full, the oldest regular message is dropped.
+  bool push(Channel channel, std::string text, bool silent, bool priority = false)
+  {
+    if (stats.depth == NOTIFY_QUEUE_CAPACITY)
+    {
+      int victim = -1;
+      for (int i = 0; i < NOTIFY_QUEUE_CAPACITY; i++)
+      {
+        if (!queue[i].priority)
+        {
+          victim = i;
+          break;
+        }
+      };
+      stats.dropped++;
+      if (victim < 0)
+      {
+        ESP_LOGW(TAG_NOTIFY, "Queue is full. Message is dropped.");
+        return false;
+      }
+      ESP_LOGW(TAG_NOTIFY, "Queue is full. The oldest message is dropped.");
+      for (uint32_t i = victim; i + 1 < stats.depth; i++)
+        queue[i] = std::move(queue[i + 1]);
+      stats.depth--;
+    }
+
+    uint32_t position = stats.depth;
+    if (priority)
+    {
+      position = 0;
+      while (position < stats.depth && queue[position].priority)
+        position++;
+      for (uint32_t i = stats.depth; i > position; i--)
+        queue[i] = std::move(queue[i - 1]);
+    }
+    queue[position] = Message{channel, silent, priority, std::move(text)};
+    stats.depth++;
+    stats.queued++;
+    if (stats.depth > stats.maxDepth)
+      stats.maxDepth = stats.depth;
+    return true;
+  };
+
+  /// @brief Queues a report message.
+  bool report(std::string text, bool silent)
+  {
+    return push(CHANNEL_REPORTS, std::move(text), silent);
+  };
+
+  /// @brief Registers a problem transition. Power failure is queued right away ahead of
+  /// everything else, other transitions are collected into a digest.
+  /// @param value measured value at detection time, NAN if there's none
+  void problem(Problems problem, ProblemState state, double value = NAN)
+  {
+    if (problem == Problems::GENERIC_POWER_FAILURE)
+    {
+      reportedStates[problem] = state;
+      push(CHANNEL_PROBLEMS, generateProblemMessage(sourceName.c_str(), problem, state, value), false, true);
+      return;
+    }
+
+    PendingProblem &pending = pendingProblems[problem];
+    if (pending.active)
+      stats.merged++;
+    else
+      pending = PendingProblem{true, state, value, 0, esphome::millis()};
+    pending.state = state;
+    pending.value = value;
+    pending.transitions++;
+  };
+
+  /// @brief Builds a message of problems whose window is over and which have tokens left.
+  /// Problems out of tokens are kept pending and go on merging.
+  void flushProblems(uint32_t now)
+  {
+    int ready[PROBLEMS_COUNT];
+    int count = 0;
+    for (int i = 0; i < PROBLEMS_COUNT; i++)
+    {
+      PendingProblem &pending = pendingProblems[i];
+      if (!pending.active || now - pending.since < NOTIFY_DIGEST_WINDOW)
+        continue;
+      if (pending.state == reportedStates[i])
+      {
+        // State went back to the reported one. Nothing to tell.
+        stats.merged++;
+        pending.active = false;
+        continue;
+      }
+      if (!hasToken(problemBuckets[i], now))
+        continue;
+      takeToken(problemBuckets[i], now);
+      ready[count++] = i;
+    };
+
+    if (count == 0)
+      return;
+
+    if (count == 1)
+    {
+      auto problem = static_cast<Problems>(ready[0]);
+      PendingProblem &pending = pendingProblems[problem];
+      push(CHANNEL_PROBLEMS, generateProblemMessage(sourceName.c_str(), problem, pending.state, pending.value), false);
+    }
+    else
+    {
+      char buffer[NOTIFY_DIGEST_SIZE];
+      int length = snprintf(buffer, sizeof(buffer), TG_DIGEST_HEADER, count, sourceName.c_str());
+      for (int i = 0; i < count; i++)
+      {
+        auto problem = static_cast<Problems>(ready[i]);
+        PendingProblem &pending = pendingProblems[problem];
+        if (length < 0 || length >= static_cast<int>(sizeof(buffer)))
+          break;
+        if (isfinite(pending.value))
+          length += snprintf(buffer + length, sizeof(buffer) - length, TG_DIGEST_LINE_WITH_VALUE,
+                             getProblemDescriptor(problem).name, STATE_NAMES[pending.state],
+                             pending.value, getProblemDescriptor(problem).measure, pending.transitions);
+        else
+          length += snprintf(buffer + length, sizeof(buffer) - length, TG_DIGEST_LINE,
+                             getProblemDescriptor(problem).name, STATE_NAMES[pending.state], pending.transitions);
+      };
+      // Several problems in one message are merges too.
+      stats.merged += count - 1;
+      push(CHANNEL_PROBLEMS, std::string(buffer), false);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      reportedStates[ready[i]] = pendingProblems[ready[i]].state;
+      pendingProblems[ready[i]].active = false;
+    };
+  };
+
+  /// @brief Takes the next message to send: priority ones first, then the oldest one
+  /// whose channel has a token. Should be called only when the previous message is sent.
+  /// @return false if there's nothing to send now
+  bool take(std::string &text, bool &silent)
+  {
+    uint32_t now = esphome::millis();
+    flushProblems(now);
+
+    for (uint32_t i = 0; i < stats.depth; i++)
+    {
+      Message &message = queue[i];
+      if (!message.priority && !hasToken(channelBuckets[message.channel], now))
+        continue;
+      takeToken(channelBuckets[message.channel], now);
+      text = std::move(message.text);
+      silent = message.silent;
+      for (uint32_t j = i; j + 1 < stats.depth; j++)
+        queue[j] = std::move(queue[j + 1]);
+      stats.depth--;
+      stats.sent++;
+      return true;
+    };
+    return false;
+  };
+
+}; // namespace notify
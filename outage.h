@@ -0,0 +1,271 @@
+#pragma once
+
+#include "acquisition.h"
+#include "settings.h"
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <cmath>
+#include <string>
+
+#define TAG_OUTAGE "Outage"
+
+#define OUTAGE_COLLAPSE_LEVEL 0.5   // of VOLTAGE_LEVEL, every phase below it is a collapse.
+#define OUTAGE_TREND_DROP 0.3       // Every phase falling by this share from the previous reading is a collapse too.
+#define OUTAGE_RESTORE_LEVEL 0.8    // of VOLTAGE_LEVEL, every phase above it is normal.
+#define OUTAGE_SILENCE_TIMEOUT 200  // ms without a response to call the meter silent
+#define OUTAGE_CONFIRM_TIMEOUT 1000 // ms a single sign waits for a second one
+#define OUTAGE_RESTORE_DELAY 1000   // ms of normal voltage before power is back
+
+namespace outage
+{
+  enum DetectorState
+  {
+    DETECTOR_UNKNOWN = 0, // Nothing is known after boot yet.
+    DETECTOR_POWERED,
+    DETECTOR_SUSPECT, // One sign of outage, waiting for confirmation
+    DETECTOR_OUTAGE,
+    DETECTOR_RESTORING // Normal voltage is back, waiting for it to hold
+  };
+
+  static const char *const DETECTOR_STATE_NAMES[] = {"unknown", "powered", "suspect", "outage", "restoring"};
+
+  /// @brief Independent signs of outage, bit mask
+  enum Evidence
+  {
+    EVIDENCE_AC_LOST = 1,           // UPS reports no AC input.
+    EVIDENCE_VOLTAGE_COLLAPSE = 2,  // Meter reports collapsing voltage on every phase.
+    EVIDENCE_METER_SILENT = 4       // Meter doesn't answer, it is powered by the grid.
+  };
+
+  static const int EVIDENCE_COUNT = 3;
+
+  /// @brief Detector counters
+  struct OutageStats
+  {
+    uint32_t detections;
+    uint32_t falseAlarms;         // Single signs not confirmed in time
+    uint32_t lastLatency;         // ms from the earliest sign still present to the confirmation
+    uint32_t maxLatency;          // ms
+    uint32_t lastHandlingLatency; // ms from the earliest sign to the start of power failure actions
+    uint32_t maxHandlingLatency;  // ms
+  };
+
+  static DetectorState state = DETECTOR_UNKNOWN;
+  static uint8_t evidence = 0;
+  static uint8_t dismissed = 0; // Signs not confirmed in time, they don't start a new suspicion until cleared.
+  static uint32_t suspectStart = 0;  // millis() the suspicion has started
+  static uint32_t signSince[EVIDENCE_COUNT]{}; // millis() each sign has been raised, indexed by bit
+  static uint32_t outageSince = 0;             // millis() of the earliest sign of the confirmed outage
+  static uint32_t restoreStart = 0;  // millis() of the first normal reading after outage
+  static float lastVoltages[3] = {NAN, NAN, NAN};
+  static OutageStats stats{};
+
+  int evidenceCount(uint8_t mask)
+  {
+    return __builtin_popcount(mask);
+  };
+
+  std::string evidenceNames(uint8_t mask)
+  {
+    std::string out;
+    auto append = [&out](const char *name)
+    {
+      if (!out.empty())
+        out += ", ";
+      out += name;
+    };
+    if (mask & EVIDENCE_AC_LOST)
+      append("AC input lost");
+    if (mask & EVIDENCE_VOLTAGE_COLLAPSE)
+      append("voltage collapse");
+    if (mask & EVIDENCE_METER_SILENT)
+      append("meter silent");
+    return out;
+  };
+
+  /// @brief Raises the sign, keeping the time it has been raised first.
+  void raise(uint8_t sign, uint32_t now)
+  {
+    if (!(evidence & sign))
+      signSince[__builtin_ctz(sign)] = now;
+    evidence |= sign;
+  };
+
+  /// @brief Clears the sign. A cleared sign may start a new suspicion when it is raised again.
+  void clear(uint8_t sign)
+  {
+    evidence &= ~sign;
+    dismissed &= ~sign;
+  };
+
+  /// @brief millis() of the earliest sign still present
+  uint32_t firstSign(uint32_t now)
+  {
+    uint32_t first = now;
+    for (int i = 0; i < EVIDENCE_COUNT; i++)
+    {
+      if ((evidence & (1 << i)) && static_cast<int32_t>(signSince[i] - first) < 0)
+        first = signSince[i];
+    };
+    return first;
+  };
+
+  void setState(DetectorState next)
+  {
+    if (next == state)
+      return;
+    ESP_LOGD(TAG_OUTAGE, "Detector state %s -> %s.", DETECTOR_STATE_NAMES[state], DETECTOR_STATE_NAMES[next]);
+    state = next;
+  };
+
+  /// @brief Applies a change of signs. Two independent signs confirm the outage,
+  /// a single one makes the detector ask the meter for voltage right away.
+  void evaluate(uint32_t now)
+  {
+    switch (state)
+    {
+    case DETECTOR_UNKNOWN:
+    case DETECTOR_POWERED:
+      if ((evidence & ~dismissed) == 0)
+        break;
+      suspectStart = now;
+      setState(DETECTOR_SUSPECT);
+      acquisition::expedite(acquisition::VOLTAGE_A);
+      [[fallthrough]]; // A second sign may be there already.
+    case DETECTOR_SUSPECT:
+      if (evidenceCount(evidence) >= 2)
+      {
+        outageSince = firstSign(now);
+        uint32_t latency = now - outageSince;
+        stats.detections++;
+        stats.lastLatency = latency;
+        if (latency > stats.maxLatency)
+          stats.maxLatency = latency;
+        ESP_LOGW(TAG_OUTAGE, "Power failure is confirmed in %u ms by %s.", static_cast<unsigned>(latency),
+                 evidenceNames(evidence).c_str());
+        setState(DETECTOR_OUTAGE);
+      }
+      else if (evidence == 0)
+      {
+        setState(DETECTOR_POWERED);
+      }
+      break;
+    case DETECTOR_RESTORING:
+      if ((evidence & ~dismissed) != 0)
+        setState(DETECTOR_OUTAGE);
+      break;
+    default:
+      break;
+    }
+  };
+
+  /// @brief Raw UPS AC input state. Should be called on every edge, before any debounce filter.
+  void onAcInput(bool isPresent)
+  {
+    uint32_t now = esphome::millis();
+    if (isPresent)
+      clear(EVIDENCE_AC_LOST);
+    else
+      raise(EVIDENCE_AC_LOST, now);
+    evaluate(now);
+  };
+
+  /// @brief Meter response. Should be called with every frame from acquisition.
+  void onFrame(const acquisition::Frame &frame, uint32_t updated)
+  {
+    uint32_t now = esphome::millis();
+    clear(EVIDENCE_METER_SILENT);
+    if (!(updated & acquisition::channelBit(acquisition::VOLTAGE_A)))
+    {
+      evaluate(now);
+      return;
+    }
+
+    const float *voltages = &frame.values[acquisition::VOLTAGE_A];
+    bool is_collapse = true;
+    bool is_normal = true;
+    for (int i = 0; i < 3; i++)
+    {
+      float voltage = voltages[i];
+      bool is_falling = std::isfinite(lastVoltages[i]) && lastVoltages[i] > 0 &&
+                        voltage <= lastVoltages[i] * (1 - OUTAGE_TREND_DROP);
+      is_collapse &= voltage < VOLTAGE_LEVEL * OUTAGE_COLLAPSE_LEVEL || is_falling;
+      is_normal &= voltage > VOLTAGE_LEVEL * OUTAGE_RESTORE_LEVEL;
+      lastVoltages[i] = voltage;
+    };
+
+    if (is_collapse)
+      raise(EVIDENCE_VOLTAGE_COLLAPSE, now);
+    else
+      clear(EVIDENCE_VOLTAGE_COLLAPSE);
+
+    if (is_normal && state == DETECTOR_UNKNOWN)
+    {
+      dismissed |= evidence;
+      setState(DETECTOR_POWERED);
+      return;
+    }
+    // The meter keeps running from its supply for a while and updates RMS values about once a second,
+    // so normal voltage right after the first sign proves nothing. The voltage is read again
+    // until a second sign comes or OUTAGE_CONFIRM_TIMEOUT dismisses the first one.
+    if (is_normal && state == DETECTOR_SUSPECT)
+      acquisition::expedite(acquisition::VOLTAGE_A);
+    if (is_normal && state == DETECTOR_OUTAGE)
+    {
+      restoreStart = now;
+      setState(DETECTOR_RESTORING);
+    }
+    evaluate(now);
+  };
+
+  /// @brief Tracks meter silence and timers. Should be called from main loop at least every 50 ms.
+  void loop()
+  {
+    uint32_t now = esphome::millis();
+    if (acquisition::requestAge() >= OUTAGE_SILENCE_TIMEOUT)
+      raise(EVIDENCE_METER_SILENT, now);
+
+    if (state == DETECTOR_SUSPECT && evidenceCount(evidence) < 2 && now - suspectStart >= OUTAGE_CONFIRM_TIMEOUT)
+    {
+      // A silent meter alone is a link fault, a lone AC sign is a UPS input fault.
+      stats.falseAlarms++;
+      ESP_LOGW(TAG_OUTAGE, "Outage sign (%s) is not confirmed in %u ms.", evidenceNames(evidence).c_str(),
+               static_cast<unsigned>(now - suspectStart));
+      dismissed |= evidence;
+      setState(DETECTOR_POWERED);
+      return;
+    }
+
+    if (state == DETECTOR_RESTORING && (evidence & ~dismissed) == 0 && now - restoreStart >= OUTAGE_RESTORE_DELAY)
+    {
+      ESP_LOGI(TAG_OUTAGE, "Power is back.");
+      setState(DETECTOR_POWERED);
+      return;
+    }
+    evaluate(now);
+  };
+
+  /// @brief Should be called once power failure actions are started. Logs latency of the whole path.
+  void onFailureHandled()
+  {
+    if (state != DETECTOR_OUTAGE && state != DETECTOR_RESTORING)
+      return;
+    uint32_t latency = esphome::millis() - outageSince;
+    stats.lastHandlingLatency = latency;
+    if (latency > stats.maxHandlingLatency)
+      stats.maxHandlingLatency = latency;
+    ESP_LOGW(TAG_OUTAGE, "Power failure actions have been started in %u ms from the first sign.", static_cast<unsigned>(latency));
+  };
+
+  bool isKnown()
+  {
+    return state != DETECTOR_UNKNOWN;
+  };
+
+  /// @brief Grid power is present. An unconfirmed sign doesn't count.
+  bool isPowered()
+  {
+    return state == DETECTOR_POWERED || state == DETECTOR_SUSPECT;
+  };
+
+}; // namespace outage
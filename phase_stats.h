@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace phasestats
+{
+  enum Channel
+  {
+    CHANNEL_VOLTAGE_A = 0,
+    CHANNEL_VOLTAGE_B = 1,
+    CHANNEL_VOLTAGE_C = 2,
+    CHANNEL_CURRENT_A = 3,
+    CHANNEL_CURRENT_B = 4,
+    CHANNEL_CURRENT_C = 5,
+    CHANNEL_FREQUENCY = 6,
+    CHANNEL_COUNT = 7
+  };
+
+  /// @brief P-square quantile estimator (Jain & Chlamtac, 1985).
+  /// Five markers track the quantile without storing samples.
+  struct Quantile
+  {
+    float p;
+    float heights[5];
+    int32_t positions[5]; // 0-based
+  };
+
+  /// @brief Streaming statistics of one channel
+  struct Accumulator
+  {
+    uint32_t count;
+    float min;
+    float max;
+    double mean;
+    double m2; // Sum of squared deviations from the mean (Welford).
+    Quantile p5;
+    Quantile p50;
+    Quantile p95;
+  };
+
+  /// @brief Statistics of one channel at the end of a period
+  struct Summary
+  {
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    float stddev;
+    float p5;
+    float p50;
+    float p95;
+  };
+
+  /// @brief Summaries of all channels, a value type to pass to the I/O worker.
+  struct Summaries
+  {
+    Summary channels[CHANNEL_COUNT];
+  };
+
+  static Accumulator accumulators[CHANNEL_COUNT];
+
+  /// @brief Desired position of the marker after count samples.
+  float desiredPosition(const Quantile &quantile, int marker, uint32_t count)
+  {
+    const float increments[5] = {0.0f, quantile.p / 2.0f, quantile.p, (1.0f + quantile.p) / 2.0f, 1.0f};
+    return (count - 1) * increments[marker];
+  };
+
+  void resetQuantile(Quantile &quantile, float p)
+  {
+    quantile = Quantile{};
+    quantile.p = p;
+  };
+
+  void addQuantile(Quantile &quantile, float value, uint32_t count)
+  {
+    float *q = quantile.heights;
+    int32_t *n = quantile.positions;
+
+    // Samples are kept sorted until all markers are set.
+    if (count <= 5)
+    {
+      int i = count - 1;
+      while (i > 0 && q[i - 1] > value)
+      {
+        q[i] = q[i - 1];
+        i--;
+      };
+      q[i] = value;
+      n[count - 1] = count - 1;
+      return;
+    }
+
+    int cell;
+    if (value < q[0])
+    {
+      q[0] = value;
+      cell = 0;
+    }
+    else if (value >= q[4])
+    {
+      q[4] = value;
+      cell = 3;
+    }
+    else
+    {
+      cell = 0;
+      while (cell < 3 && value >= q[cell + 1])
+        cell++;
+    }
+    for (int i = cell + 1; i < 5; i++)
+      n[i]++;
+
+    for (int i = 1; i < 4; i++)
+    {
+      float delta = desiredPosition(quantile, i, count) - n[i];
+      if ((delta >= 1.0f && n[i + 1] - n[i] > 1) || (delta <= -1.0f && n[i - 1] - n[i] < -1))
+      {
+        int d = delta > 0 ? 1 : -1;
+        float parabolic = q[i] + static_cast<float>(d) / (n[i + 1] - n[i - 1]) *
+                                     ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                                      (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+        if (q[i - 1] < parabolic && parabolic < q[i + 1])
+          q[i] = parabolic;
+        else
+          q[i] = q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+        n[i] += d;
+      }
+    };
+  };
+
+  float getQuantile(const Quantile &quantile, uint32_t count)
+  {
+    if (count == 0)
+      return NAN;
+    // Markers hold the sorted samples themselves until they start moving.
+    if (count <= 5)
+      return quantile.heights[static_cast<int>(roundf((count - 1) * quantile.p))];
+    return quantile.heights[2];
+  };
+
+  /// @brief Resets all channels. Should be called when a new day starts.
+  void reset()
+  {
+    for (auto &accumulator : accumulators)
+    {
+      accumulator = Accumulator{};
+      accumulator.min = NAN;
+      accumulator.max = NAN;
+      resetQuantile(accumulator.p5, 0.05f);
+      resetQuantile(accumulator.p50, 0.50f);
+      resetQuantile(accumulator.p95, 0.95f);
+    };
+  };
+
+  void add(Channel channel, float value)
+  {
+    if (!std::isfinite(value))
+      return;
+
+    Accumulator &accumulator = accumulators[channel];
+    accumulator.count++;
+    if (accumulator.count == 1 || value < accumulator.min)
+      accumulator.min = value;
+    if (accumulator.count == 1 || value > accumulator.max)
+      accumulator.max = value;
+
+    double delta = value - accumulator.mean;
+    accumulator.mean += delta / accumulator.count;
+    accumulator.m2 += delta * (value - accumulator.mean);
+
+    addQuantile(accumulator.p5, value, accumulator.count);
+    addQuantile(accumulator.p50, value, accumulator.count);
+    addQuantile(accumulator.p95, value, accumulator.count);
+  };
+
+  Summary summarize(Channel channel)
+  {
+    const Accumulator &accumulator = accumulators[channel];
+    Summary summary{};
+    summary.count = accumulator.count;
+    summary.min = accumulator.min;
+    summary.max = accumulator.max;
+    summary.mean = accumulator.count > 0 ? static_cast<float>(accumulator.mean) : NAN;
+    summary.stddev = accumulator.count > 1 ? static_cast<float>(sqrt(accumulator.m2 / (accumulator.count - 1))) : NAN;
+    summary.p5 = getQuantile(accumulator.p5, accumulator.count);
+    summary.p50 = getQuantile(accumulator.p50, accumulator.count);
+    summary.p95 = getQuantile(accumulator.p95, accumulator.count);
+    return summary;
+  };
+
+  Summaries summarizeAll()
+  {
+    Summaries summaries{};
+    for (int i = 0; i < CHANNEL_COUNT; i++)
+      summaries.channels[i] = summarize(static_cast<Channel>(i));
+    return summaries;
+  };
+
+}; // namespace phasestats
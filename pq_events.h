@@ -0,0 +1,322 @@
+#pragma once
+
+#include "io_worker.h"
+#include "pq_format.h"
+#include "sd_metrics.h"
+#include "sdcard.h"
+#include "settings.h"
+#include "tg_bot_strings.h"
+#include <FS.h>
+#include <SD.h>
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <esphome/core/time.h>
+#include <string>
+
+#define TAG_PQ_EVENTS "PQ Events"
+
+#define PQ_PHASES 3
+#define PQ_SAG_LEVEL 0.90          // of VOLTAGE_LEVEL, EN 50160
+#define PQ_SWELL_LEVEL 1.10        // of VOLTAGE_LEVEL
+#define PQ_INTERRUPTION_LEVEL 0.05 // Residual voltage of interruption, of VOLTAGE_LEVEL
+#define PQ_HYSTERESIS 0.02         // of VOLTAGE_LEVEL, to end an event
+#define PQ_PENDING_EVENTS 4
+#define PQ_DURATION_CLASSES 5
+#define PQ_SAG_CLASSES 4
+#define PQ_SWELL_CLASSES 2
+#define PQ_DATE_MODE sdcard::DateDirectoryMode::BY_YEAR_THEN_BY_MONTH
+
+namespace pqevents
+{
+  /// @brief Detector state of one phase
+  struct PhaseState
+  {
+    uint16_t ring[PQ_EVENT_PRE_SAMPLES]; // Pre-trigger samples
+    uint8_t ringHead;
+    uint8_t ringCount;
+    uint8_t postCount;
+    bool active;    // Voltage is out of range.
+    bool recording; // Event is over, but post-trigger samples are still collected.
+    bool isUnder;   // Sag or interruption, swell otherwise
+    uint32_t lastSample;
+    float samplePeriod; // ms, moving average
+    uint32_t started;   // millis()
+    PqEventRecord record;
+  };
+
+  /// @brief Completed event waiting for the wall clock and the I/O worker
+  struct PendingEvent
+  {
+    bool used;
+    uint32_t started; // millis()
+    PqEventRecord record;
+  };
+
+  /// @brief Counters of the detector
+  struct PqStats
+  {
+    uint32_t events;
+    uint32_t written;
+    uint32_t dropped;
+    uint32_t failed;
+  };
+
+  static const uint32_t DURATION_CLASS_LIMITS[PQ_DURATION_CLASSES - 1] = {1000, 5000, 60000, 180000}; // ms
+  static const float SAG_CLASS_LIMITS[PQ_SAG_CLASSES - 1] = {0.80, 0.70, 0.40}; // Residual voltage, of VOLTAGE_LEVEL
+  static const float SWELL_CLASS_LIMITS[PQ_SWELL_CLASSES - 1] = {1.20};         // Peak voltage, of VOLTAGE_LEVEL
+
+  static PhaseState phases[PQ_PHASES]{};
+  static PendingEvent pending[PQ_PENDING_EVENTS]{};
+  static PqStats stats{};
+
+  // Daily event counts by class: [depth or height][duration]
+  static uint16_t sagCounts[PQ_SAG_CLASSES][PQ_DURATION_CLASSES];
+  static uint16_t swellCounts[PQ_SWELL_CLASSES][PQ_DURATION_CLASSES];
+  static uint16_t interruptionCounts[PQ_DURATION_CLASSES];
+
+  void resetCounters()
+  {
+    memset(sagCounts, 0, sizeof(sagCounts));
+    memset(swellCounts, 0, sizeof(swellCounts));
+    memset(interruptionCounts, 0, sizeof(interruptionCounts));
+  };
+
+  int durationClass(uint32_t duration)
+  {
+    int index = 0;
+    while (index < PQ_DURATION_CLASSES - 1 && duration >= DURATION_CLASS_LIMITS[index])
+      index++;
+    return index;
+  };
+
+  void countEvent(const PqEventRecord &record)
+  {
+    float level = record.extreme / 10.0f / VOLTAGE_LEVEL;
+    int duration = durationClass(record.duration);
+    int index = 0;
+    switch (record.type)
+    {
+    case PQ_EVENT_SAG:
+      while (index < PQ_SAG_CLASSES - 1 && level < SAG_CLASS_LIMITS[index])
+        index++;
+      sagCounts[index][duration]++;
+      break;
+    case PQ_EVENT_SWELL:
+      while (index < PQ_SWELL_CLASSES - 1 && level >= SWELL_CLASS_LIMITS[index])
+        index++;
+      swellCounts[index][duration]++;
+      break;
+    case PQ_EVENT_INTERRUPTION:
+      interruptionCounts[duration]++;
+      break;
+    default:
+      break;
+    }
+  };
+
+  /// @brief Moves the recorded event to the pending queue.
+  void completeEvent(PhaseState &state)
+  {
+    state.recording = false;
+    state.record.samplePeriod = static_cast<uint16_t>(state.samplePeriod);
+    for (auto &slot : pending)
+    {
+      if (!slot.used)
+      {
+        slot.used = true;
+        slot.started = state.started;
+        slot.record = state.record;
+        return;
+      }
+    };
+    ESP_LOGW(TAG_PQ_EVENTS, "Event queue is full. Event of phase %c is dropped.", 'A' + state.record.phase);
+    stats.dropped++;
+  };
+
+  /// @brief Adds a voltage sample of the phase. Should be called on every meter reading.
+  /// @param phase 0 - A, 1 - B, 2 - C
+  void add(int phase, float voltage)
+  {
+    if (phase < 0 || phase >= PQ_PHASES || !isfinite(voltage) || voltage < 0)
+      return;
+
+    PhaseState &state = phases[phase];
+    uint32_t now = esphome::millis();
+    if (state.lastSample != 0)
+    {
+      float period = now - state.lastSample;
+      state.samplePeriod = state.samplePeriod == 0 ? period : state.samplePeriod * 0.875f + period * 0.125f;
+    }
+    state.lastSample = now;
+
+    uint16_t sample = pqEventVoltage(voltage);
+    float level = voltage / VOLTAGE_LEVEL;
+    if (state.active)
+    {
+      bool is_over = state.isUnder ? level >= PQ_SAG_LEVEL + PQ_HYSTERESIS
+                                   : level <= PQ_SWELL_LEVEL - PQ_HYSTERESIS;
+      if (is_over)
+      {
+        PqEventRecord &record = state.record;
+        record.duration = now - state.started;
+        if (state.isUnder)
+          record.type = record.extreme < pqEventVoltage(VOLTAGE_LEVEL * PQ_INTERRUPTION_LEVEL) ? PQ_EVENT_INTERRUPTION
+                                                                                                 : PQ_EVENT_SAG;
+        else
+          record.type = PQ_EVENT_SWELL;
+        state.active = false;
+        state.recording = true;
+        stats.events++;
+        countEvent(record);
+        ESP_LOGI(TAG_PQ_EVENTS, "Voltage %s on phase %c: %" PRIu32 " ms, %.1f V.", PQ_EVENT_TYPE_NAMES[record.type],
+                 'A' + phase, record.duration, record.extreme / 10.0f);
+      }
+      else if (state.isUnder ? sample < state.record.extreme : sample > state.record.extreme)
+      {
+        state.record.extreme = sample;
+      }
+    }
+    else if (level < PQ_SAG_LEVEL || level > PQ_SWELL_LEVEL)
+    {
+      // A new event cuts post-trigger samples of the previous one.
+      if (state.recording)
+        completeEvent(state);
+
+      state.active = true;
+      state.isUnder = level < PQ_SAG_LEVEL;
+      state.started = now;
+      state.postCount = 0;
+      state.record = PqEventRecord{};
+      state.record.phase = phase;
+      state.record.extreme = sample;
+      for (int i = 0; i < PQ_EVENT_PRE_SAMPLES; i++)
+      {
+        int age = PQ_EVENT_PRE_SAMPLES - i; // Samples back from the trigger
+        state.record.pre[i] = age > state.ringCount ? 0 : state.ring[(state.ringHead + PQ_EVENT_PRE_SAMPLES - age) % PQ_EVENT_PRE_SAMPLES];
+      };
+    }
+
+    if ((state.active || state.recording) && state.postCount < PQ_EVENT_POST_SAMPLES)
+      state.record.post[state.postCount++] = sample;
+    if (state.recording && state.postCount == PQ_EVENT_POST_SAMPLES)
+      completeEvent(state);
+
+    state.ring[state.ringHead] = sample;
+    state.ringHead = (state.ringHead + 1) % PQ_EVENT_PRE_SAMPLES;
+    if (state.ringCount < PQ_EVENT_PRE_SAMPLES)
+      state.ringCount++;
+  };
+
+  /// @brief Appends the record to the monthly event file. Runs on the I/O worker.
+  /// A torn record at the end of file is overwritten.
+  bool writeEvent(const PqEventRecord &record)
+  {
+    auto time = esphome::ESPTime::from_epoch_utc(record.startTimestamp);
+    char path[64];
+    sdcard::date_file(path, sizeof(path), time, PQ_DATE_MODE, PQ_EVENTS_FILE);
+    if (!sdcard::ensure_date_dir_path(time, PQ_DATE_MODE))
+    {
+      ESP_LOGE(TAG_PQ_EVENTS, "Unable to initialize date-dependent directory tree.");
+      return false;
+    }
+
+    if (!sdcard::claim())
+    {
+      ESP_LOGE(TAG_PQ_EVENTS, "Unable to open file. Another file is opened already.");
+      return false;
+    }
+
+    auto file = sdmetrics::open(path, sdmetrics::exists(path) ? FILE_UPDATE : FILE_CREATE_UPDATE, true);
+    if (!file)
+    {
+      ESP_LOGE(TAG_PQ_EVENTS, "Unable to open or create event file %s.", path);
+      sdcard::free();
+      return false;
+    }
+
+    uint32_t size = file.size();
+    bool is_success = file.seek(size - size % sizeof(record)) &&
+                      sdmetrics::write(file, reinterpret_cast<const uint8_t *>(&record), sizeof(record)) == sizeof(record);
+    sdmetrics::close(file);
+    sdcard::free();
+
+    if (!is_success)
+      ESP_LOGE(TAG_PQ_EVENTS, "Unable to write event to %s.", path);
+    return is_success;
+  };
+
+  /// @brief Stamps completed events with wall clock time and queues them for writing.
+  void loop(esphome::ESPTime now)
+  {
+    if (!now.is_valid())
+      return;
+
+    for (auto &slot : pending)
+    {
+      if (!slot.used)
+        continue;
+
+      PqEventRecord record = slot.record;
+      record.magic = PQ_EVENT_MAGIC;
+      record.version = PQ_EVENT_VERSION;
+      record.startTimestamp = now.timestamp - (esphome::millis() - slot.started) / 1000;
+      record.crc = pqEventCrc(record);
+      slot.used = false;
+
+      if (!ioworker::isStarted())
+      {
+        if (writeEvent(record))
+          stats.written++;
+        else
+          stats.failed++;
+        continue;
+      }
+
+      bool submitted = ioworker::submit(
+          "pq event write",
+          [record]()
+          { return writeEvent(record); },
+          [](ioworker::JobStatus status)
+          {
+            if (status == ioworker::JobStatus::JOB_DONE)
+              stats.written++;
+            else
+              stats.failed++;
+          });
+      if (!submitted)
+        stats.dropped++;
+    };
+  };
+
+  /// @brief Lists non-zero daily event counts by class for the daily summary.
+  std::string generateSummary()
+  {
+    static const char *const SAG_LABELS[PQ_SAG_CLASSES] = {"Sags 80-90%", "Sags 70-80%", "Sags 40-70%", "Sags 5-40%"};
+    static const char *const SWELL_LABELS[PQ_SWELL_CLASSES] = {"Swells 110-120%", "Swells &gt;120%"};
+
+    std::string out;
+    char buffer[128];
+    auto append = [&out, &buffer](const char *label, const uint16_t *counts)
+    {
+      uint32_t total = 0;
+      for (int i = 0; i < PQ_DURATION_CLASSES; i++)
+        total += counts[i];
+      if (total == 0)
+        return;
+      int length = snprintf(buffer, sizeof(buffer), TG_PQ_EVENTS_LINE, label, counts[0], counts[1],
+                            counts[2], counts[3], counts[4]);
+      out.append(buffer, length);
+    };
+
+    for (int i = 0; i < PQ_SAG_CLASSES; i++)
+      append(SAG_LABELS[i], sagCounts[i]);
+    for (int i = 0; i < PQ_SWELL_CLASSES; i++)
+      append(SWELL_LABELS[i], swellCounts[i]);
+    append("Interruptions", interruptionCounts);
+
+    if (out.empty())
+      return out;
+    return TG_PQ_EVENTS_HEADER "<blockquote>" + out + "</blockquote>";
+  };
+
+}; // namespace pqevents
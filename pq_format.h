@@ -0,0 +1,77 @@
+#pragma once
+
+// Power-quality event records. Shared by the firmware and host-side tools,
+// so this header must not depend on Arduino or ESPHome.
+//
+// A monthly file is a sequence of fixed-size records appended on event end.
+// A record torn by power loss fails CRC and is skipped.
+
+#include "checksum.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#define PQ_EVENTS_FILE "pqevents.bin"
+#define PQ_EVENT_MAGIC 0x45515043 // "CPQE" in little-endian
+#define PQ_EVENT_VERSION 1
+#define PQ_EVENT_PRE_SAMPLES 8  // Samples before the trigger
+#define PQ_EVENT_POST_SAMPLES 8 // Samples from the trigger on
+
+enum PqEventType
+{
+    PQ_EVENT_SAG = 1,
+    PQ_EVENT_SWELL = 2,
+    PQ_EVENT_INTERRUPTION = 3
+};
+
+static const char *const PQ_EVENT_TYPE_NAMES[] = {"unknown", "sag", "swell", "interruption"};
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "Power-quality events are stored in little-endian byte order.");
+
+#pragma pack(push, 1)
+
+/// @brief Power-quality event. Voltages are in 0.1 V units.
+struct PqEventRecord
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;  // PqEventType
+    uint8_t phase; // 0 - A, 1 - B, 2 - C
+    uint8_t reserved;
+    uint32_t startTimestamp; // UTC
+    uint32_t duration;       // ms
+    uint16_t extreme;        // Residual voltage of sag or interruption, peak voltage of swell.
+    uint16_t samplePeriod;   // ms, average interval between samples
+    uint16_t pre[PQ_EVENT_PRE_SAMPLES];   // Oldest first
+    uint16_t post[PQ_EVENT_POST_SAMPLES]; // Trigger sample first
+    uint32_t crc; // CRC-32 of the record with this field set to zero
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(PqEventRecord) == 56, "Unexpected power-quality event record size.");
+
+inline uint32_t pqEventCrc(const PqEventRecord &record)
+{
+    PqEventRecord copy = record;
+    copy.crc = 0;
+    return crc32Compute(&copy, sizeof(copy));
+}
+
+inline bool pqEventIsValid(const PqEventRecord &record)
+{
+    return record.magic == PQ_EVENT_MAGIC &&
+           record.version == PQ_EVENT_VERSION &&
+           record.type >= PQ_EVENT_SAG && record.type <= PQ_EVENT_INTERRUPTION &&
+           record.crc == pqEventCrc(record);
+}
+
+/// @brief Converts voltage to record units, saturating at the field range.
+inline uint16_t pqEventVoltage(float voltage)
+{
+    if (!(voltage > 0.0f))
+        return 0;
+    float value = voltage * 10.0f + 0.5f;
+    return value >= 65535.0f ? 65535 : static_cast<uint16_t>(value);
+}
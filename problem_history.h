@@ -0,0 +1,244 @@
+#pragma once
+
+#include "checksum.h"
+#include "problems.h"
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#define TAG_HISTORY "History"
+
+#define HISTORY_MAGIC 0x54534843 // "CHST" in little-endian
+#define HISTORY_VERSION 1
+#define HISTORY_DEPTH 8    // Transitions kept per problem
+#define HISTORY_OUTAGES 20 // Power outages kept
+#define HISTORY_CHUNK_SIZE 1024
+
+namespace history
+{
+  typedef std::function<bool(const char *, size_t)> PublishCallback;
+
+  /// @brief Problem state change
+  struct Transition
+  {
+    uint32_t timestamp; // UTC
+    uint8_t from;       // ProblemState
+    uint8_t to;         // ProblemState
+    uint16_t reserved;
+    float value; // Measured value at detection, NAN for binary problems.
+  };
+
+  /// @brief Power outage interval, paired from GENERIC_POWER_FAILURE transitions
+  struct Outage
+  {
+    uint32_t start; // UTC
+    uint32_t end;   // UTC, 0 while the outage lasts
+  };
+
+  /// @brief Ring of the latest transitions of one problem
+  struct TransitionRing
+  {
+    uint8_t head; // Next slot to write
+    uint8_t count;
+    uint16_t reserved;
+    Transition items[HISTORY_DEPTH];
+  };
+
+  /// @brief History image kept in the NVS restore global
+  struct HistoryData
+  {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    TransitionRing problems[PROBLEMS_COUNT];
+    uint8_t outagesHead;
+    uint8_t outagesCount;
+    uint16_t reserved;
+    Outage outages[HISTORY_OUTAGES];
+    uint32_t crc; // CRC-32 of the image with this field set to zero
+  };
+
+  static HistoryData historyData{};
+  static uint8_t *storage = nullptr;
+  static bool dirty = false;
+  static bool powerChecked = false; // Open outage has been checked against power presence after boot.
+
+  uint32_t historyCrc(const HistoryData &data)
+  {
+    HistoryData copy = data;
+    copy.crc = 0;
+    return crc32Compute(&copy, sizeof(copy));
+  };
+
+  void clear()
+  {
+    historyData = HistoryData{};
+    historyData.magic = HISTORY_MAGIC;
+    historyData.version = HISTORY_VERSION;
+    historyData.size = sizeof(HistoryData);
+    dirty = true;
+  };
+
+  /// @brief Binds history to NVS restore global and loads stored data. Invalid data is cleared.
+  bool setupStorage(uint8_t *data, size_t size)
+  {
+    if (size < sizeof(HistoryData))
+    {
+      ESP_LOGE(TAG_HISTORY, "Problem history (%u bytes) doesn't fit NVS storage (%u bytes).",
+               static_cast<unsigned>(sizeof(HistoryData)), static_cast<unsigned>(size));
+      return false;
+    }
+    storage = data;
+    memcpy(&historyData, storage, sizeof(HistoryData));
+    if (historyData.magic != HISTORY_MAGIC || historyData.version != HISTORY_VERSION ||
+        historyData.size != sizeof(HistoryData) || historyData.crc != historyCrc(historyData))
+    {
+      ESP_LOGW(TAG_HISTORY, "Stored problem history is invalid. History is cleared.");
+      clear();
+    }
+    return true;
+  };
+
+  /// @brief Copies history to NVS restore global if it has been changed.
+  /// Flash is written together with the snapshot.
+  bool store()
+  {
+    if (storage == nullptr || !dirty)
+      return false;
+    historyData.crc = historyCrc(historyData);
+    memcpy(storage, &historyData, sizeof(HistoryData));
+    dirty = false;
+    return true;
+  };
+
+  Outage *lastOutage()
+  {
+    if (historyData.outagesCount == 0)
+      return nullptr;
+    return &historyData.outages[(historyData.outagesHead + HISTORY_OUTAGES - 1) % HISTORY_OUTAGES];
+  };
+
+  void startOutage(uint32_t timestamp)
+  {
+    Outage *last = lastOutage();
+    // The outage has lasted through a reboot.
+    if (last != nullptr && last->end == 0)
+      return;
+    historyData.outages[historyData.outagesHead] = Outage{timestamp, 0};
+    historyData.outagesHead = (historyData.outagesHead + 1) % HISTORY_OUTAGES;
+    if (historyData.outagesCount < HISTORY_OUTAGES)
+      historyData.outagesCount++;
+  };
+
+  void endOutage(uint32_t timestamp)
+  {
+    Outage *last = lastOutage();
+    if (last == nullptr || last->end != 0)
+      return;
+    last->end = timestamp < last->start ? last->start : timestamp;
+  };
+
+  /// @brief Records a problem transition. Should be called for every processed problem event.
+  /// @param now current UTC time, the event time is derived from its age
+  void record(const ProblemEvent &event, time_t now)
+  {
+    if (now <= 0 || event.problem < 0 || event.problem >= PROBLEMS_COUNT)
+      return;
+
+    uint32_t timestamp = now - (esphome::millis() - event.timestamp) / 1000;
+    TransitionRing &ring = historyData.problems[event.problem];
+    ring.items[ring.head] = Transition{timestamp, static_cast<uint8_t>(event.from),
+                                       static_cast<uint8_t>(event.state), 0, event.value};
+    ring.head = (ring.head + 1) % HISTORY_DEPTH;
+    if (ring.count < HISTORY_DEPTH)
+      ring.count++;
+
+    if (event.problem == Problems::GENERIC_POWER_FAILURE)
+    {
+      if (event.state == ProblemState::FAILURE)
+        startOutage(timestamp);
+      else if (event.state == ProblemState::NONE)
+        endOutage(timestamp);
+    }
+    dirty = true;
+  };
+
+  /// @brief Closes an outage left open by a reboot if power is present on the first check after boot.
+  /// Its end is the time the node has seen power again, so the duration is an upper bound.
+  void checkPower(bool isPoweredOn, time_t now)
+  {
+    if (powerChecked || now <= 0)
+      return;
+    powerChecked = true;
+
+    Outage *last = lastOutage();
+    if (!isPoweredOn || last == nullptr || last->end != 0)
+      return;
+    ESP_LOGW(TAG_HISTORY, "Power outage has ended while the node was down.");
+    endOutage(now);
+    dirty = true;
+  };
+
+  const char *stateName(uint8_t state)
+  {
+    return state <= ProblemState::FAILURE ? STATE_NAMES[state] : "?";
+  };
+
+  /// @brief Publishes transitions (oldest first for each problem) and outages as CSV chunks.
+  /// The last chunk ends with "# end".
+  bool dump(PublishCallback publish)
+  {
+    std::string chunk;
+    chunk.reserve(HISTORY_CHUNK_SIZE);
+    char line[128];
+    bool is_success = true;
+    auto append = [&](int length)
+    {
+      if (length <= 0)
+        return;
+      if (chunk.size() + length > HISTORY_CHUNK_SIZE)
+      {
+        is_success &= publish(chunk.c_str(), chunk.size());
+        chunk.clear();
+      }
+      chunk.append(line, length);
+    };
+
+    append(snprintf(line, sizeof(line), "problem;timestamp;from;to;value\n"));
+    for (int i = 0; i < PROBLEMS_COUNT; i++)
+    {
+      const TransitionRing &ring = historyData.problems[i];
+      for (int j = 0; j < ring.count; j++)
+      {
+        const Transition &item = ring.items[(ring.head + HISTORY_DEPTH - ring.count + j) % HISTORY_DEPTH];
+        int length = snprintf(line, sizeof(line), "%s;%u;%s;%s;",
+                              getProblemDescriptor(static_cast<Problems>(i)).key,
+                              static_cast<unsigned>(item.timestamp),
+                              stateName(item.from), stateName(item.to));
+        if (isfinite(item.value))
+          length += snprintf(line + length, sizeof(line) - length, "%.3f", item.value);
+        length += snprintf(line + length, sizeof(line) - length, "\n");
+        append(length);
+      };
+    };
+
+    append(snprintf(line, sizeof(line), "# outages\nstart;end;duration\n"));
+    for (int i = 0; i < historyData.outagesCount; i++)
+    {
+      const Outage &outage =
+          historyData.outages[(historyData.outagesHead + HISTORY_OUTAGES - historyData.outagesCount + i) % HISTORY_OUTAGES];
+      if (outage.end == 0)
+        append(snprintf(line, sizeof(line), "%u;;\n", static_cast<unsigned>(outage.start)));
+      else
+        append(snprintf(line, sizeof(line), "%u;%u;%u\n", static_cast<unsigned>(outage.start),
+                        static_cast<unsigned>(outage.end), static_cast<unsigned>(outage.end - outage.start)));
+    };
+
+    append(snprintf(line, sizeof(line), "# end\n"));
+    is_success &= publish(chunk.c_str(), chunk.size());
+    return is_success;
+  };
+
+}; // namespace history
@@ -1,13 +1,18 @@
 #pragma once
 
+#include "phase_stats.h"
+#include "pq_events.h"
 #include "settings.h"
+#include "tariff.h"
+#include <esphome/core/hal.h>
 #include <esphome/core/helpers.h>
 #include <esphome/core/time.h>
-#include <map>
+#include <atomic>
 #include "tg_bot_strings.h"
 
 /* Global constants */
 static const int PROBLEMS_COUNT = 12;
+static const uint32_t PROBLEM_EVENTS_CAPACITY = 32;
 
 static const esphome::ESPTime NONE_TIME = esphome::ESPTime{};
 
@@ -36,62 +41,162 @@ enum ProblemState
   FAILURE = 2
 };
 
-static esphome::CallbackManager<void(Problems)> problem_failure_callback;
-static esphome::CallbackManager<void(Problems)> problem_warning_callback;
-static esphome::CallbackManager<void(Problems)> problem_restore_callback;
-
-void add_on_failure_callback(std::function<void(Problems)> &&callback) { problem_failure_callback.add(std::move(callback)); };
-void add_on_warning_callback(std::function<void(Problems)> &&callback) { problem_warning_callback.add(std::move(callback)); };
-void add_on_restore_callback(std::function<void(Problems)> &&callback) { problem_restore_callback.add(std::move(callback)); };
-
-/* State names */
-static const std::map<ProblemState, const char *> STATE_NAMES{
-    {ProblemState::NONE, "OK"},
-    {ProblemState::WARNING, "Warning"},
-    {ProblemState::FAILURE, "Failure"}};
-
-/* Keys for summary data on problems */
-static const std::map<Problems, const char *> PROBLEMS_KEYS{
-    {Problems::GENERIC_POWER_FAILURE, "PowerLoss"},
-    {Problems::UNDERVOLTAGE, "Undervoltage"},
-    {Problems::OVERVOLTAGE, "Overvoltage"},
-    {Problems::OVERLOAD, "Overload"},
-    {Problems::PHASE_SHIFT, "PhaseShift"},
-    {Problems::FREQUENCY_SHIFT, "Frequency_Shift"},
-    {Problems::BREAKER, "CircuitBreaker"},
-    {Problems::POWER_METER, "PowerMeterConnectivity"},
-    {Problems::INTRUSION, "CaseIntrusion"},
-    {Problems::BATTERY, "NodeUPSBattery"},
-    {Problems::OVERHEAT, "Overheat"},
-    {Problems::AC_LINE, "NodeACPower"}};
-
-static const std::map<Problems, const char *> PROBLEMS_NAMES{
-    {Problems::GENERIC_POWER_FAILURE, "Power Loss"},
-    {Problems::UNDERVOLTAGE, "Undervoltage"},
-    {Problems::OVERVOLTAGE, "Overvoltage"},
-    {Problems::OVERLOAD, "Overload"},
-    {Problems::PHASE_SHIFT, "Phase Shift"},
-    {Problems::FREQUENCY_SHIFT, "Frequency Shift"},
-    {Problems::BREAKER, "Circuit Breaker"},
-    {Problems::POWER_METER, "Power Meter Connectivity"},
-    {Problems::INTRUSION, "Case Intrusion"},
-    {Problems::BATTERY, "Node UPS Battery"},
-    {Problems::OVERHEAT, "Overheat"},
-    {Problems::AC_LINE, "Node AC Power"}};
-
-static const std::map<Problems, const char *> PROBLEMS_MEASURES{
-    {Problems::GENERIC_POWER_FAILURE, ""},
-    {Problems::UNDERVOLTAGE, "V"},
-    {Problems::OVERVOLTAGE, "V"},
-    {Problems::OVERLOAD, "A"},
-    {Problems::PHASE_SHIFT, "%"},
-    {Problems::FREQUENCY_SHIFT, "Hz"},
-    {Problems::BREAKER, ""},
-    {Problems::POWER_METER, ""},
-    {Problems::INTRUSION, ""},
-    {Problems::BATTERY, ""},
-    {Problems::OVERHEAT, "°C"},
-    {Problems::AC_LINE, ""}};
+/* Problem state change, queued by detection and handled by callbacks */
+struct ProblemEvent
+{
+  Problems problem;
+  ProblemState state;
+  ProblemState from;  // State before the change
+  uint32_t timestamp; // millis() at detection
+  float value;        // Measured value at detection, NAN for binary problems.
+};
+
+static esphome::CallbackManager<void(const ProblemEvent &)> problem_failure_callback;
+static esphome::CallbackManager<void(const ProblemEvent &)> problem_warning_callback;
+static esphome::CallbackManager<void(const ProblemEvent &)> problem_restore_callback;
+static esphome::CallbackManager<void(const ProblemEvent &)> problem_transition_callback;
+
+void add_on_failure_callback(std::function<void(const ProblemEvent &)> &&callback) { problem_failure_callback.add(std::move(callback)); };
+void add_on_warning_callback(std::function<void(const ProblemEvent &)> &&callback) { problem_warning_callback.add(std::move(callback)); };
+void add_on_restore_callback(std::function<void(const ProblemEvent &)> &&callback) { problem_restore_callback.add(std::move(callback)); };
+// Called for every state change before the state-specific callbacks.
+void add_on_transition_callback(std::function<void(const ProblemEvent &)> &&callback) { problem_transition_callback.add(std::move(callback)); };
+
+/* Event queue. Single producer (detection), single consumer (processProblemEvents). */
+static ProblemEvent problemEvents[PROBLEM_EVENTS_CAPACITY];
+static std::atomic<uint32_t> problemEventsHead{0}; // Next event to read, moved by consumer.
+static std::atomic<uint32_t> problemEventsTail{0}; // Next slot to write, moved by producer.
+static uint32_t problemEventsOverflows = 0;
+
+/// @brief Adds an event to the queue. Never blocks or allocates.
+/// @return false if the queue is full and the event is lost
+bool pushProblemEvent(const ProblemEvent &event)
+{
+  uint32_t tail = problemEventsTail.load(std::memory_order_relaxed);
+  if (tail - problemEventsHead.load(std::memory_order_acquire) >= PROBLEM_EVENTS_CAPACITY)
+  {
+    problemEventsOverflows++;
+    return false;
+  }
+  problemEvents[tail % PROBLEM_EVENTS_CAPACITY] = event;
+  problemEventsTail.store(tail + 1, std::memory_order_release);
+  return true;
+};
+
+/// @brief Takes the oldest event from the queue.
+/// @return false if the queue is empty
+bool popProblemEvent(ProblemEvent &event)
+{
+  uint32_t head = problemEventsHead.load(std::memory_order_relaxed);
+  if (head == problemEventsTail.load(std::memory_order_acquire))
+    return false;
+  event = problemEvents[head % PROBLEM_EVENTS_CAPACITY];
+  problemEventsHead.store(head + 1, std::memory_order_release);
+  return true;
+};
+
+/// @brief Events waiting in the queue
+uint32_t getProblemEventsDepth()
+{
+  return problemEventsTail.load(std::memory_order_acquire) - problemEventsHead.load(std::memory_order_acquire);
+};
+
+/// @brief Calls callbacks for all queued events in order of detection. Should be called each loop.
+void processProblemEvents()
+{
+  ProblemEvent event;
+  while (popProblemEvent(event))
+  {
+    problem_transition_callback.call(event);
+    switch (event.state)
+    {
+    case ProblemState::WARNING:
+      problem_warning_callback.call(event);
+      break;
+    case ProblemState::FAILURE:
+      problem_failure_callback.call(event);
+      break;
+    case ProblemState::NONE:
+      problem_restore_callback.call(event);
+      break;
+    default:
+      break;
+    }
+  };
+};
+
+/* State names, indexed by ProblemState */
+static constexpr const char *STATE_NAMES[] = {"OK", "Warning", "Failure"};
+
+/// @brief Measurement a problem is detected on
+enum ThresholdInput
+{
+  INPUT_NONE = -1,
+  INPUT_MIN_VOLTAGE = 0,
+  INPUT_MAX_VOLTAGE = 1,
+  INPUT_MAX_CURRENT = 2,
+  INPUT_PHASE_SHIFT = 3,
+  INPUT_FREQUENCY_SHIFT = 4,
+  INPUT_TEMPERATURE = 5,
+  INPUT_COUNT = 6
+};
+
+/// @brief Defines how the problem is detected and reported
+enum ProblemClass
+{
+  CLASS_POWER = 0,    // Power loss, has its own message.
+  CLASS_MEASURED = 1, // Warning and failure levels of a measured value.
+  CLASS_BINARY = 2    // Failure reported by a contact or a link, no value.
+};
+
+/// @brief Static description of a problem
+struct ProblemDescriptor
+{
+  Problems problem;
+  const char *key;     // Key for summary data
+  const char *name;    // Display name
+  const char *measure; // Unit of the value
+  const char *topic;   // MQTT topic suffix
+  ThresholdInput valueSource;
+  ProblemClass problemClass;
+};
+
+#define PROBLEM_DESCRIPTOR(problem, key, name, measure, source, problem_class) \
+  {Problems::problem, key, name, measure, "Problems/" key, source, problem_class}
+
+/* Problem registry, indexed by Problems */
+static constexpr ProblemDescriptor PROBLEMS_REGISTRY[] = {
+    PROBLEM_DESCRIPTOR(GENERIC_POWER_FAILURE, "PowerLoss", "Power Loss", "", INPUT_NONE, CLASS_POWER),
+    PROBLEM_DESCRIPTOR(UNDERVOLTAGE, "Undervoltage", "Undervoltage", "V", INPUT_MIN_VOLTAGE, CLASS_MEASURED),
+    PROBLEM_DESCRIPTOR(OVERVOLTAGE, "Overvoltage", "Overvoltage", "V", INPUT_MAX_VOLTAGE, CLASS_MEASURED),
+    PROBLEM_DESCRIPTOR(OVERLOAD, "Overload", "Overload", "A", INPUT_MAX_CURRENT, CLASS_MEASURED),
+    PROBLEM_DESCRIPTOR(PHASE_SHIFT, "PhaseShift", "Phase Shift", "%", INPUT_PHASE_SHIFT, CLASS_MEASURED),
+    PROBLEM_DESCRIPTOR(FREQUENCY_SHIFT, "Frequency_Shift", "Frequency Shift", "Hz", INPUT_FREQUENCY_SHIFT, CLASS_MEASURED),
+    PROBLEM_DESCRIPTOR(BREAKER, "CircuitBreaker", "Circuit Breaker", "", INPUT_NONE, CLASS_BINARY),
+    PROBLEM_DESCRIPTOR(POWER_METER, "PowerMeterConnectivity", "Power Meter Connectivity", "", INPUT_NONE, CLASS_BINARY),
+    PROBLEM_DESCRIPTOR(INTRUSION, "CaseIntrusion", "Case Intrusion", "", INPUT_NONE, CLASS_BINARY),
+    PROBLEM_DESCRIPTOR(BATTERY, "NodeUPSBattery", "Node UPS Battery", "", INPUT_NONE, CLASS_BINARY),
+    PROBLEM_DESCRIPTOR(OVERHEAT, "Overheat", "Overheat", "°C", INPUT_TEMPERATURE, CLASS_MEASURED),
+    PROBLEM_DESCRIPTOR(AC_LINE, "NodeACPower", "Node AC Power", "", INPUT_NONE, CLASS_BINARY)};
+
+constexpr bool problemsRegistryIsOrdered(int i = 0)
+{
+  return i == PROBLEMS_COUNT ||
+         (PROBLEMS_REGISTRY[i].problem == i && problemsRegistryIsOrdered(i + 1));
+};
+
+static_assert(PROBLEMS_COUNT == Problems::AC_LINE + 1, "PROBLEMS_COUNT doesn't match Problems enumeration.");
+static_assert(sizeof(PROBLEMS_REGISTRY) / sizeof(PROBLEMS_REGISTRY[0]) == PROBLEMS_COUNT,
+              "Every problem should have an entry in PROBLEMS_REGISTRY.");
+static_assert(problemsRegistryIsOrdered(), "PROBLEMS_REGISTRY entries should follow Problems enumeration.");
+static_assert(sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0]) == ProblemState::FAILURE + 1,
+              "Every state should have an entry in STATE_NAMES.");
+
+/// @brief Gets description of specified problem
+inline const ProblemDescriptor &getProblemDescriptor(Problems problem)
+{
+  return PROBLEMS_REGISTRY[static_cast<int>(problem)];
+};
 
 static ProblemState problems[PROBLEMS_COUNT];
 static int dailyWarnings[PROBLEMS_COUNT];
@@ -109,11 +214,12 @@ static int dailyPowerFailureDuration = 0;
 
 static bool isActive;
 
-/// @brief Sets the problem state and updates daily counters for it.
+/// @brief Sets the problem state, updates daily counters for it and queues the event.
 /// @param problem id to report
 /// @param state A state of problem to set
+/// @param value measured value that caused the change
 void setProblem(Problems problem, ProblemState state = ProblemState::NONE,
-                int timestamp = 0)
+                int timestamp = 0, double value = NAN)
 {
   if (!isActive)
     return;
@@ -127,8 +233,6 @@ void setProblem(Problems problem, ProblemState state = ProblemState::NONE,
   {
   case ProblemState::WARNING:
     dailyWarnings[idx] = dailyWarnings[idx] + 1;
-    // if (prev_ != ProblemState::UNKNOWN)
-    problem_warning_callback.call(problem);
     break;
   case ProblemState::FAILURE:
     dailyFailures[idx] = dailyFailures[idx] + 1;
@@ -139,8 +243,6 @@ void setProblem(Problems problem, ProblemState state = ProblemState::NONE,
       lastPowerFailureDuration = -1;
       powerFailureEndTS = 0;
     };
-    // if (prev_ != ProblemState::UNKNOWN)
-    problem_failure_callback.call(problem);
     break;
   case ProblemState::NONE:
     if (problem == Problems::GENERIC_POWER_FAILURE && (timestamp != 0) &&
@@ -151,14 +253,13 @@ void setProblem(Problems problem, ProblemState state = ProblemState::NONE,
       dailyPowerFailureDuration +=
           static_cast<int>((powerFailureEndTS - powerFailureStartTS));
     }
-    // if (prev_ != ProblemState::UNKNOWN)
-    problem_restore_callback.call(problem);
     break;
   default:
     break;
   }
 
   problems[static_cast<int>(problem)] = state;
+  pushProblemEvent(ProblemEvent{problem, state, prev_, esphome::millis(), static_cast<float>(value)});
 };
 
 /// @brief Gets state of specified problem
@@ -177,6 +278,163 @@ ProblemState getProblem(int i)
   return getProblem(static_cast<Problems>(i));
 };
 
+/* Threshold engine */
+
+/// @brief Declarative threshold rule. Levels are entry thresholds; a state is left
+/// when the value gets back past the level by the hysteresis margin.
+/// The rule reads the input named by valueSource of the problem descriptor.
+struct ThresholdRule
+{
+  Problems problem;
+  bool isAbove;          // true if the problem is a value above the levels, false if below
+  float (*warningLevel)();
+  float (*failureLevel)();
+  float hysteresis;      // Same units as the input.
+  uint8_t debounceSamples; // Candidate state must be seen this many times in a row...
+  uint32_t debounceTime;   // ...and for this long (ms) before it is reported.
+  uint32_t minDwellTime;   // ms a reported state is held before it may be eased or cleared.
+};
+
+/// @brief Runtime state of a threshold rule
+struct ThresholdRuleState
+{
+  ProblemState pending;
+  uint8_t pendingSamples;
+  uint32_t pendingSince;
+  uint32_t enteredAt;
+  ProblemState raw;         // Result of plain comparison, as reported before the engine.
+  uint32_t rawTransitions;  // Transitions plain comparison would have reported.
+  uint32_t transitions;     // Transitions actually reported.
+};
+
+static const ThresholdRule THRESHOLD_RULES[] = {
+    {Problems::UNDERVOLTAGE, false,
+     []() { return settings::settingsData.content.settings.undervoltageWarningLevel; },
+     []() { return settings::settingsData.content.settings.undervoltageFailureLevel; },
+     2.0, 3, 0, 10000},
+    {Problems::OVERVOLTAGE, true,
+     []() { return settings::settingsData.content.settings.overvoltageWarningLevel; },
+     []() { return settings::settingsData.content.settings.overvoltageFailureLevel; },
+     2.0, 3, 0, 10000},
+    {Problems::OVERLOAD, true,
+     []() { return settings::settingsData.content.settings.overloadWarningLevel; },
+     []() { return settings::settingsData.content.settings.overloadFailureLevel; },
+     0.5, 3, 0, 10000},
+    {Problems::PHASE_SHIFT, true,
+     []() { return settings::settingsData.content.settings.phaseShiftWarningLevel; },
+     []() { return settings::settingsData.content.settings.phaseShiftFailureLevel; },
+     1.0, 5, 0, 30000},
+    {Problems::FREQUENCY_SHIFT, true,
+     []() { return settings::settingsData.content.settings.frequencyShiftWarningLevel; },
+     []() { return settings::settingsData.content.settings.frequencyShiftFailureLevel; },
+     0.05, 3, 0, 10000},
+    {Problems::OVERHEAT, true,
+     []() { return static_cast<float>(OVERHEATING_WARNING_TEMPERATURE); },
+     []() { return static_cast<float>(OVERHEATING_FAILURE_TEMPERATURE); },
+     2.0, 1, 15000, 60000}};
+
+static const int THRESHOLD_RULES_COUNT = sizeof(THRESHOLD_RULES) / sizeof(THRESHOLD_RULES[0]);
+
+static ThresholdRuleState thresholdStates[THRESHOLD_RULES_COUNT];
+
+/// @brief Resets runtime state of all threshold rules.
+void resetThresholds()
+{
+  for (auto &state : thresholdStates)
+    state = ThresholdRuleState{};
+};
+
+/// @brief Classifies the value. Rules looking for low values are mirrored,
+/// so one comparison covers both directions.
+/// @param current state the hysteresis is applied to, NONE to get plain comparison
+ProblemState classifyThreshold(const ThresholdRule &rule, double value, ProblemState current)
+{
+  double sign = rule.isAbove ? 1.0 : -1.0;
+  double x = sign * value;
+  double warning = sign * rule.warningLevel();
+  double failure = sign * rule.failureLevel();
+
+  if (x >= failure || (current == ProblemState::FAILURE && x > failure - rule.hysteresis))
+    return ProblemState::FAILURE;
+  if (x >= warning || (current != ProblemState::NONE && x > warning - rule.hysteresis))
+    return ProblemState::WARNING;
+  return ProblemState::NONE;
+};
+
+/// @brief Total count of transitions held back by hysteresis, debounce and dwell time.
+uint32_t getSuppressedTransitions()
+{
+  uint32_t raw = 0, reported = 0;
+  for (const auto &state : thresholdStates)
+  {
+    raw += state.rawTransitions;
+    reported += state.transitions;
+  };
+  return raw > reported ? raw - reported : 0;
+};
+
+/// @brief Evaluates all rules on a measurement frame in one pass.
+/// @param frame values indexed by ThresholdInput, NAN for inputs not in this frame
+void evaluateThresholds(const double *frame)
+{
+  uint32_t now = esphome::millis();
+  for (int i = 0; i < THRESHOLD_RULES_COUNT; i++)
+  {
+    const ThresholdRule &rule = THRESHOLD_RULES[i];
+    ThresholdRuleState &state = thresholdStates[i];
+    ThresholdInput input = getProblemDescriptor(rule.problem).valueSource;
+    if (input == INPUT_NONE || !isfinite(frame[input]))
+      continue;
+    double value = frame[input];
+
+    ProblemState raw = classifyThreshold(rule, value, ProblemState::NONE);
+    if (raw != state.raw)
+    {
+      state.raw = raw;
+      state.rawTransitions++;
+    }
+
+    ProblemState current = getProblem(rule.problem);
+    ProblemState target = classifyThreshold(rule, value, current);
+    if (target == current)
+    {
+      state.pending = current;
+      state.pendingSamples = 0;
+      continue;
+    }
+
+    if (target != state.pending || state.pendingSamples == 0)
+    {
+      state.pending = target;
+      state.pendingSamples = 0;
+      state.pendingSince = now;
+    }
+    if (state.pendingSamples < UINT8_MAX)
+      state.pendingSamples++;
+
+    if (state.pendingSamples < rule.debounceSamples || now - state.pendingSince < rule.debounceTime)
+      continue;
+    // Escalation is never delayed by dwell time.
+    if (target < current && now - state.enteredAt < rule.minDwellTime)
+      continue;
+
+    setProblem(rule.problem, target, 0, value);
+    state.transitions++;
+    state.enteredAt = now;
+    state.pendingSamples = 0;
+  };
+};
+
+/// @brief Builds a frame with a single input and evaluates it.
+void evaluateThreshold(ThresholdInput input, double value)
+{
+  double frame[INPUT_COUNT];
+  for (auto &item : frame)
+    item = NAN;
+  frame[input] = value;
+  evaluateThresholds(frame);
+};
+
 void startMonitoring()
 {
   isActive = true;
@@ -196,13 +454,16 @@ void setupProblems()
     dailyFailures[i] = 0;
     dailyWarnings[i] = 0;
   };
+  resetThresholds();
   dailyPowerFailureDuration = 0;
-  minVoltage = VOLTAGE_LEVEL;
-  maxVoltage = VOLTAGE_LEVEL;
-  minCurrent = SUPPORTED_LOAD_LEVEL;
-  maxCurrent = SUPPORTED_LOAD_LEVEL;
-  minFrequency = FREQUENCY;
-  maxFrequency = FREQUENCY;
+  // Extremes are taken from the first sample of the day.
+  minVoltage = NAN;
+  maxVoltage = NAN;
+  minCurrent = NAN;
+  maxCurrent = NAN;
+  minFrequency = NAN;
+  maxFrequency = NAN;
+  phasestats::reset();
 };
 
 /// @brief Resets daily counters for problems
@@ -214,12 +475,16 @@ void resetCounters()
     dailyFailures[i] = 0;
   };
   dailyPowerFailureDuration = 0;
-  minVoltage = VOLTAGE_LEVEL;
-  maxVoltage = VOLTAGE_LEVEL;
-  minCurrent = SUPPORTED_LOAD_LEVEL;
-  maxCurrent = SUPPORTED_LOAD_LEVEL;
-  minFrequency = FREQUENCY;
-  maxFrequency = FREQUENCY;
+  // Extremes are taken from the first sample of the day.
+  minVoltage = NAN;
+  maxVoltage = NAN;
+  minCurrent = NAN;
+  maxCurrent = NAN;
+  minFrequency = NAN;
+  maxFrequency = NAN;
+  phasestats::reset();
+  pqevents::resetCounters();
+  tariff::resetCounters();
 };
 
 void monitorVoltage(double phaseA, double phaseB, double phaseC)
@@ -243,37 +508,17 @@ void monitorVoltage(double phaseA, double phaseB, double phaseC)
   if (!is_finite)
     return;
 
-  minVoltage = min(phaseA, min(phaseB, phaseC));
-  maxVoltage = max(phaseA, max(phaseB, phaseC));
-  if (maxVoltage >=
-      settings::settingsData.content.settings.overvoltageFailureLevel)
-  {
-    setProblem(Problems::OVERVOLTAGE, ProblemState::FAILURE);
-  }
-  else if (maxVoltage >=
-           settings::settingsData.content.settings.overloadWarningLevel)
-  {
-    setProblem(Problems::OVERVOLTAGE, ProblemState::WARNING);
-  }
-  else
-  {
-    setProblem(Problems::OVERVOLTAGE, ProblemState::NONE);
-  }
+  phasestats::add(phasestats::CHANNEL_VOLTAGE_A, phaseA);
+  phasestats::add(phasestats::CHANNEL_VOLTAGE_B, phaseB);
+  phasestats::add(phasestats::CHANNEL_VOLTAGE_C, phaseC);
 
-  if (minVoltage <=
-      settings::settingsData.content.settings.undervoltageFailureLevel)
-  {
-    setProblem(Problems::UNDERVOLTAGE, ProblemState::FAILURE);
-  }
-  else if (minVoltage <=
-           settings::settingsData.content.settings.undervoltageWarningLevel)
-  {
-    setProblem(Problems::UNDERVOLTAGE, ProblemState::WARNING);
-  }
-  else
-  {
-    setProblem(Problems::UNDERVOLTAGE, ProblemState::NONE);
-  }
+  double sampleMin = min(phaseA, min(phaseB, phaseC));
+  double sampleMax = max(phaseA, max(phaseB, phaseC));
+  minVoltage = fmin(minVoltage, sampleMin);
+  maxVoltage = fmax(maxVoltage, sampleMax);
+
+  double frame[INPUT_COUNT] = {sampleMin, sampleMax, NAN, NAN, NAN, NAN};
+  evaluateThresholds(frame);
 }
 
 void monitorPhaseShift(double value)
@@ -287,21 +532,7 @@ void monitorPhaseShift(double value)
     return;
   }
 
-  auto shift_abs = abs(value);
-  if (shift_abs >=
-      settings::settingsData.content.settings.phaseShiftFailureLevel)
-  {
-    setProblem(Problems::PHASE_SHIFT, ProblemState::FAILURE);
-  }
-  else if (shift_abs >=
-           settings::settingsData.content.settings.phaseShiftWarningLevel)
-  {
-    setProblem(Problems::PHASE_SHIFT, ProblemState::WARNING);
-  }
-  else
-  {
-    setProblem(Problems::PHASE_SHIFT);
-  };
+  evaluateThreshold(INPUT_PHASE_SHIFT, fabs(value));
 };
 
 void monitorCurrent(double phaseA, double phaseB, double phaseC)
@@ -325,28 +556,22 @@ void monitorCurrent(double phaseA, double phaseB, double phaseC)
   if (!is_finite)
     return;
 
-  maxCurrent = max(phaseA, max(phaseB, phaseC));
-  minCurrent = min(phaseA, min(phaseB, phaseC));
-  auto avgCurrent = (phaseA + phaseB + phaseC) / 3;
-  if (maxCurrent >=
-      settings::settingsData.content.settings.overloadFailureLevel)
-  {
-    setProblem(Problems::OVERLOAD, ProblemState::FAILURE);
-  }
-  else if (maxCurrent >=
-           settings::settingsData.content.settings.overloadWarningLevel)
-  {
-    setProblem(Problems::OVERLOAD, ProblemState::WARNING);
-  }
-  else
-  {
-    setProblem(Problems::OVERLOAD);
-  }
-
-  auto maxShift = max(abs(phaseA / avgCurrent - 1.0),
-                      max(abs(phaseB / avgCurrent - 1.0), abs(phaseC / avgCurrent - 1.0)));
+  phasestats::add(phasestats::CHANNEL_CURRENT_A, phaseA);
+  phasestats::add(phasestats::CHANNEL_CURRENT_B, phaseB);
+  phasestats::add(phasestats::CHANNEL_CURRENT_C, phaseC);
 
-  monitorPhaseShift(maxShift * 100);
+  double sampleMax = max(phaseA, max(phaseB, phaseC));
+  maxCurrent = fmax(maxCurrent, sampleMax);
+  minCurrent = fmin(minCurrent, min(phaseA, min(phaseB, phaseC)));
+  auto avgCurrent = (phaseA + phaseB + phaseC) / 3;
+  // Phases are balanced without load, so a latched shift problem is cleared then.
+  auto maxShift = avgCurrent > 0
+                      ? max(fabs(phaseA / avgCurrent - 1.0),
+                            max(fabs(phaseB / avgCurrent - 1.0), fabs(phaseC / avgCurrent - 1.0)))
+                      : 0.0;
+
+  double frame[INPUT_COUNT] = {NAN, NAN, sampleMax, maxShift * 100, NAN, NAN};
+  evaluateThresholds(frame);
 };
 
 void monitorFrequencyShift(double value)
@@ -363,23 +588,10 @@ void monitorFrequencyShift(double value)
   if ((!isfinite(value)) || (value < 0))
     return;
 
-  minFrequency = min(minFrequency, value);
-  maxFrequency = max(maxFrequency, value);
-  auto freq_delta = abs(value - FREQUENCY);
-  if (freq_delta >=
-      settings::settingsData.content.settings.frequencyShiftFailureLevel)
-  {
-    setProblem(Problems::FREQUENCY_SHIFT, ProblemState::FAILURE);
-  }
-  else if (freq_delta >= settings::settingsData.content.settings
-                             .frequencyShiftWarningLevel)
-  {
-    setProblem(Problems::FREQUENCY_SHIFT, ProblemState::WARNING);
-  }
-  else
-  {
-    setProblem(Problems::FREQUENCY_SHIFT);
-  };
+  phasestats::add(phasestats::CHANNEL_FREQUENCY, value);
+  minFrequency = fmin(minFrequency, value);
+  maxFrequency = fmax(maxFrequency, value);
+  evaluateThreshold(INPUT_FREQUENCY_SHIFT, fabs(value - FREQUENCY));
 };
 
 void monitorBreaker(bool isOk)
@@ -393,13 +605,15 @@ void monitorBreaker(bool isOk)
     setProblem(Problems::BREAKER, ProblemState::NONE);
 };
 
-void monitorPowerMeter(bool isOk)
+void monitorPowerMeter(bool isOk, bool isDegraded = false)
 {
   if (!isActive)
     return;
 
   if (!isOk)
     setProblem(Problems::POWER_METER, ProblemState::FAILURE);
+  else if (isDegraded)
+    setProblem(Problems::POWER_METER, ProblemState::WARNING);
   else
     setProblem(Problems::POWER_METER, ProblemState::NONE);
 };
@@ -456,23 +670,12 @@ void monitorOverheating(double temperature)
   if (!isfinite(temperature))
     return;
 
-  if (temperature >= OVERHEATING_FAILURE_TEMPERATURE)
-  {
-    setProblem(Problems::OVERHEAT, ProblemState::FAILURE);
-  }
-  else if (temperature >= OVERHEATING_WARNING_TEMPERATURE)
-  {
-    setProblem(Problems::OVERHEAT, ProblemState::WARNING);
-  }
-  else
-  {
-    setProblem(Problems::OVERHEAT, ProblemState::NONE);
-  }
+  evaluateThreshold(INPUT_TEMPERATURE, temperature);
 }
 
 const char *getProblemState(Problems problem)
 {
-  return STATE_NAMES.at(getProblem(problem));
+  return STATE_NAMES[getProblem(problem)];
 };
 
 std::string generatePowerFailureMessage(const char *sourceName, ProblemState state)
@@ -504,61 +707,53 @@ std::string generatePowerFailureMessage(const char *sourceName, ProblemState sta
 std::string generateProblemMessage(const char *sourceName, Problems problem, ProblemState state, double value = NAN)
 {
   char buffer[255];
-  switch (problem)
+  const ProblemDescriptor &descriptor = getProblemDescriptor(problem);
+  switch (descriptor.problemClass)
   {
-  case Problems::GENERIC_POWER_FAILURE:
+  case ProblemClass::CLASS_POWER:
     return generatePowerFailureMessage(sourceName, state);
-  case Problems::FREQUENCY_SHIFT:
-  case Problems::OVERHEAT:
-  case Problems::OVERLOAD:
-  case Problems::OVERVOLTAGE:
-  case Problems::PHASE_SHIFT:
-  case Problems::UNDERVOLTAGE:
+  case ProblemClass::CLASS_MEASURED:
     switch (state)
     {
     case ProblemState::NONE:
       snprintf(buffer, sizeof(buffer), TG_RESTORE_MESSAGE_WITH_VALUE,
-               PROBLEMS_NAMES.at(problem), sourceName,
-               value, PROBLEMS_MEASURES.at(problem),
+               descriptor.name, sourceName,
+               value, descriptor.measure,
                dailyWarnings[problem], dailyFailures[problem]);
       break;
     case ProblemState::WARNING:
       snprintf(buffer, sizeof(buffer), TG_WARNING_MESSAGE_WITH_VALUE,
-               PROBLEMS_NAMES.at(problem), sourceName,
-               value, PROBLEMS_MEASURES.at(problem),
+               descriptor.name, sourceName,
+               value, descriptor.measure,
                dailyWarnings[problem]);
       break;
     case ProblemState::FAILURE:
       snprintf(buffer, sizeof(buffer), TG_FAILURE_MESSAGE_WITH_VALUE,
-               PROBLEMS_NAMES.at(problem), sourceName,
-               value, PROBLEMS_MEASURES.at(problem),
+               descriptor.name, sourceName,
+               value, descriptor.measure,
                dailyFailures[problem]);
       break;
     default:
       break;
     }
     return std::string(buffer);
-  case Problems::AC_LINE:
-  case Problems::BATTERY:
-  case Problems::BREAKER:
-  case Problems::POWER_METER:
-  case Problems::INTRUSION:
+  case ProblemClass::CLASS_BINARY:
   default:
     switch (state)
     {
     case ProblemState::NONE:
       snprintf(buffer, sizeof(buffer), TG_RESTORE_MESSAGE,
-               PROBLEMS_NAMES.at(problem), sourceName,
+               descriptor.name, sourceName,
                dailyWarnings[problem], dailyFailures[problem]);
       break;
     case ProblemState::FAILURE:
       snprintf(buffer, sizeof(buffer), TG_FAILURE_MESSAGE,
-               PROBLEMS_NAMES.at(problem), sourceName,
+               descriptor.name, sourceName,
                dailyFailures[problem]);
       break;
     case ProblemState::WARNING:
       snprintf(buffer, sizeof(buffer), TG_WARNING_MESSAGE,
-               PROBLEMS_NAMES.at(problem), sourceName,
+               descriptor.name, sourceName,
                dailyWarnings[problem]);
       break;
     default:
@@ -0,0 +1,447 @@
+#pragma once
+
+#include "io_worker.h"
+#include "log_strings.h"
+#include "sdcard.h"
+#include <FS.h>
+#include <SD.h>
+#include <esphome/core/hal.h>
+#include <esphome/core/time.h>
+
+#define TAG_RETENTION "Retention"
+
+#define RETENTION_ROOT_DIR "/"
+#define RETENTION_MAX_DEPTH 4         // Deepest date tree is /YYYY/MM/DD.
+#define RETENTION_CANDIDATES 16       // Oldest files collected by one scan pass.
+#define RETENTION_ENTRIES_PER_STEP 32 // Directory entries visited by one step.
+#define RETENTION_DELETES_PER_STEP 8  // Files deleted by one step.
+#define RETENTION_PATH_SIZE 96
+
+namespace retention
+{
+  enum RetentionPhase
+  {
+    PHASE_IDLE = 0,
+    PHASE_SCAN = 1,
+    PHASE_DELETE = 2
+  };
+
+  /// @brief Roots of trees the retention is applied to
+  enum RetentionRoot
+  {
+    ROOT_DATE_TREES = 0, // /YYYY..., see sdcard::DateDirectoryMode
+    ROOT_LOG_ARCHIVE = 1,
+    ROOT_COUNT = 2
+  };
+
+  /// @brief File to be deleted. Date is the last day covered by the file (YYYYMMDD).
+  struct Candidate
+  {
+    uint32_t date;
+    uint32_t size;
+    char path[RETENTION_PATH_SIZE];
+  };
+
+  /// @brief Counters of retention runs
+  struct RetentionStats
+  {
+    uint32_t runs;
+    uint32_t filesDeleted;
+    uint32_t failures;
+    uint32_t lastFilesDeleted;
+    uint32_t lastBytesFreed;
+    uint32_t lastRunTime;
+    uint64_t bytesFreed;
+    uint64_t totalBytes; // Size of managed files after the last run.
+  };
+
+  /// @brief State of the current run. Touched by the I/O worker only while a run is active.
+  struct RetentionState
+  {
+    RetentionPhase phase;
+    uint32_t today;
+    uint32_t cutoff; // Files older than cutoff date are expired.
+    uint64_t maxBytes;
+    uint64_t totalBytes;
+    uint8_t root;
+    uint8_t depth;
+    fs::File dirs[RETENTION_MAX_DEPTH];
+    uint32_t dirDates[RETENTION_MAX_DEPTH];
+    Candidate candidates[RETENTION_CANDIDATES];
+    uint8_t count;
+    uint8_t next;
+    bool overflow; // More files than candidates have been seen.
+    uint8_t passDeleted;
+    uint32_t started;
+    uint32_t deleted;
+    uint32_t freed;
+  };
+
+  static RetentionState state{};
+  static RetentionStats stats{};
+  static bool jobInFlight = false;
+  static volatile bool finished = false;
+
+  uint32_t dateKey(const esphome::ESPTime &time)
+  {
+    return time.year * 10000 + time.month * 100 + time.day_of_month;
+  };
+
+  /// @brief Parses date from digits of the text (YYYY, YYYYMM or YYYYMMDD ignoring delimiters).
+  /// @return Last day covered by the date (YYYYMMDD) or 0 if there is no year
+  uint32_t parseDateKey(const char *text, size_t length)
+  {
+    uint32_t digits[8];
+    size_t count = 0;
+    for (size_t i = 0; i < length && count < 8; i++)
+    {
+      if (text[i] >= '0' && text[i] <= '9')
+        digits[count++] = text[i] - '0';
+    };
+    if (count < 4)
+      return 0;
+
+    uint32_t year = digits[0] * 1000 + digits[1] * 100 + digits[2] * 10 + digits[3];
+    uint32_t month = count >= 6 ? digits[4] * 10 + digits[5] : 12;
+    uint32_t day = count >= 8 ? digits[6] * 10 + digits[7] : 31;
+    if (year < 2000 || month < 1 || month > 12 || day < 1 || day > 31)
+      return 0;
+    return year * 10000 + month * 100 + day;
+  };
+
+  const char *baseName(const char *path)
+  {
+    const char *name = strrchr(path, '/');
+    return name == nullptr ? path : name + 1;
+  };
+
+  /// @brief Keeps the oldest files only. Runs on the I/O worker.
+  void addCandidate(const char *path, uint32_t date, uint32_t size)
+  {
+    size_t length = strlen(path);
+    if (length >= RETENTION_PATH_SIZE)
+    {
+      ESP_LOGW(TAG_RETENTION, "Path is too long, file is skipped: %s", path);
+      return;
+    }
+
+    Candidate *slot = nullptr;
+    if (state.count < RETENTION_CANDIDATES)
+    {
+      slot = &state.candidates[state.count++];
+    }
+    else
+    {
+      state.overflow = true;
+      slot = &state.candidates[0];
+      for (auto &candidate : state.candidates)
+      {
+        if (candidate.date > slot->date)
+          slot = &candidate;
+      };
+      if (slot->date <= date)
+        return;
+    }
+    slot->date = date;
+    slot->size = size;
+    memcpy(slot->path, path, length + 1);
+  };
+
+  /// @brief Closes all directories of the scan.
+  void closeDirs()
+  {
+    while (state.depth > 0)
+      state.dirs[--state.depth].close();
+  };
+
+  bool openRoot()
+  {
+    const char *path = state.root == ROOT_LOG_ARCHIVE ? LOG_ARCHIVE : RETENTION_ROOT_DIR;
+    auto dir = SD.open(path);
+    if (!dir || !dir.isDirectory())
+      return false;
+    state.dirs[0] = dir;
+    state.dirDates[0] = 0;
+    state.depth = 1;
+    return true;
+  };
+
+  /// @brief Handles a single directory entry of the scan.
+  void visitEntry(fs::File &entry)
+  {
+    const char *path = entry.path();
+    uint8_t level = state.depth - 1;
+
+    if (entry.isDirectory())
+    {
+      if (state.root == ROOT_LOG_ARCHIVE)
+        return;
+
+      uint32_t date = parseDateKey(path, strlen(path));
+      // Only date directories are managed in the root (see sdcard::DateDirectoryMode).
+      if (date == 0 || (level == 0 && parseDateKey(baseName(path), 4) == 0))
+        return;
+      if (state.depth == RETENTION_MAX_DEPTH)
+      {
+        ESP_LOGW(TAG_RETENTION, "Directory tree is too deep, skipped: %s", path);
+        return;
+      }
+      state.dirs[state.depth] = entry;
+      state.dirDates[state.depth] = date;
+      state.depth++;
+      return;
+    }
+
+    uint32_t date = 0;
+    if (state.root == ROOT_LOG_ARCHIVE)
+    {
+      // Logs which are being compressed now are not touched.
+      if (sdcard::archive.active &&
+          (strcmp(path, sdcard::archive.source) == 0 || strcmp(path, sdcard::archive.target) == 0))
+        return;
+      const char *name = baseName(path);
+      date = parseDateKey(name, strlen(name));
+    }
+    else
+    {
+      date = state.dirDates[level];
+    }
+
+    // Files of the current day (month, year) are never deleted.
+    if (date == 0 || date >= state.today)
+      return;
+
+    state.totalBytes += entry.size();
+    addCandidate(path, date, entry.size());
+  };
+
+  /// @brief Visits up to RETENTION_ENTRIES_PER_STEP directory entries.
+  /// @return true when all trees have been scanned
+  bool scanStep()
+  {
+    for (int visited = 0; visited < RETENTION_ENTRIES_PER_STEP;)
+    {
+      if (state.depth == 0)
+      {
+        if (state.root == ROOT_COUNT)
+          return true;
+        if (!openRoot())
+        {
+          state.root++;
+          continue;
+        }
+      }
+
+      auto entry = state.dirs[state.depth - 1].openNextFile();
+      if (!entry)
+      {
+        state.dirs[--state.depth].close();
+        if (state.depth == 0)
+          state.root++;
+        continue;
+      }
+      visitEntry(entry);
+      visited++;
+    };
+    return false;
+  };
+
+  /// @brief Removes empty date directories from the file up to the root.
+  void removeEmptyParents(const char *path)
+  {
+    char dirname[RETENTION_PATH_SIZE];
+    strcpy(dirname, path);
+    for (int level = 0; level < RETENTION_MAX_DEPTH; level++)
+    {
+      char *delimiter = strrchr(dirname, '/');
+      if (delimiter == nullptr || delimiter == dirname)
+        return;
+      *delimiter = '\0';
+      if (strcmp(dirname, LOG_ARCHIVE) == 0 || strcmp(dirname, LOG_PATH) == 0)
+        return;
+      // rmdir fails on non-empty directory.
+      if (!SD.rmdir(dirname))
+        return;
+      ESP_LOGD(TAG_RETENTION, "Empty directory %s has been removed.", dirname);
+    };
+  };
+
+  /// @brief Orders candidates from the oldest to the newest.
+  void sortCandidates()
+  {
+    for (uint8_t i = 1; i < state.count; i++)
+    {
+      for (uint8_t j = i; j > 0 && state.candidates[j].date < state.candidates[j - 1].date; j--)
+        std::swap(state.candidates[j], state.candidates[j - 1]);
+    };
+  };
+
+  /// @brief Deletes up to RETENTION_DELETES_PER_STEP expired (or exceeding quota) files.
+  /// @return true when nothing has to be deleted in this pass
+  bool deleteStep()
+  {
+    for (int deleted = 0; deleted < RETENTION_DELETES_PER_STEP; deleted++)
+    {
+      if (state.next == state.count)
+        return true;
+
+      auto &candidate = state.candidates[state.next];
+      if (candidate.date >= state.cutoff && state.totalBytes <= state.maxBytes)
+        return true;
+
+      state.next++;
+      if (!SD.remove(candidate.path))
+      {
+        ESP_LOGE(TAG_RETENTION, "Unable to delete file %s.", candidate.path);
+        stats.failures++;
+        continue;
+      }
+      ESP_LOGD(TAG_RETENTION, "File %s (%u bytes) has been deleted.", candidate.path, candidate.size);
+      state.totalBytes -= candidate.size;
+      state.freed += candidate.size;
+      state.deleted++;
+      state.passDeleted++;
+      removeEmptyParents(candidate.path);
+    };
+    return false;
+  };
+
+  void beginPass()
+  {
+    state.phase = RetentionPhase::PHASE_SCAN;
+    state.root = ROOT_DATE_TREES;
+    state.depth = 0;
+    state.totalBytes = 0;
+    state.count = 0;
+    state.next = 0;
+    state.overflow = false;
+    state.passDeleted = 0;
+  };
+
+  void endRun()
+  {
+    closeDirs();
+    state.phase = RetentionPhase::PHASE_IDLE;
+    stats.runs++;
+    stats.filesDeleted += state.deleted;
+    stats.lastFilesDeleted = state.deleted;
+    stats.lastBytesFreed = state.freed;
+    stats.bytesFreed += state.freed;
+    stats.totalBytes = state.totalBytes;
+    stats.lastRunTime = esphome::millis() - state.started;
+    finished = true;
+  };
+
+  /// @brief Performs a bounded piece of the run. Runs on the I/O worker.
+  /// @return false on I/O error
+  bool step()
+  {
+    if (state.phase == RetentionPhase::PHASE_IDLE)
+      return true;
+
+    if (!sdcard::claim())
+      return true; // Card is busy, the step will be repeated.
+
+    if (SD.cardType() == CARD_NONE)
+    {
+      ESP_LOGW(TAG_RETENTION, "SD card has been removed. Retention is aborted.");
+      stats.failures++;
+      endRun();
+      sdcard::free();
+      return false;
+    }
+
+    if (state.phase == RetentionPhase::PHASE_SCAN)
+    {
+      if (scanStep())
+      {
+        sortCandidates();
+        state.phase = RetentionPhase::PHASE_DELETE;
+      }
+    }
+    else if (deleteStep())
+    {
+      // All collected files are gone but older (or exceeding quota) ones may be left.
+      bool more = state.overflow && state.next == state.count && state.passDeleted > 0 &&
+                  (state.totalBytes > state.maxBytes ||
+                   state.candidates[state.count - 1].date < state.cutoff);
+      if (more)
+        beginPass();
+      else
+        endRun();
+    }
+
+    sdcard::free();
+    return true;
+  };
+
+  /// @brief Starts a retention run if it is not running yet.
+  /// @param time Current time
+  /// @param keepDays Files older than this number of days are deleted
+  /// @param maxMegabytes Oldest files are deleted until the total size fits this quota
+  bool start(esphome::ESPTime time, uint32_t keepDays, uint32_t maxMegabytes)
+  {
+    if (!time.is_valid())
+      return false;
+    if (state.phase != RetentionPhase::PHASE_IDLE || jobInFlight)
+    {
+      ESP_LOGW(TAG_RETENTION, "Retention is already running.");
+      return false;
+    }
+
+    state.today = dateKey(time);
+    state.cutoff = dateKey(esphome::ESPTime::from_epoch_utc(time.timestamp - keepDays * 86400));
+    state.maxBytes = static_cast<uint64_t>(maxMegabytes) * 1024 * 1024;
+    state.started = esphome::millis();
+    state.deleted = 0;
+    state.freed = 0;
+    beginPass();
+    ESP_LOGI(TAG_RETENTION, "Retention has been started: keep files since %u, up to %u MB.",
+             state.cutoff, maxMegabytes);
+    return true;
+  };
+
+  bool isRunning() { return state.phase != RetentionPhase::PHASE_IDLE || jobInFlight; };
+
+  /// @brief Drives the run and reports its result. Should be called periodically from the main loop.
+  void loop(esphome::ESPTime time)
+  {
+    if (finished)
+    {
+      finished = false;
+      char message[128];
+      snprintf(message, sizeof(message),
+               "Retention: %u file(s), %.2f MB have been deleted in %u ms. %.2f MB are kept.",
+               stats.lastFilesDeleted, stats.lastBytesFreed / 1024.0 / 1024.0,
+               stats.lastRunTime, stats.totalBytes / 1024.0 / 1024.0);
+      ESP_LOGI(TAG_RETENTION, "%s", message);
+      sdcard::writeLogfile(time, LOG_EVENT_TYPE_INFO, LOG_CATEGORY_SERVICE, message);
+    }
+
+    if (state.phase == RetentionPhase::PHASE_IDLE || jobInFlight)
+      return;
+
+    if (!ioworker::isStarted())
+    {
+      step();
+      return;
+    }
+
+    jobInFlight = true;
+    // The next step is submitted from the callback, so the run is not limited by loop rate.
+    bool submitted = ioworker::submit(
+        "retention step",
+        []()
+        { return step(); },
+        [time](ioworker::JobStatus)
+        {
+          jobInFlight = false;
+          if (state.phase != RetentionPhase::PHASE_IDLE)
+            loop(time);
+        },
+        ioworker::JobPriority::PRIORITY_LOW);
+    if (!submitted)
+      jobInFlight = false;
+  };
+
+}; // namespace retention
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "checksum.h"
+#include "io_worker.h"
+#include "sdcard.h"
+#include "snapshot.h"
+#include "tg_bot_strings.h"
+#include <FS.h>
+#include <SD.h>
+#include <esphome/core/time.h>
+#include <string>
+
+#define TAG_ROLLUPS "Rollups"
+
+#define ROLLUP_FILE "/rollups.dat"
+#define ROLLUP_TEMP_FILE "/rollups.tmp"
+#define ROLLUP_MAGIC 0x50524443 // "CDRP" in little-endian
+#define ROLLUP_VERSION 1
+#define ROLLUP_LOCK_TIMEOUT 500 // ms to wait for SD card files on load
+
+#define ROLLUP_HOURS 24
+#define ROLLUP_DAYS 31
+#define ROLLUP_MONTHS 12
+#define ROLLUP_YEARS 10
+
+// Rollups are stored compactly: counters as uint32_t, measurements as float.
+#define ROLLUP_TYPE_uint64_t uint32_t
+#define ROLLUP_TYPE_double_t float
+
+#define ROLLUP_DIFF_SUM(current, base) ((current) > (base) ? (current) - (base) : 0)
+#define ROLLUP_DIFF_MIN(current, base) (current) // Extremes of an hour are running daily extremes.
+#define ROLLUP_DIFF_MAX(current, base) (current)
+
+#define ROLLUP_FIELD_DECLARE(name, type, aggregate, reset, restore, live) ROLLUP_TYPE_##type name;
+#define ROLLUP_FIELD_PACK(name, type, aggregate, reset, restore, live) packed.name = slice.name;
+#define ROLLUP_FIELD_UNPACK(name, type, aggregate, reset, restore, live) slice.name = packed.name;
+#define ROLLUP_FIELD_DIFF(name, type, aggregate, reset, restore, live) \
+  result.name = ROLLUP_DIFF_##aggregate(current.name, base.name);
+
+namespace rollups
+{
+  /// @brief SnapSlice with 32-bit fields
+  struct PackedSlice
+  {
+    SNAP_SLICE_FIELDS(ROLLUP_FIELD_DECLARE)
+  };
+
+  /// @brief Fixed-capacity ring of closed periods. The newest one is at head - 1.
+  template <size_t N>
+  struct Ring
+  {
+    uint16_t head;
+    uint16_t count;
+    uint32_t keys[N]; // YYYYMMDDHH, YYYYMMDD, YYYYMM or YYYY
+    PackedSlice slices[N];
+  };
+
+  /// @brief Rollups with open period accumulators
+  struct RollupData
+  {
+    uint32_t hourKey;     // Open hour, 0 if not started.
+    PackedSlice hourBase; // Daily data at the start of the open hour.
+    uint32_t monthKey;    // Open month, 0 if there are no closed days in it.
+    PackedSlice month;    // Sum of closed days of the open month.
+    uint32_t yearKey;     // Open year, 0 if there are no closed months in it.
+    PackedSlice year;     // Sum of closed months of the open year.
+    Ring<ROLLUP_HOURS> hours;
+    Ring<ROLLUP_DAYS> days;
+    Ring<ROLLUP_MONTHS> months;
+    Ring<ROLLUP_YEARS> years;
+  };
+
+  /// @brief Header of rollups file, followed by RollupData
+  struct RollupFileHeader
+  {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t crc; // CRC-32 of RollupData
+  };
+
+  static_assert(sizeof(RollupData) <= UINT16_MAX, "Rollup data is too big for the file header.");
+
+  static RollupData data{};
+  // Copy of data being written by the I/O worker.
+  static RollupData persisted{};
+  // Stored rollups have been read or confirmed to be absent. Nothing is changed or saved before that,
+  // so empty rings never overwrite the stored history.
+  static bool loaded = false;
+  static bool writeInFlight = false;
+  static bool writePending = false;
+
+  PackedSlice pack(const SnapSlice &slice)
+  {
+    PackedSlice packed{};
+    SNAP_SLICE_FIELDS(ROLLUP_FIELD_PACK)
+    return packed;
+  };
+
+  SnapSlice unpack(const PackedSlice &packed)
+  {
+    SnapSlice slice{};
+    SNAP_SLICE_FIELDS(ROLLUP_FIELD_UNPACK)
+    return slice;
+  };
+
+  /// @brief Counters accumulated from base to current. Extremes are taken from current.
+  SnapSlice diff(const SnapSlice &current, const SnapSlice &base)
+  {
+    SnapSlice result{};
+    SNAP_SLICE_FIELDS(ROLLUP_FIELD_DIFF)
+    return result;
+  };
+
+  template <size_t N>
+  void push(Ring<N> &ring, uint32_t key, const PackedSlice &slice)
+  {
+    ring.keys[ring.head] = key;
+    ring.slices[ring.head] = slice;
+    ring.head = (ring.head + 1) % N;
+    if (ring.count < N)
+      ring.count++;
+  };
+
+  /// @brief Returns the closed period, 0 is the newest one.
+  template <size_t N>
+  bool get(const Ring<N> &ring, size_t age, uint32_t &key, SnapSlice &slice)
+  {
+    if (age >= ring.count)
+      return false;
+    size_t index = (ring.head + N - 1 - age) % N;
+    key = ring.keys[index];
+    slice = unpack(ring.slices[index]);
+    return true;
+  };
+
+  uint32_t dayKey(const esphome::ESPTime &time)
+  {
+    return (time.year * 100 + time.month) * 100 + time.day_of_month;
+  };
+
+  uint32_t hourKey(const esphome::ESPTime &time) { return dayKey(time) * 100 + time.hour; };
+
+  uint32_t monthKey(const esphome::ESPTime &time) { return time.year * 100 + time.month; };
+
+  /// @brief Adds slice to period accumulator. The first slice of a period is taken as is,
+  /// so reset values of extremes don't leak into the period.
+  void accumulate(uint32_t &accumulatorKey, PackedSlice &accumulator, uint32_t key, const PackedSlice &slice)
+  {
+    if (accumulatorKey == 0)
+      accumulator = slice;
+    else
+      accumulator = pack(unpack(accumulator) + unpack(slice));
+    accumulatorKey = key;
+  };
+
+  bool writeFile(const RollupData &content)
+  {
+    if (!sdcard::claim())
+    {
+      ESP_LOGE(TAG_ROLLUPS, "Unable to open file. Another file is opened already.");
+      return false;
+    }
+
+    RollupFileHeader header{ROLLUP_MAGIC, ROLLUP_VERSION, sizeof(RollupData), crc32Compute(&content, sizeof(content))};
+    auto file = sdmetrics::open(ROLLUP_TEMP_FILE, FILE_WRITE, true);
+    bool is_success = file &&
+                      sdmetrics::write(file, reinterpret_cast<const uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                      sdmetrics::write(file, reinterpret_cast<const uint8_t *>(&content), sizeof(content)) == sizeof(content);
+    if (file)
+      sdmetrics::close(file);
+
+    // Rename doesn't replace files on FAT. If power is lost in between, the temporary file is loaded.
+    is_success = is_success &&
+                 (!sdmetrics::exists(ROLLUP_FILE) || sdmetrics::remove(ROLLUP_FILE)) &&
+                 sdmetrics::rename(ROLLUP_TEMP_FILE, ROLLUP_FILE);
+    sdcard::free();
+
+    if (!is_success)
+      ESP_LOGE(TAG_ROLLUPS, "Unable to write rollups to %s.", ROLLUP_FILE);
+    return is_success;
+  };
+
+  bool readFile(const char *path, RollupData &content)
+  {
+    auto file = sdmetrics::open(path, FILE_READ);
+    if (!file)
+      return false;
+
+    RollupFileHeader header{};
+    bool is_valid = file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                    header.magic == ROLLUP_MAGIC && header.version == ROLLUP_VERSION &&
+                    header.size == sizeof(RollupData) &&
+                    file.read(reinterpret_cast<uint8_t *>(&content), sizeof(content)) == sizeof(content) &&
+                    header.crc == crc32Compute(&content, sizeof(content));
+    sdmetrics::close(file);
+    if (!is_valid)
+      ESP_LOGW(TAG_ROLLUPS, "Rollups file %s is invalid.", path);
+    return is_valid;
+  };
+
+  /// @brief Loads rollups from SD card. Should be called on boot and after the card is mounted.
+  /// Starts from scratch only if there is no valid rollups file. Does nothing once loaded.
+  /// @return true if rollups are loaded or started from scratch
+  bool load()
+  {
+    if (loaded)
+      return true;
+
+    if (SD.cardType() == CARD_NONE)
+    {
+      ESP_LOGW(TAG_ROLLUPS, "SD card is not available. Rollups will be loaded after it is mounted.");
+      return false;
+    }
+    if (!sdcard::claim(ROLLUP_LOCK_TIMEOUT))
+    {
+      ESP_LOGW(TAG_ROLLUPS, "SD card is busy. Rollups will be loaded later.");
+      return false;
+    }
+
+    bool has_file = sdmetrics::exists(ROLLUP_FILE) || sdmetrics::exists(ROLLUP_TEMP_FILE);
+    bool is_success = has_file && (readFile(ROLLUP_FILE, data) || readFile(ROLLUP_TEMP_FILE, data));
+    sdcard::free();
+    if (!is_success)
+    {
+      if (has_file)
+        ESP_LOGW(TAG_ROLLUPS, "Stored rollups are invalid. Starting from scratch.");
+      else
+        ESP_LOGW(TAG_ROLLUPS, "There are no stored rollups. Starting from scratch.");
+      data = RollupData{};
+    }
+    loaded = true;
+    return true;
+  };
+
+  void completeWrite(ioworker::JobStatus status);
+
+  /// @brief Queues writing of rollups. Data is copied.
+  void save()
+  {
+    if (!loaded || SD.cardType() == CARD_NONE)
+      return;
+
+    if (writeInFlight)
+    {
+      writePending = true;
+      return;
+    }
+
+    persisted = data;
+    writePending = false;
+    if (!ioworker::isStarted())
+    {
+      writeFile(persisted);
+      return;
+    }
+
+    writeInFlight = ioworker::submit(
+        "rollups write",
+        []()
+        { return writeFile(persisted); },
+        completeWrite);
+  };
+
+  void completeWrite(ioworker::JobStatus status)
+  {
+    writeInFlight = false;
+    if (writePending)
+      save();
+  };
+
+  void closeYear()
+  {
+    push(data.years, data.yearKey, data.year);
+    data.yearKey = 0;
+  };
+
+  void closeMonth()
+  {
+    if (data.yearKey != 0 && data.yearKey != data.monthKey / 100)
+      closeYear(); // Year has not been closed on time (node was down).
+    accumulate(data.yearKey, data.year, data.monthKey / 100, data.month);
+    push(data.months, data.monthKey, data.month);
+    if (data.monthKey % 100 == 12)
+      closeYear();
+    data.monthKey = 0;
+  };
+
+  /// @brief Closes the hour which has been open since the previous call.
+  /// Should be called at the start of every hour with the current daily data.
+  void closeHour(esphome::ESPTime time, const SnapSlice &daily)
+  {
+    if (!time.is_valid() || !load())
+      return;
+
+    uint32_t key = hourKey(time);
+    if (data.hourKey == key)
+      return;
+
+    // Daily data is reset at the end of the day, so the hour of another day can't be closed here.
+    if (data.hourKey != 0 && data.hourKey / 100 == key / 100)
+      push(data.hours, data.hourKey, pack(diff(daily, unpack(data.hourBase))));
+    data.hourKey = key;
+    data.hourBase = pack(daily);
+    save();
+  };
+
+  /// @brief Closes the day (and the month or the year if it's over).
+  /// Should be called with the final daily data right before it's reset.
+  void closeDay(esphome::ESPTime time, const SnapSlice &daily)
+  {
+    if (!time.is_valid())
+      return;
+    if (!load())
+    {
+      ESP_LOGE(TAG_ROLLUPS, "Rollups are not loaded. Day %04d-%02d-%02d is not rolled up.", time.year, time.month,
+               time.day_of_month);
+      return;
+    }
+
+    // The rest of the last hour goes to that hour. The next hour starts from reset daily data.
+    uint32_t day = dayKey(time);
+    if (data.hourKey != 0 && data.hourKey / 100 == day)
+      push(data.hours, data.hourKey, pack(diff(daily, unpack(data.hourBase))));
+    data.hourKey = 0;
+
+    PackedSlice packed = pack(daily);
+    push(data.days, day, packed);
+
+    uint32_t month = monthKey(time);
+    if (data.monthKey != 0 && data.monthKey != month)
+      closeMonth(); // Month has not been closed on time (node was down).
+    accumulate(data.monthKey, data.month, month, packed);
+
+    esphome::ESPTime tomorrow = time;
+    tomorrow.increment_day();
+    if (tomorrow.month != time.month)
+      closeMonth();
+    save();
+  };
+
+  /// @brief Makes report message of the closed period.
+  std::string generateReport(const char *source_name, const char *period_name,
+                             const char *period, const SnapSlice &slice)
+  {
+    char buffer[1024];
+    auto str_len = snprintf(
+        buffer, sizeof(buffer), TG_PERIOD_REPORT_FORMAT, period_name, period, source_name,
+        slice.energyConsumption,
+        static_cast<uint64_t>(slice.powerFailuresCount),
+        static_cast<uint64_t>(slice.powerFailuresDuration / 60),
+        formatRange(slice.minVoltage, slice.maxVoltage, "V").c_str(),
+        formatRange(slice.minFrequency, slice.maxFrequency, "Hz").c_str()
+            TG_SUMMARY_EVENTS(TG_SUMMARY_EVENT_ARGS_WF, TG_SUMMARY_EVENT_ARGS_F));
+    std::string out(buffer);
+    out.resize(str_len);
+    out.shrink_to_fit();
+    return out;
+  };
+
+  /// @brief Makes report of the last closed month.
+  /// @return empty string if there is no closed month yet
+  std::string generateMonthlyReport(const char *source_name)
+  {
+    uint32_t key;
+    SnapSlice slice;
+    if (!get(data.months, 0, key, slice))
+      return {};
+    char period[16];
+    snprintf(period, sizeof(period), "%04u-%02u", key / 100, key % 100);
+    return generateReport(source_name, "Monthly", period, slice);
+  };
+
+  /// @brief Makes report of the last closed year.
+  /// @return empty string if there is no closed year yet
+  std::string generateYearlyReport(const char *source_name)
+  {
+    uint32_t key;
+    SnapSlice slice;
+    if (!get(data.years, 0, key, slice))
+      return {};
+    char period[16];
+    snprintf(period, sizeof(period), "%04u", key);
+    return generateReport(source_name, "Yearly", period, slice);
+  };
+
+}; // namespace rollups
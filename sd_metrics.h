@@ -0,0 +1,170 @@
+#pragma once
+
+#include <FS.h>
+#include <SD.h>
+#include <cmath>
+#include <esphome/core/hal.h>
+#include <utility>
+
+#define SD_METRICS_BUCKETS 24 // Bucket i counts latencies below 2^i us, the last one is open-ended.
+#define SD_METRICS_DECAY_COUNT 4096 // Histogram is halved when it reaches this count.
+
+namespace sdmetrics
+{
+  enum Operation
+  {
+    OP_OPEN = 0,
+    OP_WRITE = 1, // write(), print(), println() and printf()
+    OP_CLOSE = 2,
+    OP_EXISTS = 3,
+    OP_MKDIR = 4,
+    OP_RENAME = 5,
+    OP_REMOVE = 6,
+    OP_COUNT = 7
+  };
+
+  /// @brief Log2 latency histogram of one operation type
+  struct Histogram
+  {
+    uint32_t buckets[SD_METRICS_BUCKETS];
+    uint32_t count;
+    uint32_t max;    // us, since the last takeMax()
+    uint32_t errors; // since boot
+  };
+
+  // Updated by the I/O worker and the main loop, read by sensors. Word-sized
+  // counters are good enough for diagnostics, so there's no locking.
+  static Histogram histograms[OP_COUNT]{};
+
+  /// @brief Adds operation latency to the histogram.
+  /// Old samples are aged out by halving, so percentiles follow recent behaviour.
+  void record(Operation op, uint32_t started, bool is_success)
+  {
+    uint32_t latency = esphome::micros() - started;
+    Histogram &histogram = histograms[op];
+
+    int bucket = 0;
+    while (bucket < SD_METRICS_BUCKETS - 1 && (latency >> bucket) != 0)
+      bucket++;
+
+    if (histogram.count >= SD_METRICS_DECAY_COUNT)
+    {
+      histogram.count = 0;
+      for (auto &value : histogram.buckets)
+      {
+        value /= 2;
+        histogram.count += value;
+      };
+    }
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    if (latency > histogram.max)
+      histogram.max = latency;
+    if (!is_success)
+      histogram.errors++;
+  };
+
+  void error(Operation op) { histograms[op].errors++; };
+
+  /// @brief Estimates latency percentile as the upper bound of the bucket.
+  /// @param percent 0..100
+  /// @return latency in milliseconds or NAN if there's no data
+  float percentile(Operation op, float percent)
+  {
+    const Histogram &histogram = histograms[op];
+    uint32_t count = histogram.count;
+    if (count == 0)
+      return NAN;
+
+    uint32_t rank = static_cast<uint32_t>(count * percent / 100.0f + 0.5f);
+    uint32_t seen = 0;
+    for (int bucket = 0; bucket < SD_METRICS_BUCKETS; bucket++)
+    {
+      seen += histogram.buckets[bucket];
+      if (seen >= rank && seen > 0)
+        return (1UL << bucket) / 1000.0f;
+    };
+    return (1UL << (SD_METRICS_BUCKETS - 1)) / 1000.0f;
+  };
+
+  /// @brief Returns the longest latency (ms) since the previous call and resets it.
+  float takeMax(Operation op)
+  {
+    uint32_t max = histograms[op].max;
+    histograms[op].max = 0;
+    return histograms[op].count == 0 ? NAN : max / 1000.0f;
+  };
+
+  fs::File open(const char *path, const char *mode = FILE_READ, bool create = false)
+  {
+    uint32_t started = esphome::micros();
+    auto file = SD.open(path, mode, create);
+    record(OP_OPEN, started, static_cast<bool>(file));
+    return file;
+  };
+
+  void close(fs::File &file)
+  {
+    uint32_t started = esphome::micros();
+    file.close();
+    record(OP_CLOSE, started, true);
+  };
+
+  bool exists(const char *path)
+  {
+    uint32_t started = esphome::micros();
+    bool result = SD.exists(path);
+    record(OP_EXISTS, started, true); // Missing file isn't an error.
+    return result;
+  };
+
+  bool mkdir(const char *path)
+  {
+    uint32_t started = esphome::micros();
+    bool result = SD.mkdir(path);
+    record(OP_MKDIR, started, true); // Fails on existing directory, so errors are counted by caller.
+    return result;
+  };
+
+  bool rename(const char *from, const char *to)
+  {
+    uint32_t started = esphome::micros();
+    bool result = SD.rename(from, to);
+    record(OP_RENAME, started, result);
+    return result;
+  };
+
+  bool remove(const char *path)
+  {
+    uint32_t started = esphome::micros();
+    bool result = SD.remove(path);
+    record(OP_REMOVE, started, result);
+    return result;
+  };
+
+  size_t write(fs::File &file, const uint8_t *data, size_t size)
+  {
+    uint32_t started = esphome::micros();
+    size_t written = file.write(data, size);
+    record(OP_WRITE, started, written == size);
+    return written;
+  };
+
+  size_t println(fs::File &file, const char *line)
+  {
+    uint32_t started = esphome::micros();
+    size_t written = file.println(line);
+    record(OP_WRITE, started, written != 0);
+    return written;
+  };
+
+  template <typename... Args>
+  size_t printf(fs::File &file, const char *format, Args &&...args)
+  {
+    uint32_t started = esphome::micros();
+    size_t written = file.printf(format, std::forward<Args>(args)...);
+    record(OP_WRITE, started, written != 0);
+    return written;
+  };
+
+}; // namespace sdmetrics
@@ -1,9 +1,15 @@
 #pragma once
 
 #include "csv_strings.h"
+#include "io_worker.h"
+#include "lzss.h"
+#include "sd_metrics.h"
 #include <FS.h>
 #include <SD.h>
+#include <esphome/core/hal.h>
 #include <esphome/core/time.h>
+#include <memory>
+#include <new>
 #include <string>
 #include <vfs_api.h>
 
@@ -16,32 +22,45 @@
 #define LOG_PATH "/events"
 #define LOG_ARCHIVE LOG_PATH "/archive"
 #define LOG_FILENAME LOG_PATH "/eventlog.csv"
-#define LOG_ROTATE_FILENAME LOG_ARCHIVE "/%Y%m%d.log"
+#define LOG_ROTATE_FILENAME LOG_ARCHIVE "/%Y%m%d-%H%M%S.log"
+#define LOG_ROTATE_EXTENSION ".log"
+#define LOG_COMPRESS_STEP 32768 // Input bytes compressed by one I/O job.
+#define LOG_COMPRESS_CHUNK 512
+
+// Modes to update files in place (FILE_WRITE truncates and FILE_APPEND ignores seek).
+#define FILE_UPDATE "r+"
+#define FILE_CREATE_UPDATE "w+"
+
+#define DIR_CACHE_SIZE 4
+#define CLEAR_MAX_DEPTH 8
+
+#define LOG_BUFFER_CAPACITY 32
+#define LOG_RECORD_SIZE 160
+#define LOG_BATCH_SIZE 8
+#define LOG_FLUSH_INTERVAL 30000 // ms
 
 namespace sdcard
 {
-  static bool is_file_open = false;
+  static SemaphoreHandle_t file_lock = xSemaphoreCreateMutex();
 
+  /// @brief Takes exclusive access to SD card files without waiting.
   bool claim()
   {
-    if (is_file_open)
-      return false;
+    return xSemaphoreTake(file_lock, 0) == pdTRUE;
+  };
 
-    is_file_open = true;
-    return true;
+  /// @brief Takes exclusive access to SD card files, waiting up to the timeout.
+  bool claim(uint32_t timeout_ms)
+  {
+    return xSemaphoreTake(file_lock, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
   };
 
   bool free()
   {
-    if (!is_file_open)
-      return false;
-
-    is_file_open = false;
-
-    return true;
+    return xSemaphoreGive(file_lock) == pdTRUE;
   };
 
-  bool can_claim() { return !is_file_open && (SD.cardType() != CARD_NONE); };
+  bool can_claim() { return (uxSemaphoreGetCount(file_lock) > 0) && (SD.cardType() != CARD_NONE); };
 
   enum DateDirectoryMode
   {
@@ -123,149 +142,562 @@ namespace sdcard
     }
   }
 
-  bool ensure_date_dir_path(esphome::ESPTime time,
-                            DateDirectoryMode mode = DateDirectoryMode::PLAIN)
+  /// @brief Creates directory with all missing parents (mkdir -p). Existing elements are tolerated.
+  bool make_dirs(const char *dirname)
   {
-
-    std::string dirname;
-    dirname.resize(128);
-    auto sz = date_path(&dirname[0], dirname.size(), time, mode);
-    dirname.resize(sz);
-
-    ESP_LOGI("SD", "Ensure date-dependent path: %s", dirname.c_str());
-    // if (dirname.empty())
-    //   return false;
-    if (SD.exists(dirname.c_str()))
+    char path[255] = {'\0'}; // Max allowed path in FAT16.
+    size_t path_size = strlen(dirname);
+    if (path_size >= sizeof(path))
     {
-      ESP_LOGI("SD", "Directory %s exists.", dirname.c_str());
-      return true;
+      ESP_LOGE("SD", "Path tree is too long: %s", dirname);
+      return false;
     }
-    else
+    if (dirname[0] != '/')
     {
-      ESP_LOGI("SD", "Directory %s is not exists, trying to create it.", dirname.c_str());
-      char path[255] = {'\0'}; // Max allowed path in FAT16.
-      size_t path_size = dirname.size();
-      path[0] = dirname[0];
-      if (path_size >= 254)
-      {
-        ESP_LOGE("SD", "Date-dependent path tree is too long.");
-        return false;
-      }
-      if (path[0] != '/')
+      ESP_LOGE("SD", "Malformed path: %s", dirname);
+      return false;
+    }
+
+    memcpy(path, dirname, path_size);
+    for (size_t i = 1; i <= path_size; i++)
+    {
+      if (path[i] != '/' && path[i] != '\0')
+        continue;
+      if (path[i - 1] == '/')
+        continue; // Skip repeated and trailing delimiters.
+
+      char delimiter = path[i];
+      path[i] = '\0';
+      // mkdir fails on existing directory, so exists() is checked on failure only.
+      if (!sdmetrics::mkdir(path) && !sdmetrics::exists(path))
       {
-        ESP_LOGE("SD", "Malformed date-dependent path: %s", dirname.c_str());
+        sdmetrics::error(sdmetrics::OP_MKDIR);
+        ESP_LOGE("SD", "Unable to create dir tree element: %s", path);
         return false;
       }
-      for (int i = 1; i < path_size; i++)
-      {
-        if ((dirname[i] == '/'))
-        {
-          ESP_LOGI("SD", "Creating path element: %s", &path[0]);
-          if (!SD.mkdir(&path[0]))
-          {
-            ESP_LOGE("SD", "Unable to create date-dependent dir tree element: %s", &path[0]);
-            return false;
-          };
-        };
-        path[i] = dirname[i];
-        if (i == (path_size - 1))
-        {
-          path[i + 1] = '\0';
-          ESP_LOGI("SD", "Creating the last path element: %s", &path[0]);
-          if (!SD.mkdir(&path[0]))
-          {
-            ESP_LOGE("SD", "Unable to create date-dependent dir tree element: %s", &path[0]);
-            return false;
-          };
-          return true;
-        }
-      };
+      path[i] = delimiter;
     };
-    return false;
+    return true;
   };
 
-  bool writeLogfile(esphome::ESPTime time, const char *eventType,
-                    const char *category, const char *message)
+  /// @brief Known-existing date directory
+  struct DirCacheEntry
   {
+    uint32_t generation;
+    uint32_t lastUsed;
+    int32_t bucket;
+    DateDirectoryMode mode;
+  };
+
+  static DirCacheEntry dirCache[DIR_CACHE_SIZE]{};
+  static uint32_t dirCacheClock = 0;
+  // Entries of previous generations are stale. Zero generation is never used.
+  static volatile uint32_t dirCacheGeneration = 1;
 
+  /// @brief Forgets all known directories. Must be called when SD card is (re)mounted.
+  void invalidate_dir_cache() { dirCacheGeneration = dirCacheGeneration + 1; };
+
+  /// @brief Date bucket of directory: every date inside of the bucket shares the same directory.
+  int32_t date_bucket(esphome::ESPTime time, DateDirectoryMode mode)
+  {
+    switch (mode)
+    {
+    case DateDirectoryMode::BY_YEAR:
+      return time.year * 10000;
+    case DateDirectoryMode::BY_MONTH:
+    case DateDirectoryMode::BY_YEAR_THEN_BY_MONTH:
+      return time.year * 10000 + time.month * 100;
+    case DateDirectoryMode::PLAIN:
+    case DateDirectoryMode::BY_DAY:
+    case DateDirectoryMode::BY_YEAR_THEN_BY_MONTH_THEN_BY_DAY:
+    case DateDirectoryMode::BY_MONTH_THEN_BY_DAY:
+    default:
+      return time.year * 10000 + time.month * 100 + time.day_of_month;
+    }
+  };
+
+  bool ensure_date_dir_path(esphome::ESPTime time,
+                            DateDirectoryMode mode = DateDirectoryMode::PLAIN)
+  {
     if (!time.is_valid())
       return false;
 
-    if (!SD.exists(LOG_PATH))
+    uint32_t generation = dirCacheGeneration;
+    int32_t bucket = date_bucket(time, mode);
+    DirCacheEntry *victim = &dirCache[0];
+    for (auto &entry : dirCache)
     {
-      ESP_LOGW("SD", "Log path not found. Trying to create log directory: %s.",
-               LOG_PATH);
-      if (!SD.mkdir(LOG_PATH))
+      if (entry.generation == generation && entry.mode == mode && entry.bucket == bucket)
       {
-        ESP_LOGE("SD", "Unable to create log directory: %s", LOG_PATH);
+        entry.lastUsed = ++dirCacheClock;
+        return true;
+      }
+      if (entry.generation != generation)
+        victim = &entry; // Stale entries are replaced first.
+      else if (victim->generation == generation && entry.lastUsed < victim->lastUsed)
+        victim = &entry;
+    };
+
+    char dirname[128];
+    date_path(dirname, sizeof(dirname), time, mode);
+
+    ESP_LOGD("SD", "Ensure date-dependent path: %s", dirname);
+    if (!sdmetrics::exists(dirname))
+    {
+      ESP_LOGI("SD", "Directory %s is not exists, trying to create it.", dirname);
+      if (!make_dirs(dirname))
+      {
+        ESP_LOGE("SD", "Unable to create date-dependent dir tree: %s", dirname);
         return false;
-      };
-      if (!SD.mkdir(LOG_ARCHIVE))
+      }
+    }
+
+    victim->generation = generation;
+    victim->mode = mode;
+    victim->bucket = bucket;
+    victim->lastUsed = ++dirCacheClock;
+    return true;
+  };
+
+  /// @brief Event log line prepared for the batched writer
+  struct LogRecord
+  {
+    uint16_t length;
+    char line[LOG_RECORD_SIZE];
+  };
+
+  /// @brief Counters of the buffered event log
+  struct LogStats
+  {
+    uint32_t queued;
+    uint32_t written;
+    uint32_t dropped;
+    uint32_t flushes;
+    uint32_t failedFlushes;
+    uint32_t lastFlushLatency;
+    uint32_t maxFlushLatency;
+  };
+
+  static LogRecord logBuffer[LOG_BUFFER_CAPACITY];
+  static size_t logHead = 0;
+  static size_t logCount = 0;
+  // Records [logHead, logHead + logInFlight) are being written by the I/O worker.
+  static size_t logInFlight = 0;
+  static uint32_t logOldestMillis = 0;
+  static uint32_t logDirGeneration = 0;
+  // Event log size tracked in RAM. Negative if it must be read from the card.
+  static long logFileSize = -1;
+  static LogStats logStats{};
+  // Set by the I/O worker when a log has been rotated and needs to be compressed.
+  static volatile bool archivePending = true;
+
+  size_t pendingLogRecords() { return logCount; };
+
+  /// @brief Appends buffered records to the event log with a single open/append/close.
+  /// Runs on the I/O worker, touches in-flight records only.
+  /// @param time Current time (used for rotation file name)
+  /// @param first Index of the first record in the log buffer
+  /// @param count Number of records to write
+  /// @return Number of written records
+  size_t writeLogRecords(esphome::ESPTime time, size_t first, size_t count)
+  {
+    if (logDirGeneration != dirCacheGeneration && !sdmetrics::exists(LOG_ARCHIVE))
+    {
+      ESP_LOGW("SD", "Log path not found. Trying to create log directory: %s.",
+               LOG_ARCHIVE);
+      if (!make_dirs(LOG_ARCHIVE))
       {
         ESP_LOGE("SD", "Unable to create log archive directory: %s", LOG_ARCHIVE);
-        return false;
+        return 0;
       };
     }
+    if (logDirGeneration != dirCacheGeneration)
+      logFileSize = -1; // Card has been remounted.
+    logDirGeneration = dirCacheGeneration;
 
     if (!claim())
-      return false;
-
-    bool needHeader = !SD.exists(LOG_FILENAME);
+      return 0;
 
-    if (needHeader)
+    if (logFileSize > MAX_FILE_SIZE)
     {
-      ESP_LOGI("SD Log",
-               "Log file %s not found. Trying to create and empty CSV log.",
-               LOG_FILENAME);
-    }
+      char filename[64];
+      time.strftime(filename, sizeof(filename), LOG_ROTATE_FILENAME);
+      ESP_LOGW("SD Log", "Need to rotate log: %s >>> %s.", LOG_FILENAME,
+               filename);
+      if (!sdmetrics::rename(LOG_FILENAME, filename))
+      {
+        ESP_LOGE("SD", "Unable to rotate logfile.");
+        logFileSize = -1;
+        free();
+        return 0;
+      };
+      logFileSize = 0;
+      archivePending = true;
+    };
 
-    auto logfile = SD.open(LOG_FILENAME, FILE_APPEND, true);
+    auto logfile = sdmetrics::open(LOG_FILENAME, FILE_APPEND, true);
 
     if (!logfile)
     {
       ESP_LOGE("SD", "Unable to open or create event log.");
+      logFileSize = -1;
       free();
+      return 0;
+    };
+
+    if (logFileSize < 0)
+    {
+      logFileSize = logfile.size();
+      ESP_LOGD("SD Log", "Log file size is %.2f Mb", logFileSize / 1024.0 / 1024.0);
+    }
+
+    if (logFileSize == 0)
+    {
+      ESP_LOGI("SD Log", "Log file %s is empty. Writing CSV header.", LOG_FILENAME);
+      logFileSize += sdmetrics::println(logfile, CSV_EVENTLOG_HEADER);
+    }
+
+    size_t written = 0;
+    while (written < count)
+    {
+      auto &record = logBuffer[(first + written) % LOG_BUFFER_CAPACITY];
+      if (sdmetrics::write(logfile, reinterpret_cast<const uint8_t *>(record.line), record.length) != record.length)
+      {
+        ESP_LOGE("SD Log", "Unable to append log record. %u record(s) left in buffer.",
+                 static_cast<unsigned>(count - written));
+        logFileSize = -1; // Partial write, size is unknown.
+        break;
+      }
+      logFileSize += record.length;
+      written++;
+    };
+    sdmetrics::close(logfile);
+    free();
+    return written;
+  };
+
+  /// @brief Releases written records and updates log statistics. Runs on the main loop.
+  void completeLogFlush(size_t written, uint32_t started)
+  {
+    logHead = (logHead + written) % LOG_BUFFER_CAPACITY;
+    logCount -= written;
+    logInFlight = 0;
+    logOldestMillis = esphome::millis();
+    logStats.written += written;
+    logStats.flushes++;
+    logStats.lastFlushLatency = esphome::millis() - started;
+    logStats.maxFlushLatency = max(logStats.maxFlushLatency, logStats.lastFlushLatency);
+    if (logCount > 0)
+      logStats.failedFlushes++;
+    ESP_LOGI("SD Log", "%u log record(s) have been added in %u ms.",
+             static_cast<unsigned>(written), logStats.lastFlushLatency);
+  };
+
+  /// @brief Starts writing of all buffered records by the I/O worker.
+  /// @param time Current time (used for rotation file name)
+  /// @param force Flush even if the batch is not full and flush interval is not expired
+  /// @return false if the flush can't be started
+  bool flushLogfile(esphome::ESPTime time, bool force = false)
+  {
+    if (logCount == 0 || logInFlight > 0)
+      return true;
+
+    if (!force && (logCount < LOG_BATCH_SIZE) &&
+        (esphome::millis() - logOldestMillis < LOG_FLUSH_INTERVAL))
+      return true;
+
+    if (!time.is_valid() || SD.cardType() == CARD_NONE)
+      return false;
+
+    uint32_t started = esphome::millis();
+    size_t first = logHead;
+    size_t count = logCount;
+    logInFlight = count;
+
+    if (!ioworker::isStarted())
+    {
+      completeLogFlush(writeLogRecords(time, first, count), started);
+      return logCount == 0;
+    }
+
+    auto written = std::make_shared<size_t>(0);
+    bool submitted = ioworker::submit(
+        "event log flush",
+        [time, first, count, written]()
+        {
+          *written = writeLogRecords(time, first, count);
+          return *written == count;
+        },
+        [written, started](ioworker::JobStatus)
+        { completeLogFlush(*written, started); },
+        force ? ioworker::JobPriority::PRIORITY_HIGH : ioworker::JobPriority::PRIORITY_NORMAL);
+
+    if (!submitted)
+    {
+      logInFlight = 0;
+      logStats.failedFlushes++;
+    }
+    return submitted;
+  };
+
+  /// @brief Puts an event into the log buffer. Records are written by flushLogfile().
+  /// When the buffer is full, the record is dropped.
+  bool writeLogfile(esphome::ESPTime time, const char *eventType,
+                    const char *category, const char *message)
+  {
+
+    if (!time.is_valid())
+      return false;
+
+    if (logCount == LOG_BUFFER_CAPACITY)
+    {
+      flushLogfile(time, true);
+      ESP_LOGW("SD Log", "Event log buffer is full. The record is dropped: %s", message);
+      logStats.dropped++;
       return false;
     };
 
-    long filesize = 0;
-    filesize = logfile.size();
-    ESP_LOGI("SD Log", "Log file size is %.2f Mb", filesize / 1024.0 / 1024.0);
+    if (logCount == 0)
+      logOldestMillis = esphome::millis();
+
+    char timestamp[24];
+    time.strftime(timestamp, sizeof(timestamp), CSV_EVENTLOG_DATE_FORMAT);
 
-    bool needRotate = (filesize > 0) && (filesize > MAX_FILE_SIZE);
-    if (needRotate)
+    auto &record = logBuffer[(logHead + logCount) % LOG_BUFFER_CAPACITY];
+    int length = snprintf(record.line, sizeof(record.line), CSV_EVENTLOG_DATALINE_FORMAT,
+                          timestamp, eventType, category, message);
+    if (length < 0)
+      return false;
+    if (length >= static_cast<int>(sizeof(record.line)))
     {
-      const char *filename = time.strftime(LOG_ROTATE_FILENAME).c_str();
-      ESP_LOGW("SD Log", "Need to rotate log: %s >>> %s.", LOG_FILENAME,
-               filename);
-      logfile.close();
-      if (!SD.rename(LOG_FILENAME, filename))
+      // Keep the line terminated when message is truncated.
+      length = sizeof(record.line) - 1;
+      record.line[length - 1] = '\n';
+    }
+    record.length = static_cast<uint16_t>(length);
+    logCount++;
+    logStats.queued++;
+    if (logCount >= LOG_BATCH_SIZE)
+      flushLogfile(time);
+    return true;
+  };
+
+  /// @brief State of rotated log compression. Touched by the I/O worker only.
+  struct ArchiveCompression
+  {
+    bool active;
+    char source[64];
+    char target[64];
+    uint32_t offset;
+    uint32_t size;
+    uint32_t compressed;
+    uint32_t started;
+    LzssEncoder *encoder;
+  };
+
+  /// @brief Counters of rotated log compression
+  struct ArchiveStats
+  {
+    uint32_t compressed;
+    uint32_t failed;
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+    uint32_t lastDuration;
+  };
+
+  static ArchiveCompression archive{};
+  static ArchiveStats archiveStats{};
+  static bool archiveJobInFlight = false;
+
+  /// @brief Finds the first rotated log which is not compressed yet.
+  bool findRotatedLog(char *path, size_t size)
+  {
+    auto dir = sdmetrics::open(LOG_ARCHIVE);
+    if (!dir || !dir.isDirectory())
+      return false;
+
+    const size_t extension = strlen(LOG_ROTATE_EXTENSION);
+    auto file = dir.openNextFile();
+    while (file)
+    {
+      const char *name = file.path();
+      size_t length = strlen(name);
+      if (!file.isDirectory() && length > extension && length < size &&
+          strcmp(name + length - extension, LOG_ROTATE_EXTENSION) == 0)
       {
-        ESP_LOGE("SD", "Unable to rotate logfile.");
+        memcpy(path, name, length + 1);
+        return true;
+      }
+      file = dir.openNextFile();
+    };
+    return false;
+  };
+
+  void releaseArchiveCompression()
+  {
+    delete archive.encoder;
+    archive.encoder = nullptr;
+    archive.active = false;
+  };
+
+  /// @brief Creates compressed file with header for archive.source.
+  bool startArchiveCompression()
+  {
+    size_t length = strlen(archive.source) - strlen(LOG_ROTATE_EXTENSION);
+    if (length + strlen(LZSS_EXTENSION) >= sizeof(archive.target))
+      return false;
+    memcpy(archive.target, archive.source, length);
+    strcpy(archive.target + length, LZSS_EXTENSION);
+
+    auto source = sdmetrics::open(archive.source, FILE_READ);
+    if (!source)
+      return false;
+    archive.size = source.size();
+    sdmetrics::close(source);
+
+    auto target = sdmetrics::open(archive.target, FILE_WRITE, true);
+    if (!target)
+      return false;
+    auto header = lzssMakeHeader(archive.size);
+    bool written = sdmetrics::write(target, reinterpret_cast<const uint8_t *>(&header), sizeof(header)) == sizeof(header);
+    sdmetrics::close(target);
+    if (!written)
+      return false;
+
+    archive.encoder = new (std::nothrow) LzssEncoder;
+    if (archive.encoder == nullptr)
+    {
+      ESP_LOGE("SD Log", "Not enough memory to compress %s.", archive.source);
+      return false;
+    }
+    lzssReset(*archive.encoder);
+    archive.offset = 0;
+    archive.compressed = sizeof(header);
+    archive.started = esphome::millis();
+    archive.active = true;
+    ESP_LOGI("SD Log", "Compressing rotated log %s (%u bytes).", archive.source, archive.size);
+    return true;
+  };
+
+  /// @brief Compresses the next LOG_COMPRESS_STEP bytes of a rotated log.
+  /// Runs on the I/O worker. The source is removed when it is compressed completely.
+  /// @return false on I/O error
+  bool compressArchiveStep()
+  {
+    if (!claim())
+      return true; // Card is busy, the step will be repeated.
+
+    if (!archive.active)
+    {
+      if (!findRotatedLog(archive.source, sizeof(archive.source)))
+      {
+        archivePending = false;
         free();
-        return false;
-      };
-      logfile = SD.open(LOG_FILENAME, FILE_APPEND, true);
-      if (!logfile)
+        return true;
+      }
+      if (!startArchiveCompression())
       {
-        ESP_LOGE("SD", "Unable to open or create event log.");
+        ESP_LOGE("SD Log", "Unable to start compression of %s.", archive.source);
+        releaseArchiveCompression();
+        archiveStats.failed++;
+        archivePending = false;
         free();
         return false;
+      }
+    }
+
+    auto source = sdmetrics::open(archive.source, FILE_READ);
+    auto target = sdmetrics::open(archive.target, FILE_APPEND);
+    bool ok = source && target && source.seek(archive.offset);
+
+    uint8_t in[LOG_COMPRESS_CHUNK];
+    uint8_t out[LOG_COMPRESS_CHUNK];
+    uint32_t stepEnd = archive.offset + LOG_COMPRESS_STEP;
+    while (ok && archive.offset < archive.size && archive.offset < stepEnd)
+    {
+      int count = source.read(in, sizeof(in));
+      if (count <= 0)
+      {
+        ok = false;
+        break;
+      }
+      size_t consumed = 0;
+      while (ok && consumed < static_cast<size_t>(count))
+      {
+        consumed += lzssSink(*archive.encoder, in + consumed, count - consumed);
+        size_t produced = lzssPoll(*archive.encoder, out, sizeof(out), false);
+        ok = sdmetrics::write(target, out, produced) == produced;
+        archive.compressed += produced;
       };
-      needHeader = true;
+      archive.offset += count;
     };
 
-    if (needHeader)
-      logfile.println(CSV_EVENTLOG_HEADER);
-    logfile.printf(CSV_EVENTLOG_DATALINE_FORMAT,
-                   time.strftime(CSV_EVENTLOG_DATE_FORMAT).c_str(), eventType, category,
-                   message);
-    ESP_LOGI("SD Log", "Log record has been added. Log file size: %.2f Kb",
-             logfile.size() / 1024.0);
-    logfile.close();
-    return free();
+    bool finished = ok && archive.offset >= archive.size;
+    while (finished && ok && !lzssIsFinished(*archive.encoder))
+    {
+      size_t produced = lzssPoll(*archive.encoder, out, sizeof(out), true);
+      ok = sdmetrics::write(target, out, produced) == produced;
+      archive.compressed += produced;
+    };
+
+    if (source)
+      sdmetrics::close(source);
+    if (target)
+      sdmetrics::close(target);
+
+    if (!ok)
+    {
+      ESP_LOGE("SD Log", "Unable to compress %s. The rotated log is kept as is.", archive.source);
+      releaseArchiveCompression();
+      SD.remove(archive.target);
+      archiveStats.failed++;
+      archivePending = false;
+      free();
+      return false;
+    }
+
+    if (finished)
+    {
+      releaseArchiveCompression();
+      if (!SD.remove(archive.source))
+      {
+        ESP_LOGE("SD Log", "Unable to remove compressed log %s.", archive.source);
+        archivePending = false;
+      }
+      archiveStats.compressed++;
+      archiveStats.bytesIn += archive.size;
+      archiveStats.bytesOut += archive.compressed;
+      archiveStats.lastDuration = esphome::millis() - archive.started;
+      ESP_LOGI("SD Log", "Rotated log has been compressed to %s: %u >>> %u bytes in %u ms.",
+               archive.target, archive.size, archive.compressed, archiveStats.lastDuration);
+    }
+    free();
+    return true;
   };
 
+  /// @brief Schedules compression of rotated logs on the I/O worker. Should be called periodically.
+  /// Rotated logs stay uncompressed if the worker is not started.
+  bool compressArchiveLogs()
+  {
+    if (!archivePending || archiveJobInFlight || !ioworker::isStarted())
+      return true;
+
+    archiveJobInFlight = true;
+    bool submitted = ioworker::submit(
+        "log archive compression",
+        []()
+        { return compressArchiveStep(); },
+        [](ioworker::JobStatus)
+        { archiveJobInFlight = false; },
+        ioworker::JobPriority::PRIORITY_LOW);
+    if (!submitted)
+      archiveJobInFlight = false;
+    return submitted;
+  };
+
+  /// @brief Removes all files and subdirectories of the directory. Subdirectories are
+  /// walked with a bounded stack of open directories instead of recursion.
+  /// @return false if anything is left
   bool clearDirectory(const char *path)
   {
 
@@ -276,50 +708,79 @@ namespace sdcard
       return false;
     }
 
-    std::function<bool(const char *)> clear_lambda =
-        [=](const char *path_to_clear)
+    fs::File dirs[CLEAR_MAX_DEPTH];
+    dirs[0] = sdmetrics::open(path);
+    if (!dirs[0] || !dirs[0].isDirectory())
     {
-      auto dir = SD.open(path_to_clear);
-      if (!dir.isDirectory())
-      {
-        ESP_LOGW("SD", "Provided path to clear (%s) is not a directory.",
-                 path);
-        return false;
-      };
-      auto file = dir.openNextFile();
-      while (file)
-      {
-        auto path_to_delete = file.path();
+      ESP_LOGW("SD", "Provided path to clear (%s) is not a directory.", path);
+      free();
+      return false;
+    };
 
-        if (file.isDirectory())
+    char entryPath[255]; // Max allowed path in FAT16.
+    size_t depth = 1;
+    bool result = true;
+    while (depth > 0)
+    {
+      auto entry = dirs[depth - 1].openNextFile();
+      if (!entry)
+      {
+        strncpy(entryPath, dirs[depth - 1].path(), sizeof(entryPath) - 1);
+        entryPath[sizeof(entryPath) - 1] = '\0';
+        sdmetrics::close(dirs[--depth]);
+        // The directory to clear itself is kept.
+        if (depth > 0 && !SD.rmdir(entryPath))
         {
-          if (!clear_lambda(path_to_delete))
-            return false;
+          ESP_LOGE("SD", "Unable to delete directory %s.", entryPath);
+          result = false;
         }
-        else
+        continue;
+      }
+
+      if (entry.isDirectory())
+      {
+        if (depth == CLEAR_MAX_DEPTH)
         {
-          file.close();
-          if (!SD.remove(path_to_delete))
-          {
-            ESP_LOGE("SD", "Unable to delete file %s.", path_to_delete);
-            return false;
-          }
+          ESP_LOGE("SD", "Directory tree is too deep to clear: %s.", entry.path());
+          result = false;
+          continue;
         }
-        file = dir.openNextFile();
-      };
+        dirs[depth++] = entry;
+        continue;
+      }
 
-      return false;
+      strncpy(entryPath, entry.path(), sizeof(entryPath) - 1);
+      entryPath[sizeof(entryPath) - 1] = '\0';
+      sdmetrics::close(entry);
+      if (!SD.remove(entryPath))
+      {
+        ESP_LOGE("SD", "Unable to delete file %s.", entryPath);
+        result = false;
+      }
     };
 
-    if (!clear_lambda(path))
+    free();
+    return result;
+  };
+
+  /// @brief Removes all rotated logs. Runs on the I/O worker if it is started.
+  /// @param callback called from main loop when clearing is over
+  /// @return false if clearing has failed or the job can't be queued
+  bool deleteArchiveLogs(ioworker::JobCallback &&callback = nullptr)
+  {
+    if (!ioworker::isStarted())
     {
-      free();
-      return false;
-    };
+      bool is_success = clearDirectory(LOG_ARCHIVE);
+      if (callback)
+        callback(is_success ? ioworker::JobStatus::JOB_DONE : ioworker::JobStatus::JOB_FAILED);
+      return is_success;
+    }
 
-    return free();
+    return ioworker::submit(
+        "log archive clear",
+        []()
+        { return clearDirectory(LOG_ARCHIVE); },
+        std::move(callback), ioworker::JobPriority::PRIORITY_LOW);
   };
 
-  bool deleteArchiveLogs() { return clearDirectory(LOG_ARCHIVE); };
-
 }; // namespace sdcard
@@ -63,39 +63,55 @@ namespace settings
 
 #ifdef USE_SD_CARD
     /* Writes settings to SD card */
-    bool writeSettings()
+    bool writeSettingsFile(const NodeSettingsBinary &data)
     {
-        if(SD.cardType() == CARD_NONE)
-        {
-            ESP_LOGW(TAG_SETTINGS, "There's no SD card to save settings.");
-            return true;
-        }
-
         if(!sdcard::claim()) {
             ESP_LOGE(TAG_SETTINGS, "Unable to open file. Another file is opened already.");
             return false;
         }
 
-        auto settingsFile = SD.open(SETTINGS_FILE, FILE_WRITE, true);
+        auto settingsFile = sdmetrics::open(SETTINGS_FILE, FILE_WRITE, true);
         if(!settingsFile) {
             ESP_LOGE(TAG_SETTINGS, "Unable to open settings file.");
             sdcard::free();
             return false;
         }
 
-        settingsData.content.hash = esphome::crc16(settingsData.content.data, sizeof(settingsData.content.data));
-
-        if(settingsFile.write(settingsData.data, sizeof(settingsData.data)) == 0) {
+        if(sdmetrics::write(settingsFile, data.data, sizeof(data.data)) == 0) {
             ESP_LOGE(TAG_SETTINGS, "Unable to save settings file.");
-            settingsFile.close();
+            sdmetrics::close(settingsFile);
             sdcard::free();
             return false;
         }
 
-        settingsFile.close();
+        sdmetrics::close(settingsFile);
         sdcard::free();
 
         return true;
+    }
+
+    /* Queues writing of settings to SD card */
+    bool writeSettings()
+    {
+        if(SD.cardType() == CARD_NONE)
+        {
+            ESP_LOGW(TAG_SETTINGS, "There's no SD card to save settings.");
+            return true;
+        }
+
+        settingsData.content.hash = esphome::crc16(settingsData.content.data, sizeof(settingsData.content.data));
+
+        if(!ioworker::isStarted())
+            return writeSettingsFile(settingsData);
+
+        NodeSettingsBinary data = settingsData;
+        return ioworker::submit(
+            "settings write",
+            [data]() { return writeSettingsFile(data); },
+            [](ioworker::JobStatus status) {
+                if(status != ioworker::JobStatus::JOB_DONE)
+                    ESP_LOGE(TAG_SETTINGS, "Unable to save settings file.");
+            });
     }    
 #else
 
@@ -153,7 +169,7 @@ namespace settings
             return true;
         }
 
-        if(!SD.exists(SETTINGS_FILE))
+        if(!sdmetrics::exists(SETTINGS_FILE))
         {
             ESP_LOGW(TAG_SETTINGS, "Settings file not found. Creating the defaults one.");
             return resetSettings(true);
@@ -164,7 +180,7 @@ namespace settings
             return false;
         }
 
-        auto settingsFile = SD.open(SETTINGS_FILE, FILE_READ);
+        auto settingsFile = sdmetrics::open(SETTINGS_FILE, FILE_READ);
         if(!settingsFile) {
             ESP_LOGE(TAG_SETTINGS, "Unable to open settings file.");
             sdcard::free();
@@ -176,12 +192,12 @@ namespace settings
         if(settingsFile.read(loaded.data, sizeof(loaded.data)) == -1)
         {
             ESP_LOGE(TAG_SETTINGS, "Unable to read setings file.");
-            settingsFile.close();
+            sdmetrics::close(settingsFile);
             sdcard::free();
             return false;
         }
 
-        settingsFile.close();
+        sdmetrics::close(settingsFile);
         sdcard::free();
         
         uint16_t loaded_crc = esphome::crc16(loaded.content.data, sizeof(loaded.content.data));
@@ -1,95 +1,125 @@
 #pragma once
 
+#include "checksum.h"
 #include "csv_strings.h"
+#include "datalog_format.h"
+#include "io_worker.h"
+#include "problem_history.h"
 #include "problems.h"
 #include "sdcard.h"
 #include "settings.h"
+#include "tariff.h"
 #include "tg_bot_strings.h"
+#include <esphome/core/preferences.h>
 #include <esphome/core/util.h>
 
 #define TAG_SNAPSHOT "Snapshot"
 
 #define SNAPSHOT_FILE "/snapshot.dat"
+#define SNAPSHOT_JOURNAL_MAGIC 0x4E534443 // "CDSN" in little-endian
+#define SNAPSHOT_JOURNAL_SLOTS 2
+#define SNAPSHOT_JOURNAL_SLOT_SIZE 512 // One SD card sector per slot.
+#define SNAPSHOT_SYNC_DELAY 100 // ms to let the restore global store its value before flash sync.
 
 #define SNAPLOG_FILE "datalog_.csv"
 #define SNAPLOG_MAX_SIZE 16777216
 #define SNAPLOG_ROTATE_FILE "data%.4d.csv"
+#define PHASE_STATS_FILE "phases_.csv"
+#define TARIFF_FILE "tariffs_.csv"
 
 #define REASON_TIMER "REGULAR"
 #define REASON_FAILURE "FAIL"
 #define REASON_RESTORE "RESTORE"
 
-#define SNAPSHOT_DATA_VERSION 2
+#define SNAPSHOT_DATA_VERSION 4
+#define SNAPSHOT_MIN_DATA_VERSION 2 // Older snapshots are migrated on load.
 
 #pragma pack(0)
 
+// Snapshot slice fields in storage order: X(name, type, aggregate, reset value, restore, live value).
+// aggregate: SUM, MIN or MAX, used to accumulate daily data into previous days data.
+// Extremes are NAN until the first sample, MIN and MAX skip NAN.
+// restore: ASSIGN or MERGE (by aggregate) to restore live value on load, NONE if there's no live value.
+// Changing the list changes storage layout: bump SNAPSHOT_DATA_VERSION and add a migration step.
+#define SNAP_SLICE_FIELDS(X)                                                                                      \
+    X(powerFailuresCount, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::GENERIC_POWER_FAILURE])               \
+    X(powerFailuresDuration, uint64_t, SUM, 0, ASSIGN, dailyPowerFailureDuration)                                 \
+    X(undervoltageFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::UNDERVOLTAGE])                      \
+    X(undervoltageWarnings, uint64_t, SUM, 0, ASSIGN, dailyWarnings[Problems::UNDERVOLTAGE])                      \
+    X(overvoltageFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::OVERVOLTAGE])                        \
+    X(overvoltageWarnings, uint64_t, SUM, 0, ASSIGN, dailyWarnings[Problems::OVERVOLTAGE])                        \
+    X(overloadFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::OVERLOAD])                              \
+    X(overloadWarnings, uint64_t, SUM, 0, ASSIGN, dailyWarnings[Problems::OVERLOAD])                              \
+    X(phaseImbalanceFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::PHASE_SHIFT])                     \
+    X(phaseImbalanceWarnings, uint64_t, SUM, 0, ASSIGN, dailyWarnings[Problems::PHASE_SHIFT])                     \
+    X(frequencyFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::FREQUENCY_SHIFT])                      \
+    X(frequencyWarnings, uint64_t, SUM, 0, ASSIGN, dailyWarnings[Problems::FREQUENCY_SHIFT])                      \
+    X(breakerFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::BREAKER])                                \
+    X(powerMeterFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::POWER_METER])                         \
+    X(caseIntrusionFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::INTRUSION])                        \
+    X(overheatingWarnings, uint64_t, SUM, 0, ASSIGN, dailyWarnings[Problems::OVERHEAT])                           \
+    X(overheatingFailures, uint64_t, SUM, 0, ASSIGN, dailyFailures[Problems::OVERHEAT])                           \
+    X(minFrequency, double_t, MIN, NAN, MERGE, minFrequency)                                                      \
+    X(maxFrequency, double_t, MAX, NAN, MERGE, maxFrequency)                                                      \
+    X(minCurrent, double_t, MIN, NAN, MERGE, minCurrent)                                                          \
+    X(maxCurrent, double_t, MAX, NAN, MERGE, maxCurrent)                                                          \
+    X(minVoltage, double_t, MIN, NAN, MERGE, minVoltage)                                                          \
+    X(maxVoltage, double_t, MAX, NAN, MERGE, maxVoltage)                                                          \
+    X(energyConsumption, double_t, SUM, 0, NONE, _) // Calculated from power meter counter.
+
+// Time-of-use slice fields, same X signature as SNAP_SLICE_FIELDS. Stored after both SnapSlices,
+// so snapshots of older versions are a prefix of the current layout.
+#define SNAP_TOU_FIELDS(X)                                                                                        \
+    X(dayEnergy, float, SUM, 0, ASSIGN, tariff::activeEnergy[tariff::ZONE_DAY])                                   \
+    X(nightEnergy, float, SUM, 0, ASSIGN, tariff::activeEnergy[tariff::ZONE_NIGHT])                               \
+    X(peakEnergy, float, SUM, 0, ASSIGN, tariff::activeEnergy[tariff::ZONE_PEAK])                                 \
+    X(reactiveEnergyA, float, SUM, 0, ASSIGN, tariff::reactiveEnergy[0])                                          \
+    X(reactiveEnergyB, float, SUM, 0, ASSIGN, tariff::reactiveEnergy[1])                                          \
+    X(reactiveEnergyC, float, SUM, 0, ASSIGN, tariff::reactiveEnergy[2])
+
+#define SNAP_AGGREGATE_SUM(a, b) ((a) + (b))
+#define SNAP_AGGREGATE_MIN(a, b) fmin((a), (b))
+#define SNAP_AGGREGATE_MAX(a, b) fmax((a), (b))
+
+#define SNAP_SAVE_ASSIGN(field, live) field = live;
+#define SNAP_SAVE_MERGE(field, live) field = live;
+#define SNAP_SAVE_NONE(field, live)
+#define SNAP_LOAD_ASSIGN(aggregate, field, live) live = field;
+#define SNAP_LOAD_MERGE(aggregate, field, live) live = SNAP_AGGREGATE_##aggregate(live, field);
+#define SNAP_LOAD_NONE(aggregate, field, live)
+
+#define SNAP_FIELD_DECLARE(name, type, aggregate, reset, restore, live) type name;
+#define SNAP_FIELD_AGGREGATE(name, type, aggregate, reset, restore, live) \
+    result.name = SNAP_AGGREGATE_##aggregate(this->name, other.name);
+#define SNAP_FIELD_RESET(name, type, aggregate, reset, restore, live) slice.name = reset;
+#define SNAP_FIELD_SAVE(name, type, aggregate, reset, restore, live) SNAP_SAVE_##restore(slice.name, live)
+#define SNAP_FIELD_LOAD(name, type, aggregate, reset, restore, live) SNAP_LOAD_##restore(aggregate, slice.name, live)
+#define SNAP_TOU_FIELD_SAVE(name, type, aggregate, reset, restore, live) SNAP_SAVE_##restore(tou.name, live)
+#define SNAP_TOU_FIELD_LOAD(name, type, aggregate, reset, restore, live) SNAP_LOAD_##restore(aggregate, tou.name, live)
+
 /// @brief Snapshot data slice
 struct SnapSlice
 {
-    uint64_t powerFailuresCount;
-    uint64_t powerFailuresDuration;
-    uint64_t undervoltageFailures;
-    uint64_t undervoltageWarnings;
-    uint64_t overvoltageFailures;
-    uint64_t overvoltageWarnings;
-    uint64_t overloadFailures;
-    uint64_t overloadWarnings;
-    uint64_t phaseImbalanceFailures;
-    uint64_t phaseImbalanceWarnings;
-    uint64_t frequencyFailures;
-    uint64_t frequencyWarnings;
-    uint64_t breakerFailures;
-    uint64_t powerMeterFailures;
-    uint64_t caseIntrusionFailures;
-    uint64_t overheatingWarnings;
-    uint64_t overheatingFailures;
-    double_t minFrequency;
-    double_t maxFrequency;
-    double_t minCurrent;
-    double_t maxCurrent;
-    double_t minVoltage;
-    double_t maxVoltage;
-    double_t energyConsumption;
-
-    SnapSlice operator+(SnapSlice other)
-    {
-        return SnapSlice{
-            powerFailuresCount =
-                this->powerFailuresCount + other.powerFailuresCount,
-            powerFailuresDuration =
-                this->powerFailuresDuration + other.powerFailuresDuration,
-            undervoltageFailures =
-                this->undervoltageFailures + other.undervoltageFailures,
-            undervoltageWarnings =
-                this->undervoltageWarnings + other.undervoltageWarnings,
-            overvoltageFailures =
-                this->overvoltageFailures + other.overvoltageFailures,
-            overvoltageWarnings =
-                this->overvoltageWarnings + other.overvoltageWarnings,
-            overloadFailures = this->overloadFailures + other.overloadFailures,
-            overloadWarnings = this->overloadWarnings + other.overloadWarnings,
-            phaseImbalanceFailures =
-                this->phaseImbalanceFailures + other.phaseImbalanceFailures,
-            phaseImbalanceWarnings =
-                this->phaseImbalanceWarnings + other.phaseImbalanceWarnings,
-            frequencyFailures = this->frequencyFailures + other.frequencyFailures,
-            frequencyWarnings = this->frequencyWarnings + other.frequencyWarnings,
-            breakerFailures = this->breakerFailures + other.breakerFailures,
-            powerMeterFailures =
-                this->powerMeterFailures + other.powerMeterFailures,
-            caseIntrusionFailures =
-                this->caseIntrusionFailures + other.caseIntrusionFailures,
-            overheatingWarnings =
-                this->overheatingWarnings + other.overheatingWarnings,
-            overheatingFailures =
-                this->overheatingFailures + other.overheatingFailures,
-            minFrequency = min(this->minFrequency, other.minFrequency),
-            maxFrequency = max(this->maxFrequency, other.maxFrequency),
-            minCurrent = min(this->minCurrent, other.minCurrent),
-            maxCurrent = max(this->maxCurrent, other.maxCurrent),
-            minVoltage = min(this->minVoltage, other.minVoltage),
-            maxVoltage = max(this->maxVoltage, other.maxVoltage),
-            energyConsumption = this->energyConsumption + other.energyConsumption};
+    SNAP_SLICE_FIELDS(SNAP_FIELD_DECLARE)
+
+    SnapSlice operator+(const SnapSlice &other) const
+    {
+        SnapSlice result;
+        SNAP_SLICE_FIELDS(SNAP_FIELD_AGGREGATE)
+        return result;
+    }
+};
+
+/// @brief Time-of-use energy slice, kWh and kvarh
+struct TouSlice
+{
+    SNAP_TOU_FIELDS(SNAP_FIELD_DECLARE)
+
+    TouSlice operator+(const TouSlice &other) const
+    {
+        TouSlice result;
+        SNAP_TOU_FIELDS(SNAP_FIELD_AGGREGATE)
+        return result;
     }
 };
 
@@ -103,6 +133,8 @@ struct Snapshot
     int32_t lastPowerFailureDuration;
     mutable SnapSlice totalPrevDaysData;
     mutable SnapSlice dailyData;
+    mutable TouSlice touPrevDaysData; // Since version 4
+    mutable TouSlice touDailyData;
 };
 
 struct SnapshotStorage
@@ -125,62 +157,177 @@ static SnapshotData snapData;
 
 #pragma pack(0)
 
+/// @brief Header of snapshot journal slot
+struct SnapshotSlotHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t sequence;
+    uint32_t crc; // CRC-32 of header (with zero crc) and snapshot data
+};
+
+static_assert(sizeof(SnapshotSlotHeader) + sizeof(SnapshotData) <= SNAPSHOT_JOURNAL_SLOT_SIZE,
+              "Snapshot data doesn't fit journal slot.");
+
+/// @brief Size of the snapshot dataset covered by CRC in the given data version.
+size_t snapshotBinarySize(int32_t version)
+{
+    return version < 4 ? offsetof(Snapshot, touPrevDaysData) : sizeof(Snapshot);
+};
+
+/// @brief Size of the snapshot data of the given version in a journal slot.
+size_t snapshotDataSize(int32_t version)
+{
+    return sizeof(SnapshotData) - sizeof(Snapshot) + snapshotBinarySize(version);
+};
+
+// Newest slot of the journal, -1 while unknown (before the first read and after a card remount).
+// Set by the loader on boot, then touched by the I/O worker only.
+static int journalSlot = -1;
+static uint32_t journalSequence = 0;
+
 // static double prevDayConsumption;
 
 bool writeDailyLogCSVHeader(fs::File &file)
 {
     if (!file)
         return false;
-    return file.println(CSV_SUMMARY_HEADER) != 0;
+    return sdmetrics::println(file, CSV_SUMMARY_HEADER) != 0;
 };
 
-bool writeDailyLogCSVDataLine(fs::File &file, esphome::ESPTime time)
+bool writeDailyLogCSVDataLine(fs::File &file, esphome::ESPTime time, const Snapshot &data)
 {
     if (!time.is_valid() || !file)
         return false;
 
-    double totalConsumption =
-        snapData.content.dataset.dailyData.energyConsumption +
-        snapData.content.dataset.totalPrevDaysData.energyConsumption;
+    const SnapSlice &daily = data.dailyData;
+    double total = daily.energyConsumption + data.totalPrevDaysData.energyConsumption;
+    return sdmetrics::printf(file, CSV_SUMMARY_DATALINE_FORMAT,
+                             time.strftime(CSV_SUMMARY_DATE_FORMAT).c_str()
+                                 CSV_SUMMARY_COLUMNS(CSV_SUMMARY_SNAPSHOT_ARG)) != 0;
+};
 
-    return file.printf(
-               CSV_SUMMARY_DATALINE_FORMAT,
-               time.strftime(CSV_SUMMARY_DATE_FORMAT).c_str(),
-               snapData.content.dataset.dailyData.energyConsumption,
-               totalConsumption,
-               snapData.content.dataset.dailyData.powerFailuresCount,
-               snapData.content.dataset.dailyData.powerFailuresDuration / 60,
-               snapData.content.dataset.dailyData.minVoltage,
-               snapData.content.dataset.dailyData.maxVoltage,
-               snapData.content.dataset.dailyData.undervoltageFailures,
-               snapData.content.dataset.dailyData.undervoltageWarnings,
-               snapData.content.dataset.dailyData.overvoltageWarnings,
-               snapData.content.dataset.dailyData.overvoltageFailures,
-               snapData.content.dataset.dailyData.minCurrent,
-               snapData.content.dataset.dailyData.maxCurrent,
-               snapData.content.dataset.dailyData.overloadWarnings,
-               snapData.content.dataset.dailyData.overloadFailures,
-               snapData.content.dataset.dailyData.phaseImbalanceWarnings,
-               snapData.content.dataset.dailyData.phaseImbalanceFailures,
-               snapData.content.dataset.dailyData.minFrequency,
-               snapData.content.dataset.dailyData.maxFrequency,
-               snapData.content.dataset.dailyData.frequencyWarnings,
-               snapData.content.dataset.dailyData.frequencyFailures,
-               snapData.content.dataset.dailyData.breakerFailures,
-               snapData.content.dataset.dailyData.powerMeterFailures,
-               snapData.content.dataset.dailyData.overheatingWarnings,
-               snapData.content.dataset.dailyData.overheatingFailures,
-               snapData.content.dataset.dailyData.caseIntrusionFailures) != 0;
+/// @brief Builds binary data log record from snapshot daily data.
+DatalogRecord makeDatalogRecord(esphome::ESPTime time, const Snapshot &data)
+{
+    const SnapSlice &daily = data.dailyData;
+    DatalogRecord record{};
+    record.year = time.year;
+    record.month = time.month;
+    record.day = time.day_of_month;
+    record.flags = DATALOG_RECORD_VALID;
+    record.consumptionPerDay = daily.energyConsumption;
+    record.consumptionTotal = daily.energyConsumption + data.totalPrevDaysData.energyConsumption;
+    record.powerFailures = daily.powerFailuresCount;
+    record.powerFailuresDuration = daily.powerFailuresDuration;
+    record.minVoltage = daily.minVoltage;
+    record.maxVoltage = daily.maxVoltage;
+    record.undervoltageFailures = daily.undervoltageFailures;
+    record.undervoltageWarnings = daily.undervoltageWarnings;
+    record.overvoltageWarnings = daily.overvoltageWarnings;
+    record.overvoltageFailures = daily.overvoltageFailures;
+    record.minCurrent = daily.minCurrent;
+    record.maxCurrent = daily.maxCurrent;
+    record.overloadWarnings = daily.overloadWarnings;
+    record.overloadFailures = daily.overloadFailures;
+    record.phaseImbalanceWarnings = daily.phaseImbalanceWarnings;
+    record.phaseImbalanceFailures = daily.phaseImbalanceFailures;
+    record.minFrequency = daily.minFrequency;
+    record.maxFrequency = daily.maxFrequency;
+    record.frequencyWarnings = daily.frequencyWarnings;
+    record.frequencyFailures = daily.frequencyFailures;
+    record.breakerFailures = daily.breakerFailures;
+    record.powerMeterFailures = daily.powerMeterFailures;
+    record.overheatingWarnings = daily.overheatingWarnings;
+    record.overheatingFailures = daily.overheatingFailures;
+    record.caseIntrusions = daily.caseIntrusionFailures;
+    return record;
 };
 
-bool writeDailyLog(esphome::ESPTime time)
+/// @brief Creates monthly binary data log with all day slots allocated.
+bool createDailyLogBinaryFile(fs::File &file, esphome::ESPTime time)
 {
-    if (SD.cardType() == CARD_NONE)
-    {
-        ESP_LOGW(TAG_SNAPSHOT, "There's no SD card to write down summary data.");
+    DatalogHeader header{};
+    header.magic = DATALOG_MAGIC;
+    header.version = DATALOG_VERSION;
+    header.recordSize = sizeof(DatalogRecord);
+    header.year = time.year;
+    header.month = time.month;
+    header.daysCount = DATALOG_DAYS_PER_FILE;
+    if (sdmetrics::write(file, reinterpret_cast<const uint8_t *>(&header), sizeof(header)) != sizeof(header))
         return false;
+
+    const DatalogRecord empty{};
+    for (int i = 0; i < DATALOG_DAYS_PER_FILE; i++)
+    {
+        if (sdmetrics::write(file, reinterpret_cast<const uint8_t *>(&empty), sizeof(empty)) != sizeof(empty))
+            return false;
     };
+    return true;
+};
+
+/// @brief Writes the day record to the monthly binary data log. Runs on the I/O worker.
+bool writeDailyLogBinaryFile(esphome::ESPTime time, const Snapshot &data)
+{
+    char filename[128];
+    sdcard::date_file(filename, sizeof(filename), time,
+                      sdcard::DateDirectoryMode::BY_YEAR_THEN_BY_MONTH,
+                      DATALOG_BIN_FILE);
+
+    if (!sdcard::claim())
+    {
+        ESP_LOGE(TAG_SNAPSHOT,
+                 "Unable to open file. Another file is opened already.");
+        return false;
+    }
+
+    fs::File file;
+    bool is_valid = false;
+    if (sdmetrics::exists(filename))
+    {
+        file = sdmetrics::open(filename, FILE_UPDATE);
+        DatalogHeader header{};
+        is_valid = file &&
+                   file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+                   datalogHeaderIsValid(header) &&
+                   header.year == time.year && header.month == time.month &&
+                   file.size() == datalogFileSize();
+        if (!is_valid)
+        {
+            ESP_LOGW(TAG_SNAPSHOT, "Binary data log %s is malformed. Creating a new one.", filename);
+            if (file)
+                sdmetrics::close(file);
+        }
+    }
 
+    if (!is_valid)
+    {
+        file = sdmetrics::open(filename, FILE_CREATE_UPDATE, true);
+        if (!file || !createDailyLogBinaryFile(file, time))
+        {
+            ESP_LOGE(TAG_SNAPSHOT, "Unable to create binary data log file %s.", filename);
+            if (file)
+                sdmetrics::close(file);
+            sdcard::free();
+            return false;
+        }
+    }
+
+    auto record = makeDatalogRecord(time, data);
+    bool is_success = file.seek(datalogRecordOffset(time.day_of_month)) &&
+                      sdmetrics::write(file, reinterpret_cast<const uint8_t *>(&record), sizeof(record)) == sizeof(record);
+    sdmetrics::close(file);
+    sdcard::free();
+
+    if (!is_success)
+        ESP_LOGW(TAG_SNAPSHOT, "Unable to write down a binary data log record.");
+    return is_success;
+};
+
+/// @brief Writes a daily data log record. Runs on the I/O worker.
+bool writeDailyLogFile(esphome::ESPTime time, const Snapshot &data)
+{
     if (!sdcard::ensure_date_dir_path(
             time, sdcard::DateDirectoryMode::BY_YEAR_THEN_BY_MONTH))
     {
@@ -207,8 +354,8 @@ bool writeDailyLog(esphome::ESPTime time)
 
     ESP_LOGI("SD Log", "Trying to write daily log to %s", filename.c_str());
 
-    bool need_header = !SD.exists(filename.c_str());
-    fs::File file = SD.open(filename.c_str(), FILE_APPEND, true);
+    bool need_header = !sdmetrics::exists(filename.c_str());
+    fs::File file = sdmetrics::open(filename.c_str(), FILE_APPEND, true);
     if (!file)
     {
         ESP_LOGE(TAG_SNAPSHOT, "Unable to create or open data log file.");
@@ -219,8 +366,8 @@ bool writeDailyLog(esphome::ESPTime time)
     bool is_success = true;
     if (need_header)
         is_success &= writeDailyLogCSVHeader(file);
-    is_success &= writeDailyLogCSVDataLine(file, time);
-    file.close();
+    is_success &= writeDailyLogCSVDataLine(file, time, data);
+    sdmetrics::close(file);
     sdcard::free();
     if (!is_success)
     {
@@ -228,7 +375,124 @@ bool writeDailyLog(esphome::ESPTime time)
         return false;
     };
 
-    return true;
+    return writeDailyLogBinaryFile(time, data);
+};
+
+/// @brief Writes daily per-phase statistics to the monthly phase statistics log. Runs on the I/O worker.
+bool writePhaseStatsFile(esphome::ESPTime time, const phasestats::Summaries &stats)
+{
+    char filename[128];
+    sdcard::date_file(filename, sizeof(filename), time,
+                      sdcard::DateDirectoryMode::BY_YEAR_THEN_BY_MONTH,
+                      PHASE_STATS_FILE);
+
+    if (!sdcard::claim())
+    {
+        ESP_LOGE(TAG_SNAPSHOT,
+                 "Unable to open file. Another file is opened already.");
+        return false;
+    }
+
+    bool need_header = !sdmetrics::exists(filename);
+    fs::File file = sdmetrics::open(filename, FILE_APPEND, true);
+    if (!file)
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to create or open phase statistics file %s.", filename);
+        sdcard::free();
+        return false;
+    };
+
+    bool is_success = true;
+    if (need_header)
+        is_success &= sdmetrics::println(file, CSV_PHASE_STATS_HEADER) != 0;
+    is_success &= sdmetrics::printf(file, CSV_PHASE_STATS_DATALINE_FORMAT,
+                                    time.strftime(CSV_SUMMARY_DATE_FORMAT).c_str()
+                                        CSV_PHASE_STATS_COLUMNS(CSV_PHASE_STATS_ARG)) != 0;
+    sdmetrics::close(file);
+    sdcard::free();
+    if (!is_success)
+        ESP_LOGW(TAG_SNAPSHOT, "Unable to write down phase statistics.");
+    return is_success;
+};
+
+/// @brief Writes daily time-of-use energy to the monthly tariff log. Runs on the I/O worker.
+bool writeTariffFile(esphome::ESPTime time, const Snapshot &data)
+{
+    char filename[128];
+    sdcard::date_file(filename, sizeof(filename), time,
+                      sdcard::DateDirectoryMode::BY_YEAR_THEN_BY_MONTH,
+                      TARIFF_FILE);
+
+    if (!sdcard::claim())
+    {
+        ESP_LOGE(TAG_SNAPSHOT,
+                 "Unable to open file. Another file is opened already.");
+        return false;
+    }
+
+    bool need_header = !sdmetrics::exists(filename);
+    fs::File file = sdmetrics::open(filename, FILE_APPEND, true);
+    if (!file)
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to create or open tariff log file %s.", filename);
+        sdcard::free();
+        return false;
+    };
+
+    const TouSlice &daily = data.touDailyData;
+    TouSlice total = data.touDailyData + data.touPrevDaysData;
+    bool is_success = true;
+    if (need_header)
+        is_success &= sdmetrics::println(file, CSV_TARIFF_HEADER) != 0;
+    is_success &= sdmetrics::printf(file, CSV_TARIFF_DATALINE_FORMAT,
+                                    time.strftime(CSV_SUMMARY_DATE_FORMAT).c_str()
+                                        CSV_TARIFF_COLUMNS(CSV_TARIFF_ARG)) != 0;
+    sdmetrics::close(file);
+    sdcard::free();
+    if (!is_success)
+        ESP_LOGW(TAG_SNAPSHOT, "Unable to write down tariff data.");
+    return is_success;
+};
+
+/// @brief Queues writing of the current daily data to the data log.
+/// Data is copied, so snapshot could be reset right after the call.
+bool writeDailyLog(esphome::ESPTime time)
+{
+    if (SD.cardType() == CARD_NONE)
+    {
+        ESP_LOGW(TAG_SNAPSHOT, "There's no SD card to write down summary data.");
+        return false;
+    };
+
+    phasestats::Summaries stats = phasestats::summarizeAll();
+    if (!ioworker::isStarted())
+        return writeDailyLogFile(time, snapData.content.dataset) && writePhaseStatsFile(time, stats) &&
+               writeTariffFile(time, snapData.content.dataset);
+
+    Snapshot data = snapData.content.dataset;
+    return ioworker::submit(
+        "daily log write",
+        [time, data, stats]()
+        {
+            bool is_success = writeDailyLogFile(time, data);
+            is_success = writePhaseStatsFile(time, stats) && is_success;
+            return writeTariffFile(time, data) && is_success;
+        },
+        [](ioworker::JobStatus status)
+        {
+            if (status != ioworker::JobStatus::JOB_DONE)
+                ESP_LOGE(TAG_SNAPSHOT, "Unable to write down summary data. IO error.");
+        });
+};
+
+/// @brief Formats daily extremes, TG_RANGE_NO_DATA if nothing has been measured.
+std::string formatRange(double minValue, double maxValue, const char *unit)
+{
+    if (!isfinite(minValue) || !isfinite(maxValue))
+        return TG_RANGE_NO_DATA;
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), TG_RANGE_FORMAT, minValue, unit, maxValue, unit);
+    return buffer;
 };
 
 std::string generateTelegramBotSummary_1(const char *source_name,
@@ -236,15 +500,18 @@ std::string generateTelegramBotSummary_1(const char *source_name,
                                          const char *grafana_uri)
 {
 
-    char buffer[512];
+    char buffer[768];
     double totalConsumption =
         snapData.content.dataset.dailyData.energyConsumption +
         snapData.content.dataset.totalPrevDaysData.energyConsumption;
+    const TouSlice &tou = snapData.content.dataset.touDailyData;
     auto str_len = snprintf(
         buffer, sizeof(buffer), TG_SUMMARY_FORMAT_PART_1, source_name,
         snapData.content.dataset.dailyData.energyConsumption, totalConsumption,
-        snapData.content.dataset.dailyData.minCurrent * VOLTAGE_LEVEL / 1000,
-        snapData.content.dataset.dailyData.maxCurrent * VOLTAGE_LEVEL / 1000,
+        tou.dayEnergy, tou.nightEnergy, tou.peakEnergy,
+        tou.reactiveEnergyA, tou.reactiveEnergyB, tou.reactiveEnergyC,
+        formatRange(snapData.content.dataset.dailyData.minCurrent * VOLTAGE_LEVEL / 1000,
+                    snapData.content.dataset.dailyData.maxCurrent * VOLTAGE_LEVEL / 1000, "kW").c_str(),
         ha_uri, grafana_uri);
     std::string out(buffer);
     out.resize(str_len);
@@ -286,12 +553,31 @@ std::string generateTelegramBotSummary_2(const char *source_name,
     auto str_len = snprintf(
         buffer, sizeof(buffer), TG_SUMMARY_FORMAT_PART_2, source_name,
         snapData.content.dataset.dailyData.powerFailuresCount, power_loss_minutes,
-        power_loss_seconds, snapData.content.dataset.dailyData.minVoltage,
-        snapData.content.dataset.dailyData.maxVoltage,
-        snapData.content.dataset.dailyData.minFrequency,
-        snapData.content.dataset.dailyData.maxFrequency);
+        power_loss_seconds,
+        formatRange(snapData.content.dataset.dailyData.minVoltage,
+                    snapData.content.dataset.dailyData.maxVoltage, "V").c_str(),
+        formatRange(snapData.content.dataset.dailyData.minFrequency,
+                    snapData.content.dataset.dailyData.maxFrequency, "Hz").c_str());
     std::string out(buffer);
     out.resize(str_len);
+
+    static const char *const labels[phasestats::CHANNEL_COUNT] = {
+        "Voltage A", "Voltage B", "Voltage C", "Current A", "Current B", "Current C", "Frequency"};
+    static const char *const units[phasestats::CHANNEL_COUNT] = {"V", "V", "V", "A", "A", "A", "Hz"};
+    auto stats = phasestats::summarizeAll();
+    std::string lines;
+    for (int i = 0; i < phasestats::CHANNEL_COUNT; i++)
+    {
+        const phasestats::Summary &summary = stats.channels[i];
+        if (summary.count < 2)
+            continue;
+        str_len = snprintf(buffer, sizeof(buffer), TG_SUMMARY_PHASE_STATS_LINE, labels[i],
+                           summary.mean, summary.stddev, summary.p5, summary.p50, summary.p95, units[i]);
+        lines.append(buffer, str_len);
+    };
+    if (!lines.empty())
+        out += TG_SUMMARY_PHASE_STATS_HEADER "<blockquote>" + lines + "</blockquote>";
+    out += pqevents::generateSummary();
     out.shrink_to_fit();
     return out;
 };
@@ -301,55 +587,46 @@ std::string generateTelegramBotSummary_3(const char *source_name,
                                          const char *grafana_uri)
 {
     char buffer[1024];
-    double totalConsumption =
-        snapData.content.dataset.dailyData.energyConsumption +
-        snapData.content.dataset.totalPrevDaysData.energyConsumption;
-    int power_loss_minutes = static_cast<int>(
-        snapData.content.dataset.dailyData.powerFailuresDuration / 60);
-    int power_loss_seconds =
-        snapData.content.dataset.dailyData.powerFailuresDuration -
-        power_loss_minutes * 60;
+    const SnapSlice &slice = snapData.content.dataset.dailyData;
     auto str_len = snprintf(
-        buffer, sizeof(buffer), TG_SUMMARY_FORMAT_PART_3, source_name,
-        snapData.content.dataset.dailyData.undervoltageWarnings,
-        snapData.content.dataset.dailyData.undervoltageFailures,
-        snapData.content.dataset.dailyData.overvoltageWarnings,
-        snapData.content.dataset.dailyData.overvoltageFailures,
-        snapData.content.dataset.dailyData.overloadWarnings,
-        snapData.content.dataset.dailyData.overloadFailures,
-        snapData.content.dataset.dailyData.phaseImbalanceWarnings,
-        snapData.content.dataset.dailyData.phaseImbalanceFailures,
-        snapData.content.dataset.dailyData.frequencyWarnings,
-        snapData.content.dataset.dailyData.frequencyFailures,
-        snapData.content.dataset.dailyData.overheatingWarnings,
-        snapData.content.dataset.dailyData.overheatingFailures,
-        snapData.content.dataset.dailyData.breakerFailures,
-        snapData.content.dataset.dailyData.powerMeterFailures,
-        snapData.content.dataset.dailyData.caseIntrusionFailures);
+        buffer, sizeof(buffer), TG_SUMMARY_FORMAT_PART_3, source_name
+        TG_SUMMARY_EVENTS(TG_SUMMARY_EVENT_ARGS_WF, TG_SUMMARY_EVENT_ARGS_F));
     std::string out(buffer);
     out.resize(str_len);
     out.shrink_to_fit();
     return out;
 };
 
+/// @brief Resets slice fields to their initial values.
+void resetSnapSlice(SnapSlice &slice)
+{
+    SNAP_SLICE_FIELDS(SNAP_FIELD_RESET)
+};
+
+/// @brief Resets time-of-use slice fields to their initial values.
+void resetTouSlice(TouSlice &slice)
+{
+    SNAP_TOU_FIELDS(SNAP_FIELD_RESET)
+};
+
 void saveToSnapshot(double currentConsumption)
 {
+    SnapSlice &slice = snapData.content.dataset.dailyData;
+    SNAP_SLICE_FIELDS(SNAP_FIELD_SAVE)
+    TouSlice &tou = snapData.content.dataset.touDailyData;
+    SNAP_TOU_FIELDS(SNAP_TOU_FIELD_SAVE)
     if(isfinite(currentConsumption))
     {
-        snapData.content.dataset.dailyData.energyConsumption =
+        slice.energyConsumption =
             currentConsumption -
             snapData.content.dataset.totalPrevDaysData.energyConsumption;
     } else {
-        snapData.content.dataset.dailyData.energyConsumption = NAN;
+        slice.energyConsumption = NAN;
     };
     snapData.content.dataset.activePowerFailureShiftingStartTS =
         powerFailureShiftingStartTS;
     snapData.content.dataset.lastPowerFailureDuration =
         lastPowerFailureDuration;
-    snapData.content.dataset.dailyData.powerFailuresCount =
-        dailyFailures[Problems::GENERIC_POWER_FAILURE];
-    snapData.content.dataset.dailyData.powerFailuresDuration =
-        dailyPowerFailureDuration;
     if (getProblem(Problems::GENERIC_POWER_FAILURE) == ProblemState::FAILURE)
     {
         snapData.content.dataset.activePowerFailureStartTS = powerFailureStartTS;
@@ -360,62 +637,70 @@ void saveToSnapshot(double currentConsumption)
         snapData.content.dataset.activePowerFailureStartTS = powerFailureStartTS;
         snapData.content.dataset.activePowerFailureEndTS = powerFailureEndTS;
     };
-    snapData.content.dataset.dailyData.minVoltage = minVoltage;
-    snapData.content.dataset.dailyData.undervoltageFailures =
-        dailyFailures[Problems::UNDERVOLTAGE];
-    snapData.content.dataset.dailyData.undervoltageWarnings =
-        dailyWarnings[Problems::UNDERVOLTAGE];
-    snapData.content.dataset.dailyData.maxVoltage = maxVoltage;
-    snapData.content.dataset.dailyData.overvoltageFailures =
-        dailyFailures[Problems::UNDERVOLTAGE];
-    snapData.content.dataset.dailyData.overvoltageWarnings =
-        dailyWarnings[Problems::UNDERVOLTAGE];
-    snapData.content.dataset.dailyData.minCurrent = minCurrent;
-    snapData.content.dataset.dailyData.maxCurrent = maxCurrent;
-    snapData.content.dataset.dailyData.overloadFailures =
-        dailyFailures[Problems::OVERLOAD];
-    snapData.content.dataset.dailyData.overloadWarnings =
-        dailyWarnings[Problems::OVERLOAD];
-    snapData.content.dataset.dailyData.phaseImbalanceFailures =
-        dailyFailures[Problems::PHASE_SHIFT];
-    snapData.content.dataset.dailyData.phaseImbalanceWarnings =
-        dailyWarnings[Problems::PHASE_SHIFT];
-    snapData.content.dataset.dailyData.minFrequency = minFrequency;
-    snapData.content.dataset.dailyData.maxFrequency = maxFrequency;
-    snapData.content.dataset.dailyData.frequencyFailures =
-        dailyFailures[Problems::FREQUENCY_SHIFT];
-    snapData.content.dataset.dailyData.frequencyWarnings =
-        dailyWarnings[Problems::FREQUENCY_SHIFT];
-    snapData.content.dataset.dailyData.breakerFailures =
-        dailyFailures[Problems::BREAKER];
-    snapData.content.dataset.dailyData.powerMeterFailures =
-        dailyFailures[Problems::POWER_METER];
-    snapData.content.dataset.dailyData.caseIntrusionFailures =
-        dailyFailures[Problems::INTRUSION];
-    snapData.content.dataset.dailyData.overheatingFailures =
-        dailyFailures[Problems::OVERHEAT];
-    snapData.content.dataset.dailyData.overheatingWarnings =
-        dailyWarnings[Problems::OVERHEAT];
+    snapData.content.dataset.version = SNAPSHOT_DATA_VERSION;
     snapData.content.crc16 = esphome::crc16(snapData.content.binary, sizeof(snapData.content.binary));
 };
 
-void loadFromSnapshot(double currentConsumption)
+bool snapshotIsValid(const SnapshotData &data)
 {
-    uint16_t snapCrc = esphome::crc16(snapData.content.binary, sizeof(snapData.content.binary));
-    if (snapCrc != snapData.content.crc16)
+    int32_t version = data.content.dataset.version;
+    return version >= SNAPSHOT_MIN_DATA_VERSION && version <= SNAPSHOT_DATA_VERSION &&
+           esphome::crc16(data.content.binary, snapshotBinarySize(version)) == data.content.crc16;
+};
+
+/// @brief Upgrades valid snapshot data of an older version in place, one version per step.
+void migrateSnapshot(SnapshotData &data)
+{
+    Snapshot &dataset = data.content.dataset;
+    if (dataset.version == SNAPSHOT_DATA_VERSION)
+        return;
+
+    ESP_LOGW(TAG_SNAPSHOT, "Migrating snapshot data from version %d to %d.",
+             dataset.version, SNAPSHOT_DATA_VERSION);
+    while (dataset.version < SNAPSHOT_DATA_VERSION)
     {
-        ESP_LOGW(TAG_SNAPSHOT, "Invalid CRC of stored data.");
+        switch (dataset.version)
+        {
+        case 2:
+            // Version 2 stored undervoltage counters in place of overvoltage ones.
+            for (SnapSlice *slice : {&dataset.dailyData, &dataset.totalPrevDaysData})
+            {
+                slice->overvoltageFailures = 0;
+                slice->overvoltageWarnings = 0;
+            };
+            break;
+        case 3:
+            // Version 3 had no time-of-use data.
+            resetTouSlice(dataset.touPrevDaysData);
+            resetTouSlice(dataset.touDailyData);
+            break;
+        }
+        dataset.version++;
+    };
+    data.content.crc16 = esphome::crc16(data.content.binary, sizeof(data.content.binary));
+};
+
+/// @brief Applies snapshot data to counters.
+/// @return false if snapshot is corrupted (counters are left untouched)
+bool loadFromSnapshot(double currentConsumption)
+{
+    if (!snapshotIsValid(snapData))
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Invalid CRC or version of stored data. Snapshot is not loaded.");
+        return false;
     }
+    migrateSnapshot(snapData);
+
+    SnapSlice &slice = snapData.content.dataset.dailyData;
     if(isfinite(currentConsumption)) {
-        snapData.content.dataset.dailyData.energyConsumption = currentConsumption -
+        slice.energyConsumption = currentConsumption -
             snapData.content.dataset.totalPrevDaysData.energyConsumption;
     } else {
-        snapData.content.dataset.dailyData.energyConsumption = NAN;
+        slice.energyConsumption = NAN;
     }
-    dailyFailures[Problems::GENERIC_POWER_FAILURE] =
-        snapData.content.dataset.dailyData.powerFailuresCount;
-    dailyPowerFailureDuration =
-        snapData.content.dataset.dailyData.powerFailuresDuration;
+    SNAP_SLICE_FIELDS(SNAP_FIELD_LOAD)
+    TouSlice &tou = snapData.content.dataset.touDailyData;
+    SNAP_TOU_FIELDS(SNAP_TOU_FIELD_LOAD)
     if (getProblem(Problems::GENERIC_POWER_FAILURE) == ProblemState::FAILURE)
     {
         powerFailureStartTS = snapData.content.dataset.activePowerFailureStartTS;
@@ -428,44 +713,7 @@ void loadFromSnapshot(double currentConsumption)
     };
     powerFailureShiftingStartTS = snapData.content.dataset.activePowerFailureShiftingStartTS;
     lastPowerFailureDuration = snapData.content.dataset.lastPowerFailureDuration;
-    minVoltage = min(minVoltage, snapData.content.dataset.dailyData.minVoltage);
-    dailyFailures[Problems::UNDERVOLTAGE] =
-        snapData.content.dataset.dailyData.undervoltageFailures;
-    dailyWarnings[Problems::UNDERVOLTAGE] =
-        snapData.content.dataset.dailyData.undervoltageWarnings;
-    maxVoltage = max(snapData.content.dataset.dailyData.maxVoltage, maxVoltage);
-    dailyFailures[Problems::UNDERVOLTAGE] =
-        snapData.content.dataset.dailyData.overvoltageFailures;
-    dailyWarnings[Problems::UNDERVOLTAGE] =
-        snapData.content.dataset.dailyData.overvoltageWarnings;
-    minCurrent = min(snapData.content.dataset.dailyData.minCurrent, minCurrent);
-    maxCurrent = max(snapData.content.dataset.dailyData.maxCurrent, maxCurrent);
-    dailyFailures[Problems::OVERLOAD] =
-        snapData.content.dataset.dailyData.overloadFailures;
-    dailyWarnings[Problems::OVERLOAD] =
-        snapData.content.dataset.dailyData.overloadWarnings;
-    dailyFailures[Problems::PHASE_SHIFT] =
-        snapData.content.dataset.dailyData.phaseImbalanceFailures;
-    dailyWarnings[Problems::PHASE_SHIFT] =
-        snapData.content.dataset.dailyData.phaseImbalanceWarnings;
-    minFrequency =
-        min(snapData.content.dataset.dailyData.minFrequency, minFrequency);
-    maxFrequency =
-        max(snapData.content.dataset.dailyData.maxFrequency, maxFrequency);
-    dailyFailures[Problems::FREQUENCY_SHIFT] =
-        snapData.content.dataset.dailyData.frequencyFailures;
-    dailyWarnings[Problems::FREQUENCY_SHIFT] =
-        snapData.content.dataset.dailyData.frequencyWarnings;
-    dailyFailures[Problems::BREAKER] =
-        snapData.content.dataset.dailyData.breakerFailures;
-    dailyFailures[Problems::POWER_METER] =
-        snapData.content.dataset.dailyData.powerMeterFailures;
-    dailyFailures[Problems::INTRUSION] =
-        snapData.content.dataset.dailyData.caseIntrusionFailures;
-    dailyFailures[Problems::OVERHEAT] =
-        snapData.content.dataset.dailyData.overheatingFailures;
-    dailyWarnings[Problems::OVERHEAT] =
-        snapData.content.dataset.dailyData.overheatingWarnings;
+    return true;
 };
 
 /// @brief Resets daily counters
@@ -480,6 +728,11 @@ void commitDailyData(double currentConsumption, int currentTimestamp)
         snapData.content.dataset.totalPrevDaysData.energyConsumption =
             currentConsumption;
     };
+    resetSnapSlice(snapData.content.dataset.dailyData);
+    snapData.content.dataset.touPrevDaysData =
+        snapData.content.dataset.touDailyData +
+        snapData.content.dataset.touPrevDaysData;
+    resetTouSlice(snapData.content.dataset.touDailyData);
     if (getProblem(Problems::GENERIC_POWER_FAILURE) == ProblemState::FAILURE)
     {
         snapData.content.dataset.totalPrevDaysData.powerFailuresDuration +=
@@ -492,85 +745,17 @@ void commitDailyData(double currentConsumption, int currentTimestamp)
     {
         snapData.content.dataset.activePowerFailureStartTS = powerFailureStartTS;
         snapData.content.dataset.activePowerFailureEndTS = powerFailureEndTS;
-        snapData.content.dataset.dailyData.powerFailuresCount = 0;
     };
-    snapData.content.dataset.dailyData.energyConsumption = 0;
-    snapData.content.dataset.dailyData.powerFailuresDuration = 0;
-    snapData.content.dataset.dailyData.minVoltage = VOLTAGE_LEVEL;
-    snapData.content.dataset.dailyData.undervoltageFailures = 0;
-    snapData.content.dataset.dailyData.undervoltageWarnings = 0;
-    snapData.content.dataset.dailyData.maxVoltage = VOLTAGE_LEVEL;
-    snapData.content.dataset.dailyData.overvoltageFailures = 0;
-    snapData.content.dataset.dailyData.overvoltageWarnings = 0;
-    snapData.content.dataset.dailyData.minCurrent = SUPPORTED_LOAD_LEVEL;
-    snapData.content.dataset.dailyData.maxCurrent = SUPPORTED_LOAD_LEVEL;
-    snapData.content.dataset.dailyData.overloadFailures = 0;
-    snapData.content.dataset.dailyData.overloadWarnings = 0;
-    snapData.content.dataset.dailyData.phaseImbalanceFailures = 0;
-    snapData.content.dataset.dailyData.phaseImbalanceWarnings = 0;
-    snapData.content.dataset.dailyData.minFrequency = FREQUENCY;
-    snapData.content.dataset.dailyData.maxFrequency = FREQUENCY;
-    snapData.content.dataset.dailyData.frequencyFailures = 0;
-    snapData.content.dataset.dailyData.frequencyWarnings = 0;
-    snapData.content.dataset.dailyData.breakerFailures = 0;
-    snapData.content.dataset.dailyData.powerMeterFailures = 0;
-    snapData.content.dataset.dailyData.caseIntrusionFailures = 0;
-    snapData.content.dataset.dailyData.overheatingWarnings = 0;
-    snapData.content.dataset.dailyData.overheatingFailures = 0;
 
     snapData.content.crc16 = esphome::crc16(snapData.content.binary, sizeof(snapData.content.binary));
 };
 
 void clearSnapshotData(time_t timestamp = 0)
 {
-    snapData.content.dataset.totalPrevDaysData.breakerFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.caseIntrusionFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.energyConsumption = 0;
-    snapData.content.dataset.totalPrevDaysData.frequencyFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.frequencyWarnings = 0;
-    snapData.content.dataset.totalPrevDaysData.maxCurrent = SUPPORTED_LOAD_LEVEL;
-    snapData.content.dataset.totalPrevDaysData.minCurrent = SUPPORTED_LOAD_LEVEL;
-    snapData.content.dataset.totalPrevDaysData.maxFrequency = FREQUENCY;
-    snapData.content.dataset.totalPrevDaysData.minFrequency = FREQUENCY;
-    snapData.content.dataset.totalPrevDaysData.maxVoltage = VOLTAGE_LEVEL;
-    snapData.content.dataset.totalPrevDaysData.minVoltage = VOLTAGE_LEVEL;
-    snapData.content.dataset.totalPrevDaysData.overheatingFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.overheatingWarnings = 0;
-    snapData.content.dataset.totalPrevDaysData.overloadFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.overloadWarnings = 0;
-    snapData.content.dataset.totalPrevDaysData.overvoltageFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.overvoltageWarnings = 0;
-    snapData.content.dataset.totalPrevDaysData.undervoltageFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.undervoltageWarnings = 0;
-    snapData.content.dataset.totalPrevDaysData.phaseImbalanceFailures = 0;
-    snapData.content.dataset.totalPrevDaysData.phaseImbalanceWarnings = 0;
-    snapData.content.dataset.totalPrevDaysData.powerFailuresCount = 0;
-    snapData.content.dataset.totalPrevDaysData.powerFailuresDuration = 0;
-    snapData.content.dataset.totalPrevDaysData.powerMeterFailures = 0;
-    snapData.content.dataset.dailyData.breakerFailures = 0;
-    snapData.content.dataset.dailyData.caseIntrusionFailures = 0;
-    snapData.content.dataset.dailyData.energyConsumption = 0;
-    snapData.content.dataset.dailyData.frequencyFailures = 0;
-    snapData.content.dataset.dailyData.frequencyWarnings = 0;
-    snapData.content.dataset.dailyData.maxCurrent = SUPPORTED_LOAD_LEVEL;
-    snapData.content.dataset.dailyData.minCurrent = SUPPORTED_LOAD_LEVEL;
-    snapData.content.dataset.dailyData.maxFrequency = FREQUENCY;
-    snapData.content.dataset.dailyData.minFrequency = FREQUENCY;
-    snapData.content.dataset.dailyData.maxVoltage = VOLTAGE_LEVEL;
-    snapData.content.dataset.dailyData.minVoltage = VOLTAGE_LEVEL;
-    snapData.content.dataset.dailyData.overheatingFailures = 0;
-    snapData.content.dataset.dailyData.overheatingWarnings = 0;
-    snapData.content.dataset.dailyData.overloadFailures = 0;
-    snapData.content.dataset.dailyData.overloadWarnings = 0;
-    snapData.content.dataset.dailyData.overvoltageFailures = 0;
-    snapData.content.dataset.dailyData.overvoltageWarnings = 0;
-    snapData.content.dataset.dailyData.undervoltageFailures = 0;
-    snapData.content.dataset.dailyData.undervoltageWarnings = 0;
-    snapData.content.dataset.dailyData.phaseImbalanceFailures = 0;
-    snapData.content.dataset.dailyData.phaseImbalanceWarnings = 0;
-    snapData.content.dataset.dailyData.powerFailuresCount = 0;
-    snapData.content.dataset.dailyData.powerFailuresDuration = 0;
-    snapData.content.dataset.dailyData.powerMeterFailures = 0;
+    resetSnapSlice(snapData.content.dataset.totalPrevDaysData);
+    resetSnapSlice(snapData.content.dataset.dailyData);
+    resetTouSlice(snapData.content.dataset.touPrevDaysData);
+    resetTouSlice(snapData.content.dataset.touDailyData);
     snapData.content.dataset.activePowerFailureEndTS = 0;
     snapData.content.dataset.activePowerFailureShiftingStartTS = 0;
     snapData.content.dataset.activePowerFailureStartTS = 0;
@@ -579,4 +764,298 @@ void clearSnapshotData(time_t timestamp = 0)
     snapData.content.dataset.lastPowerFailureDuration = 0;
 
     snapData.content.crc16 = esphome::crc16(snapData.content.binary, sizeof(snapData.content.binary));
-}
\ No newline at end of file
+}
+
+uint32_t snapshotSlotCrc(SnapshotSlotHeader header, const SnapshotData &data)
+{
+    header.crc = 0;
+    size_t size = header.size < sizeof(data.data) ? header.size : sizeof(data.data);
+    return crc32Compute(data.data, size, crc32Compute(&header, sizeof(header)));
+};
+
+/// @brief Finds the newest valid slot of the opened journal file and makes the next write target the older one.
+/// @param data receives the newest slot data, may be nullptr
+/// @return false if there is no valid slot
+bool scanSnapshotJournal(fs::File &file, SnapshotData *data)
+{
+    bool found = false;
+    int newestSlot = SNAPSHOT_JOURNAL_SLOTS - 1; // The first write goes to slot 0 if there is no valid slot.
+    uint32_t newestSequence = 0;
+    for (int slot = 0; slot < SNAPSHOT_JOURNAL_SLOTS; slot++)
+    {
+        SnapshotSlotHeader header{};
+        SnapshotData slotData{};
+        if (!file.seek(slot * SNAPSHOT_JOURNAL_SLOT_SIZE) ||
+            file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) != sizeof(header) ||
+            file.read(slotData.data, sizeof(slotData.data)) != sizeof(slotData.data))
+            continue;
+
+        if (header.magic != SNAPSHOT_JOURNAL_MAGIC || header.version > SNAPSHOT_DATA_VERSION ||
+            header.size != snapshotDataSize(header.version) || header.crc != snapshotSlotCrc(header, slotData))
+        {
+            ESP_LOGW(TAG_SNAPSHOT, "Snapshot journal slot %d is invalid.", slot);
+            continue;
+        }
+
+        if (!found || static_cast<int32_t>(header.sequence - newestSequence) > 0)
+        {
+            if (data != nullptr)
+                *data = slotData;
+            newestSlot = slot;
+            newestSequence = header.sequence;
+            found = true;
+        }
+    };
+    journalSlot = newestSlot;
+    journalSequence = newestSequence;
+    return found;
+};
+
+/// @brief Writes snapshot to the older slot of the journal file. Runs on the I/O worker.
+/// The newest slot is never touched, so a power loss during the write loses this write only.
+/// If the newest slot is unknown, slot headers are read first.
+bool writeSnapshotJournal(const SnapshotData &data)
+{
+    if (!sdcard::claim())
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to open file. Another file is opened already.");
+        return false;
+    }
+
+    bool exists = sdmetrics::exists(SNAPSHOT_FILE);
+    auto file = sdmetrics::open(SNAPSHOT_FILE, exists ? FILE_UPDATE : FILE_CREATE_UPDATE, true);
+    if (!file)
+    {
+        sdcard::free();
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to open snapshot journal %s.", SNAPSHOT_FILE);
+        return false;
+    }
+
+    if (journalSlot < 0)
+    {
+        if (exists)
+            scanSnapshotJournal(file, nullptr);
+        else
+        {
+            journalSlot = SNAPSHOT_JOURNAL_SLOTS - 1;
+            journalSequence = 0;
+        }
+    }
+
+    int slot = (journalSlot + 1) % SNAPSHOT_JOURNAL_SLOTS;
+    SnapshotSlotHeader header{SNAPSHOT_JOURNAL_MAGIC, SNAPSHOT_DATA_VERSION,
+                              sizeof(SnapshotData), journalSequence + 1, 0};
+    header.crc = snapshotSlotCrc(header, data);
+
+    uint8_t buffer[SNAPSHOT_JOURNAL_SLOT_SIZE] = {0};
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), data.data, sizeof(data.data));
+
+    bool is_success = file.seek(slot * SNAPSHOT_JOURNAL_SLOT_SIZE) &&
+                      sdmetrics::write(file, buffer, sizeof(buffer)) == sizeof(buffer);
+    sdmetrics::close(file);
+    sdcard::free();
+
+    if (!is_success)
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to write snapshot journal slot %d.", slot);
+        return false;
+    }
+    journalSlot = slot;
+    journalSequence = header.sequence;
+    ESP_LOGD(TAG_SNAPSHOT, "Snapshot #%u has been written to journal slot %d.", header.sequence, slot);
+    return true;
+};
+
+/// @brief Reads the newest valid slot of the journal file.
+/// Also makes the next write target the older slot.
+/// @return false if there is no valid slot
+bool readSnapshotJournal(SnapshotData &data)
+{
+    if (!sdcard::claim())
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to open file. Another file is opened already.");
+        return false;
+    }
+
+    if (!sdmetrics::exists(SNAPSHOT_FILE))
+    {
+        ESP_LOGW(TAG_SNAPSHOT, "Snapshot journal %s is not found.", SNAPSHOT_FILE);
+        journalSlot = SNAPSHOT_JOURNAL_SLOTS - 1;
+        journalSequence = 0;
+        sdcard::free();
+        return false;
+    }
+
+    auto file = sdmetrics::open(SNAPSHOT_FILE, FILE_READ);
+    if (!file)
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Unable to open snapshot journal %s.", SNAPSHOT_FILE);
+        sdcard::free();
+        return false;
+    }
+
+    bool found = scanSnapshotJournal(file, &data);
+    sdmetrics::close(file);
+    sdcard::free();
+
+    if (found)
+        ESP_LOGI(TAG_SNAPSHOT, "Snapshot #%u has been read from journal slot %d.", journalSequence, journalSlot);
+    return found;
+};
+
+/// @brief Forgets the newest journal slot, so slot headers are read again before the next write.
+/// Should be called after SD card is mounted.
+void resetSnapshotJournal()
+{
+    if (!ioworker::isStarted())
+    {
+        journalSlot = -1;
+        return;
+    }
+
+    // Journal position belongs to the I/O worker, so it is reset in order with the writes.
+    ioworker::submit(
+        "snapshot journal reset",
+        []()
+        {
+            journalSlot = -1;
+            return true;
+        },
+        nullptr, ioworker::JobPriority::PRIORITY_HIGH);
+};
+
+/// @brief Queues writing of the current snapshot to the journal file. Data is copied.
+bool saveSnapshotJournal()
+{
+    if (SD.cardType() == CARD_NONE)
+        return false;
+
+    if (!ioworker::isStarted())
+        return writeSnapshotJournal(snapData);
+
+    SnapshotData data = snapData;
+    return ioworker::submit(
+        "snapshot journal write",
+        [data]()
+        { return writeSnapshotJournal(data); },
+        nullptr, ioworker::JobPriority::PRIORITY_HIGH);
+};
+
+/// @brief Validates snapshot data restored from NVS. Corrupted data is replaced by
+/// the newest journal slot from SD card or reset if there is no valid slot.
+/// @return false if snapshot data has been reset
+bool restoreSnapshot(time_t timestamp)
+{
+    SnapshotData journal{};
+    bool has_journal = SD.cardType() != CARD_NONE && readSnapshotJournal(journal);
+
+    if (snapshotIsValid(snapData))
+        return true;
+
+    if (has_journal)
+    {
+        ESP_LOGW(TAG_SNAPSHOT, "Snapshot data in NVS is corrupted. Restoring it from SD card journal.");
+        snapData = journal;
+        return true;
+    }
+
+    ESP_LOGE(TAG_SNAPSHOT, "Snapshot data in NVS is corrupted and there's no valid journal. Counters are reset.");
+    clearSnapshotData(timestamp);
+    return false;
+};
+
+/// @brief Counters of snapshot commits to NVS
+struct SnapshotCommitStats
+{
+    uint32_t commits;
+    uint32_t forcedCommits;
+    uint32_t skippedCommits; // Data has not been changed since the last commit.
+    uint32_t bytesWritten;
+    uint32_t lastCommit; // ms
+};
+
+// NVS restore global which keeps the snapshot between reboots.
+static uint8_t *snapshotStorage = nullptr;
+static size_t snapshotStorageSize = 0;
+static uint32_t snapshotCommitInterval = 0; // ms
+static bool snapshotDirty = false;
+static bool snapshotSyncPending = false;
+static SnapshotCommitStats snapshotStats{};
+
+/// @brief Binds snapshot to NVS restore global and copies stored data to snapData.
+/// @param commitInterval Minimal interval between regular commits, ms
+bool setupSnapshotStorage(uint8_t *storage, size_t size, uint32_t commitInterval)
+{
+    if (size < sizeof(snapData.data))
+    {
+        ESP_LOGE(TAG_SNAPSHOT, "Snapshot data (%u bytes) doesn't fit NVS storage (%u bytes).",
+                 static_cast<unsigned>(sizeof(snapData.data)), static_cast<unsigned>(size));
+        return false;
+    }
+    snapshotStorage = storage;
+    snapshotStorageSize = size;
+    snapshotCommitInterval = commitInterval;
+    memcpy(snapData.data, snapshotStorage, sizeof(snapData.data));
+    return true;
+};
+
+/// @brief Marks snapshot as changed. It's committed by snapshotLoop() when commit interval is over.
+void markSnapshotDirty()
+{
+    snapshotDirty = true;
+};
+
+/// @brief Copies current snapData to NVS restore global (and SD card journal) if it has been changed.
+/// @param force Request flash sync right away instead of waiting for the regular flash write interval
+/// @return false if nothing has been written
+bool storeSnapshot(bool force)
+{
+    if (snapshotStorage == nullptr)
+        return false;
+
+    snapshotDirty = false;
+    if (force)
+        snapshotSyncPending = true;
+    history::store(); // Problem history shares flash writes with the snapshot.
+    if (memcmp(snapshotStorage, snapData.data, sizeof(snapData.data)) == 0)
+    {
+        snapshotStats.skippedCommits++;
+        return false;
+    }
+
+    memcpy(snapshotStorage, snapData.data, sizeof(snapData.data));
+    snapshotStats.commits++;
+    if (force)
+        snapshotStats.forcedCommits++;
+    snapshotStats.bytesWritten += snapshotStorageSize; // NVS rewrites the whole blob.
+    snapshotStats.lastCommit = esphome::millis();
+    saveSnapshotJournal();
+    return true;
+};
+
+/// @brief Refreshes snapshot from counters and stores it.
+bool commitSnapshot(double currentConsumption, bool force)
+{
+    saveToSnapshot(currentConsumption);
+    return storeSnapshot(force);
+};
+
+/// @brief Commits dirty snapshot once per commit interval and performs requested flash sync.
+/// Should be called from main loop.
+void snapshotLoop(double currentConsumption)
+{
+    uint32_t now = esphome::millis();
+    if (snapshotDirty && now - snapshotStats.lastCommit >= snapshotCommitInterval)
+        commitSnapshot(currentConsumption, false);
+
+    // Restore global saves its value to preferences from its own loop, so sync is delayed.
+    if (snapshotSyncPending && now - snapshotStats.lastCommit >= SNAPSHOT_SYNC_DELAY)
+    {
+        snapshotSyncPending = false;
+        if (!esphome::global_preferences->sync())
+            ESP_LOGE(TAG_SNAPSHOT, "Unable to sync snapshot to flash.");
+        else
+            ESP_LOGD(TAG_SNAPSHOT, "Snapshot has been synced to flash.");
+    }
+};
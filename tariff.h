@@ -0,0 +1,127 @@
+#pragma once
+
+#include <esphome/core/hal.h>
+#include <esphome/core/log.h>
+#include <esphome/core/time.h>
+#include <cmath>
+
+#define TAG_TARIFF "Tariff"
+
+#define TARIFF_ZONES_COUNT 3
+#define TARIFF_PHASES 3
+#define TARIFF_MAX_SAMPLE_GAP 180000 // ms, longer gaps between reactive power readings are not integrated.
+
+namespace tariff
+{
+  enum Zone
+  {
+    ZONE_DAY = 0,
+    ZONE_NIGHT = 1,
+    ZONE_PEAK = 2
+  };
+
+  static const char *const ZONE_NAMES[TARIFF_ZONES_COUNT] = {"day", "night", "peak"};
+
+  /// @brief Tariff zone from the start minute of local day until the start of the next period.
+  struct Period
+  {
+    uint16_t start; // Minutes since local midnight
+    Zone zone;
+  };
+
+  // Local time schedule sorted by start, the first period starts at midnight.
+  // Edit to match the supply contract.
+  static constexpr Period SCHEDULE[] = {
+      {0 * 60, ZONE_NIGHT},
+      {7 * 60, ZONE_DAY},
+      {8 * 60, ZONE_PEAK},
+      {11 * 60, ZONE_DAY},
+      {20 * 60, ZONE_PEAK},
+      {22 * 60, ZONE_DAY},
+      {23 * 60, ZONE_NIGHT},
+  };
+
+  constexpr bool scheduleIsSorted(int i = 1)
+  {
+    return i >= static_cast<int>(sizeof(SCHEDULE) / sizeof(SCHEDULE[0])) ||
+           (SCHEDULE[i - 1].start < SCHEDULE[i].start && SCHEDULE[i].start < 24 * 60 && scheduleIsSorted(i + 1));
+  }
+
+  static_assert(SCHEDULE[0].start == 0, "Tariff schedule should start at midnight.");
+  static_assert(scheduleIsSorted(), "Tariff schedule should be sorted by start minute.");
+
+  // Energy of the current day. Restored from snapshot on boot.
+  static float activeEnergy[TARIFF_ZONES_COUNT];  // kWh by zone
+  static float reactiveEnergy[TARIFF_PHASES];     // kvarh by phase, inductive and capacitive alike
+
+  static float lastCounter = NAN; // kWh
+  static float lastReactivePower[TARIFF_PHASES];
+  static uint32_t lastReactiveSample[TARIFF_PHASES];
+  static int cachedMinute = -1;
+  static Zone cachedZone = ZONE_DAY;
+
+  /// @brief Tariff zone of the local time. The schedule is scanned once per minute.
+  Zone zoneAt(const esphome::ESPTime &time)
+  {
+    int minute = time.hour * 60 + time.minute;
+    if (minute != cachedMinute)
+    {
+      cachedMinute = minute;
+      for (const auto &period : SCHEDULE)
+      {
+        if (period.start > minute)
+          break;
+        cachedZone = period.zone;
+      };
+    }
+    return cachedZone;
+  };
+
+  /// @brief Attributes the growth of the meter energy counter to the current tariff zone.
+  /// The first reading after boot only sets the base, energy used while the node was down is not zoned.
+  /// @param time local time
+  /// @param counter meter energy counter, kWh
+  void addCounter(const esphome::ESPTime &time, float counter)
+  {
+    if (!std::isfinite(counter) || !time.is_valid())
+      return;
+
+    if (!std::isfinite(lastCounter) || counter < lastCounter)
+    {
+      if (std::isfinite(lastCounter))
+        ESP_LOGW(TAG_TARIFF, "Energy counter went back from %.3f to %.3f kWh. Counter base is reset.",
+                 lastCounter, counter);
+      lastCounter = counter;
+      return;
+    }
+
+    activeEnergy[zoneAt(time)] += counter - lastCounter;
+    lastCounter = counter;
+  };
+
+  /// @brief Integrates reactive power of the phase (trapezoidal rule).
+  /// @param phase 0 - A, 1 - B, 2 - C
+  /// @param power reactive power, var
+  void addReactivePower(int phase, float power)
+  {
+    if (phase < 0 || phase >= TARIFF_PHASES || !std::isfinite(power))
+      return;
+
+    uint32_t now = esphome::millis();
+    uint32_t gap = now - lastReactiveSample[phase];
+    if (lastReactiveSample[phase] != 0 && gap <= TARIFF_MAX_SAMPLE_GAP)
+      reactiveEnergy[phase] += (fabsf(lastReactivePower[phase]) + fabsf(power)) / 2.0f * gap / 3.6e9f;
+    lastReactivePower[phase] = power;
+    lastReactiveSample[phase] = now;
+  };
+
+  /// @brief Resets energy of the day. Counter base is kept, so no energy is lost at midnight.
+  void resetCounters()
+  {
+    for (auto &energy : activeEnergy)
+      energy = 0;
+    for (auto &energy : reactiveEnergy)
+      energy = 0;
+  };
+
+}; // namespace tariff
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cinttypes>
 #include <string>
 
 #define EMOJI_FAIL "\xF0\x9F\x86\x98"
@@ -12,6 +13,8 @@
 EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
 "Power consumed per day: <b>%.2f</b> kWh\n" \
 "Total consumption: <b>%.2f</b> kWh\n" \
+"By tariff zones: day <b>%.2f</b>, night <b>%.2f</b>, peak <b>%.2f</b> kWh\n" \
+"Reactive energy: A <b>%.2f</b>, B <b>%.2f</b>, C <b>%.2f</b> kvarh\n" \
 "Load during day: <b>%.2f kW - %.2f kW approx</b>\n" \
 "<i>Quality of service:</i>\n" \
 "<blockquote>Stability: %d power failures detected with total duration %d minute(s) %d second(s)\n" \
@@ -29,32 +32,61 @@ EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
 "Case Intrusions: %d " EMOJI_FAIL "</blockquote>\n\n" \
 "-- provided by ESPHome, <a href=\\\"%s\\\">Home Assistant</a> & <a href=\\\"%s\\\">Grafana</a>."
 
+// Range of daily extremes: minimum, unit, maximum, unit. Extremes are NAN until the first sample.
+#define TG_RANGE_FORMAT "%.2f %s - %.2f %s"
+#define TG_RANGE_NO_DATA "no data"
+
 #define TG_SUMMARY_FORMAT_PART_1 EMOJI_LEDGER " -- Daily Summary [1/3] -- " EMOJI_LEDGER "\n" \
 EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
 "Power consumed per day: <b>%.2f</b> kWh\n" \
 "Total consumption: <b>%.2f</b> kWh\n" \
-"Load during day: <b>%.2f kW - %.2f kW approx</b>\n" \
+"By tariff zones: day <b>%.2f</b>, night <b>%.2f</b>, peak <b>%.2f</b> kWh\n" \
+"Reactive energy: A <b>%.2f</b>, B <b>%.2f</b>, C <b>%.2f</b> kvarh\n" \
+"Load during day: <b>%s approx</b>\n" \
 "-- provided by ESPHome, <a href='%s'>Home Assistant</a> & <a href='%s'>Grafana</a>."
 
 #define TG_SUMMARY_FORMAT_PART_2 EMOJI_LEDGER " -- Daily Summary [2/3] -- " EMOJI_LEDGER "\n" \
 EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
 "<i>Quality of service:</i>\n" \
-"<blockquote>Stability: %d power failures detected with total duration %.0f minute(s) %.0f second(s)\n" \
-"Voltage: %.2f V - %.2f V\n" \
-"Frequency: %.2f Hz - %.2f Hz</blockquote>" 
-
+"<blockquote>Stability: %" PRIu64 " power failures detected with total duration %.0f minute(s) %.0f second(s)\n" \
+"Voltage: %s\n" \
+"Frequency: %s</blockquote>" 
+
+// Appended to TG_SUMMARY_FORMAT_PART_2, one TG_SUMMARY_PHASE_STATS_LINE per channel with data.
+#define TG_SUMMARY_PHASE_STATS_HEADER "\n<i>Phase statistics (mean, std. deviation, p5 - p50 - p95):</i>\n"
+// Channel label, mean, standard deviation, p5, p50, p95, unit.
+#define TG_SUMMARY_PHASE_STATS_LINE "%s: %.2f \xC2\xB1 %.2f, %.2f - %.2f - %.2f %s\n"
+
+// Appended to TG_SUMMARY_FORMAT_PART_2, one TG_PQ_EVENTS_LINE per event class with events.
+#define TG_PQ_EVENTS_HEADER "\n<i>Voltage events (&lt;1 s, 1-5 s, 5-60 s, 1-3 min, &gt;3 min):</i>\n"
+// Class label, counts by duration class.
+#define TG_PQ_EVENTS_LINE "%s: %u / %u / %u / %u / %u\n"
+
+// Registered events of the daily summary: WF(label, warnings, failures) or F(label, failures).
+// Counters are fields of SnapSlice named slice at the expansion site.
+#define TG_SUMMARY_EVENTS(WF, F)                                        \
+  WF("Undervoltage", undervoltageWarnings, undervoltageFailures)        \
+  WF("Overvoltage", overvoltageWarnings, overvoltageFailures)           \
+  WF("Overload", overloadWarnings, overloadFailures)                    \
+  WF("Phase imbalance", phaseImbalanceWarnings, phaseImbalanceFailures) \
+  WF("Frequency shift", frequencyWarnings, frequencyFailures)           \
+  WF("Overheating", overheatingWarnings, overheatingFailures)           \
+  F("Main Circuit Breaker", breakerFailures)                            \
+  F("Power Meter", powerMeterFailures)                                  \
+  F("Case Intrusions", caseIntrusionFailures)
+
+#define TG_SUMMARY_EVENT_FORMAT_WF(label, warnings, failures) \
+  label ": %" PRIu64 " " EMOJI_WARN " / %" PRIu64 " " EMOJI_FAIL "\n"
+#define TG_SUMMARY_EVENT_FORMAT_F(label, failures) label ": %" PRIu64 " " EMOJI_FAIL "\n"
+#define TG_SUMMARY_EVENT_ARGS_WF(label, warnings, failures) \
+  , static_cast<uint64_t>(slice.warnings), static_cast<uint64_t>(slice.failures)
+#define TG_SUMMARY_EVENT_ARGS_F(label, failures) , static_cast<uint64_t>(slice.failures)
+
+// Source name followed by TG_SUMMARY_EVENTS(TG_SUMMARY_EVENT_ARGS_WF, TG_SUMMARY_EVENT_ARGS_F) expansion.
 #define TG_SUMMARY_FORMAT_PART_3 EMOJI_LEDGER " -- Daily Summary [3/3] -- " EMOJI_LEDGER "\n" \
 EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
 "<i>Registered events (" EMOJI_WARN " warnings / " EMOJI_FAIL " failures):</i>\n" \
-"<blockquote>Undervoltage: %d " EMOJI_WARN " / %d " EMOJI_FAIL "\n" \
-"Overvoltage: %d " EMOJI_WARN " / %d " EMOJI_FAIL "\n" \
-"Overload: %d " EMOJI_WARN " / %d " EMOJI_FAIL "\n" \
-"Phase imbalance: %d " EMOJI_WARN " / %d " EMOJI_FAIL "\n" \
-"Frequency shift: %d " EMOJI_WARN " / %d " EMOJI_FAIL "\n" \
-"Overheating: %d " EMOJI_WARN " / %d " EMOJI_FAIL "\n" \
-"Main Circuit Breaker: %d " EMOJI_FAIL "\n" \
-"Power Meter: %d " EMOJI_FAIL "\n" \
-"Case Intrusions: %d " EMOJI_FAIL "</blockquote>" 
+"<blockquote>" TG_SUMMARY_EVENTS(TG_SUMMARY_EVENT_FORMAT_WF, TG_SUMMARY_EVENT_FORMAT_F) "</blockquote>"
 
 
 #define TG_FAILURE_MESSAGE_WITH_VALUE EMOJI_FAIL " -- FAILURE: %s [%s] -- " EMOJI_FAIL "\n" \
@@ -84,6 +116,11 @@ EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
 
 #define TG_EMPTY_MESSAGE "  -- UNKNOWN STATE [%s] --  "
 
+// Count of problems, source name; followed by one line per problem.
+#define TG_DIGEST_HEADER EMOJI_WARN " -- %d problems changed state [%s] -- " EMOJI_WARN "\n"
+#define TG_DIGEST_LINE_WITH_VALUE "%s: <b>%s</b> (%.2f %s), %u transition(s)\n"
+#define TG_DIGEST_LINE "%s: <b>%s</b>, %u transition(s)\n"
+
 #define TG_POWER_FAIL EMOJI_FAIL EMOJI_FAIL EMOJI_FAIL "<b><u>%s</u> energy provider is <u>FAILED</u></b>" EMOJI_FAIL EMOJI_FAIL EMOJI_FAIL "\n" \
   "<i>Additional info</i>:\n" \
   "<blockquote>Circuit Breaker: <b>%s</b>\n" \
@@ -96,3 +133,15 @@ EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
   "%d minute(s) %d second(s)"
 
 #define TG_POWER_CONSUMPTION_PER_MONTH EMOJI_LEDGER "<b>Monthly consumption on %s</b>:\n %.2f <b>kW</b>"
+
+// Period name, period, source name, consumption, power failures, duration (minutes),
+// voltage, frequency and TG_SUMMARY_EVENTS(TG_SUMMARY_EVENT_ARGS_WF, TG_SUMMARY_EVENT_ARGS_F) expansion.
+#define TG_PERIOD_REPORT_FORMAT EMOJI_LEDGER " -- %s Report: %s -- " EMOJI_LEDGER "\n" \
+EMOJI_LIGHTNING "<b>%s</b>" EMOJI_LIGHTNING "\n" \
+"Power consumed: <b>%.2f</b> kWh\n" \
+"<i>Quality of service:</i>\n" \
+"<blockquote>Stability: %" PRIu64 " power failures with total duration %" PRIu64 " minute(s)\n" \
+"Voltage: %s\n" \
+"Frequency: %s</blockquote>\n" \
+"<i>Registered events (" EMOJI_WARN " warnings / " EMOJI_FAIL " failures):</i>\n" \
+"<blockquote>" TG_SUMMARY_EVENTS(TG_SUMMARY_EVENT_FORMAT_WF, TG_SUMMARY_EVENT_FORMAT_F) "</blockquote>"
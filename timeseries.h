@@ -0,0 +1,265 @@
+#pragma once
+
+#include "io_worker.h"
+#include "sdcard.h"
+#include "timeseries_format.h"
+#include <FS.h>
+#include <SD.h>
+#include <esphome/core/hal.h>
+#include <esphome/core/time.h>
+
+#define TAG_TIMESERIES "Time Series"
+
+#define TIMESERIES_PENDING_BLOCKS 4
+#define TIMESERIES_DATE_MODE sdcard::DateDirectoryMode::BY_YEAR_THEN_BY_MONTH_THEN_BY_DAY
+
+namespace timeseries
+{
+  /// @brief Sealed block waiting for the I/O worker
+  struct PendingBlock
+  {
+    bool used;
+    esphome::ESPTime time; // Time of the first sample, defines the file.
+    uint8_t data[TIMESERIES_BLOCK_SIZE];
+  };
+
+  /// @brief Counters of the time-series logger
+  struct TimeseriesStats
+  {
+    uint32_t samples;
+    uint32_t blocks;
+    uint32_t dropped;
+    uint32_t failed;
+    uint32_t tornBlocks; // Invalid blocks found at the end of file by recovery.
+    uint32_t lastWriteLatency;
+  };
+
+  static TimeseriesEncoder encoder{};
+  static esphome::ESPTime blockTime{};
+  static PendingBlock pending[TIMESERIES_PENDING_BLOCKS]{};
+  static TimeseriesStats stats{};
+
+  // Writer state. Touched by the I/O worker only.
+  static char filePath[64] = {'\0'};
+  static uint32_t fileGeneration = 0;
+  static uint32_t writeOffset = 0;
+  static uint32_t nextSequence = 0;
+  static uint8_t recoveryBlock[TIMESERIES_BLOCK_SIZE];
+
+  /// @brief Finds the end of the last good block. Blocks are scanned backward from
+  /// the end of file, so a torn block written on power loss is overwritten by the next one.
+  void recoverFile(fs::File &file)
+  {
+    uint32_t size = file.size();
+    uint32_t offset = size - size % TIMESERIES_BLOCK_SIZE;
+    if (offset != size)
+      stats.tornBlocks++;
+
+    writeOffset = 0;
+    nextSequence = 0;
+    while (offset > 0)
+    {
+      offset -= TIMESERIES_BLOCK_SIZE;
+      TimeseriesBlockHeader header;
+      if (file.seek(offset) &&
+          file.read(recoveryBlock, TIMESERIES_BLOCK_SIZE) == TIMESERIES_BLOCK_SIZE &&
+          timeseriesBlockIsValid(recoveryBlock, header))
+      {
+        writeOffset = offset + TIMESERIES_BLOCK_SIZE;
+        nextSequence = header.sequence + 1;
+        break;
+      }
+      stats.tornBlocks++;
+    };
+
+    if (writeOffset != size)
+      ESP_LOGW(TAG_TIMESERIES, "File %s has been recovered: %u of %u bytes are valid.",
+               filePath, writeOffset, size);
+  };
+
+  /// @brief Makes the day index cover all blocks before writeOffset.
+  /// Missing entries (no index yet or power loss between writes) are rebuilt from block headers.
+  bool recoverIndex(fs::File &file, fs::File &index)
+  {
+    uint32_t blocks = writeOffset / TIMESERIES_BLOCK_SIZE;
+    uint32_t first = index.size() / sizeof(TimeseriesIndexEntry);
+    if (first >= blocks)
+      return true;
+
+    ESP_LOGW(TAG_TIMESERIES, "Rebuilding %u index entries of %s.", blocks - first, filePath);
+    if (!index.seek(timeseriesIndexOffset(first)))
+      return false;
+    for (uint32_t i = first; i < blocks; i++)
+    {
+      TimeseriesBlockHeader header{};
+      if (!file.seek(i * TIMESERIES_BLOCK_SIZE) ||
+          file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) != sizeof(header))
+        return false;
+      TimeseriesIndexEntry entry{header.firstTimestamp, header.lastTimestamp};
+      if (index.write(reinterpret_cast<const uint8_t *>(&entry), sizeof(entry)) != sizeof(entry))
+        return false;
+    };
+    return true;
+  };
+
+  /// @brief Writes the block to the day file and its entry to the day index. Runs on the I/O worker.
+  bool writeBlock(PendingBlock &block)
+  {
+    char path[sizeof(filePath)];
+    char indexPath[sizeof(filePath)];
+    sdcard::date_file(path, sizeof(path), block.time, TIMESERIES_DATE_MODE, TIMESERIES_FILE);
+    sdcard::date_file(indexPath, sizeof(indexPath), block.time, TIMESERIES_DATE_MODE, TIMESERIES_INDEX_FILE);
+    if (!sdcard::ensure_date_dir_path(block.time, TIMESERIES_DATE_MODE))
+    {
+      ESP_LOGE(TAG_TIMESERIES, "Unable to initialize date-dependent directory tree.");
+      return false;
+    }
+
+    if (!sdcard::claim())
+    {
+      ESP_LOGE(TAG_TIMESERIES, "Unable to open file. Another file is opened already.");
+      return false;
+    }
+
+    uint32_t started = esphome::millis();
+    bool known = fileGeneration == sdcard::dirCacheGeneration && strcmp(path, filePath) == 0;
+    // Existing file is updated in place to overwrite a torn block.
+    auto file = SD.open(path, (known || SD.exists(path)) ? FILE_UPDATE : FILE_CREATE_UPDATE, true);
+    if (!file)
+    {
+      ESP_LOGE(TAG_TIMESERIES, "Unable to open or create time-series file %s.", path);
+      fileGeneration = 0;
+      sdcard::free();
+      return false;
+    }
+
+    auto index = SD.open(indexPath, (known || SD.exists(indexPath)) ? FILE_UPDATE : FILE_CREATE_UPDATE, true);
+    if (!index)
+    {
+      ESP_LOGE(TAG_TIMESERIES, "Unable to open or create time-series index %s.", indexPath);
+      file.close();
+      fileGeneration = 0;
+      sdcard::free();
+      return false;
+    }
+
+    if (!known)
+    {
+      strcpy(filePath, path);
+      recoverFile(file);
+      if (!recoverIndex(file, index))
+        ESP_LOGE(TAG_TIMESERIES, "Unable to rebuild index %s.", indexPath);
+      fileGeneration = sdcard::dirCacheGeneration;
+    }
+
+    timeseriesSetSequence(block.data, nextSequence);
+    TimeseriesBlockHeader header;
+    memcpy(&header, block.data, sizeof(header));
+    TimeseriesIndexEntry entry{header.firstTimestamp, header.lastTimestamp};
+    bool is_success = file.seek(writeOffset) &&
+                      file.write(block.data, TIMESERIES_BLOCK_SIZE) == TIMESERIES_BLOCK_SIZE &&
+                      index.seek(timeseriesIndexOffset(writeOffset / TIMESERIES_BLOCK_SIZE)) &&
+                      index.write(reinterpret_cast<const uint8_t *>(&entry), sizeof(entry)) == sizeof(entry);
+    index.close();
+    file.close();
+    sdcard::free();
+
+    if (!is_success)
+    {
+      ESP_LOGE(TAG_TIMESERIES, "Unable to write time-series block to %s.", path);
+      fileGeneration = 0; // File is recovered on the next write.
+      return false;
+    }
+    writeOffset += TIMESERIES_BLOCK_SIZE;
+    nextSequence++;
+    stats.lastWriteLatency = esphome::millis() - started;
+    return true;
+  };
+
+  void completeBlock(PendingBlock *block, bool is_success)
+  {
+    if (is_success)
+      stats.blocks++;
+    else
+      stats.failed++;
+    block->used = false;
+  };
+
+  /// @brief Seals the current block and queues it for writing.
+  /// @return false if the block is dropped
+  bool flush()
+  {
+    if (encoder.state.count == 0)
+      return true;
+
+    timeseriesSeal(encoder, 0); // Block number is set by the writer.
+    PendingBlock *block = nullptr;
+    for (auto &slot : pending)
+    {
+      if (!slot.used)
+      {
+        block = &slot;
+        break;
+      }
+    };
+
+    if (block == nullptr)
+    {
+      ESP_LOGW(TAG_TIMESERIES, "Write queue is full. %u sample(s) are dropped.", encoder.state.count);
+      stats.dropped++;
+      timeseriesReset(encoder);
+      return false;
+    }
+
+    memcpy(block->data, encoder.block, TIMESERIES_BLOCK_SIZE);
+    block->time = blockTime;
+    block->used = true;
+    timeseriesReset(encoder);
+
+    if (!ioworker::isStarted())
+    {
+      bool is_success = writeBlock(*block);
+      completeBlock(block, is_success);
+      return is_success;
+    }
+
+    bool submitted = ioworker::submit(
+        "time series write",
+        [block]()
+        { return writeBlock(*block); },
+        [block](ioworker::JobStatus status)
+        { completeBlock(block, status == ioworker::JobStatus::JOB_DONE); });
+    if (!submitted)
+    {
+      stats.dropped++;
+      block->used = false;
+    }
+    return submitted;
+  };
+
+  /// @brief Adds a sample of all channels (see TIMESERIES_CHANNEL_NAMES).
+  /// Should be called every second. Blocks are written when they are full or the day is over.
+  bool sample(esphome::ESPTime time, const float *values)
+  {
+    if (!time.is_valid())
+      return false;
+
+    if (encoder.state.count > 0 &&
+        (time.day_of_month != blockTime.day_of_month || time.month != blockTime.month ||
+         time.year != blockTime.year))
+      flush();
+
+    if (encoder.state.count == 0)
+      blockTime = time;
+
+    if (!timeseriesAppend(encoder, time.timestamp, values))
+    {
+      flush();
+      blockTime = time;
+      timeseriesAppend(encoder, time.timestamp, values); // Always fits an empty block.
+    }
+    stats.samples++;
+    return true;
+  };
+
+}; // namespace timeseries
@@ -0,0 +1,364 @@
+#pragma once
+
+// Per-second time-series blocks. Shared by the firmware and host-side tools,
+// so this header must not depend on Arduino or ESPHome.
+//
+// A file is a sequence of fixed-size blocks. Every block is self-contained:
+// the first sample is stored as is, the next ones are Gorilla-compressed.
+//   Timestamp delta-of-delta: '0' | '10' + 7 bits | '110' + 9 bits | '1110' + 12 bits | '1111' + 32 bits
+//   Value XOR with the previous value of the channel:
+//     '0'                             - same value
+//     '10' + meaningful bits          - fits the previous leading/trailing zeros window
+//     '11' + 5 bits leading zeros + 5 bits (meaningful length - 1) + meaningful bits
+
+#include "checksum.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define TIMESERIES_FILE "series.bin"
+#define TIMESERIES_INDEX_FILE "series.idx" // Entry N describes block N of series.bin.
+#define TIMESERIES_MAGIC 0x31535443 // "CTS1" in little-endian
+#define TIMESERIES_VERSION 1
+#define TIMESERIES_BLOCK_SIZE 512 // One SD card sector.
+
+#define TIMESERIES_CHANNELS 13
+
+static const char *const TIMESERIES_CHANNEL_NAMES[TIMESERIES_CHANNELS] = {
+    "voltage_a", "voltage_b", "voltage_c",
+    "current_a", "current_b", "current_c",
+    "power_a", "power_b", "power_c",
+    "power_factor_a", "power_factor_b", "power_factor_c",
+    "frequency"};
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "Time-series blocks are stored in little-endian byte order.");
+
+#pragma pack(push, 1)
+
+/// @brief Header of time-series block
+struct TimeseriesBlockHeader
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t channels;
+    uint16_t count; // Samples in block
+    uint32_t sequence; // Block number in file
+    uint32_t firstTimestamp;
+    uint32_t lastTimestamp;
+    uint16_t bits; // Used payload bits
+    uint16_t reserved;
+    uint32_t crc; // CRC-32 of the whole block with this field set to zero
+};
+
+/// @brief Entry of day index file
+struct TimeseriesIndexEntry
+{
+    uint32_t firstTimestamp;
+    uint32_t lastTimestamp;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(TimeseriesBlockHeader) == 28, "Unexpected time-series block header size.");
+static_assert(sizeof(TimeseriesIndexEntry) == 8, "Unexpected time-series index entry size.");
+
+#define TIMESERIES_PAYLOAD_SIZE (TIMESERIES_BLOCK_SIZE - sizeof(TimeseriesBlockHeader))
+#define TIMESERIES_PAYLOAD_BITS (TIMESERIES_PAYLOAD_SIZE * 8)
+
+/// @brief Previous value of channel
+struct TimeseriesChannelState
+{
+    uint32_t value;
+    uint8_t leading;
+    uint8_t trailing;
+};
+
+/// @brief Encoder state. It is copied to roll back a sample which doesn't fit the block.
+struct TimeseriesState
+{
+    uint16_t bits;
+    uint16_t count;
+    uint32_t firstTimestamp;
+    uint32_t lastTimestamp;
+    int32_t lastDelta;
+    TimeseriesChannelState channels[TIMESERIES_CHANNELS];
+};
+
+struct TimeseriesEncoder
+{
+    TimeseriesState state;
+    uint8_t block[TIMESERIES_BLOCK_SIZE];
+};
+
+inline uint8_t *timeseriesPayload(uint8_t *block) { return block + sizeof(TimeseriesBlockHeader); }
+inline const uint8_t *timeseriesPayload(const uint8_t *block) { return block + sizeof(TimeseriesBlockHeader); }
+
+inline bool timeseriesWriteBits(uint8_t *payload, uint16_t &position, uint32_t value, uint8_t count)
+{
+    if (position + count > TIMESERIES_PAYLOAD_BITS)
+        return false;
+    for (int i = count - 1; i >= 0; i--, position++)
+    {
+        uint8_t mask = 0x80 >> (position & 7);
+        if ((value >> i) & 1)
+            payload[position >> 3] |= mask;
+        else
+            payload[position >> 3] &= ~mask;
+    }
+    return true;
+}
+
+inline bool timeseriesReadBits(const uint8_t *payload, uint16_t &position, uint16_t limit,
+                               uint32_t &value, uint8_t count)
+{
+    if (position + count > limit)
+        return false;
+    value = 0;
+    for (uint8_t i = 0; i < count; i++, position++)
+        value = (value << 1) | ((payload[position >> 3] >> (7 - (position & 7))) & 1);
+    return true;
+}
+
+inline uint32_t timeseriesFloatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float timeseriesBitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline void timeseriesReset(TimeseriesEncoder &encoder)
+{
+    memset(&encoder, 0, sizeof(encoder));
+}
+
+inline bool timeseriesWriteTimestamp(TimeseriesEncoder &encoder, uint32_t timestamp)
+{
+    auto &state = encoder.state;
+    uint8_t *payload = timeseriesPayload(encoder.block);
+    int32_t delta = static_cast<int32_t>(timestamp - state.lastTimestamp);
+    int32_t dod = delta - state.lastDelta;
+    state.lastDelta = delta;
+    state.lastTimestamp = timestamp;
+
+    if (dod == 0)
+        return timeseriesWriteBits(payload, state.bits, 0b0, 1);
+    if (dod >= -64 && dod <= 63)
+        return timeseriesWriteBits(payload, state.bits, 0b10, 2) &&
+               timeseriesWriteBits(payload, state.bits, dod & 0x7F, 7);
+    if (dod >= -256 && dod <= 255)
+        return timeseriesWriteBits(payload, state.bits, 0b110, 3) &&
+               timeseriesWriteBits(payload, state.bits, dod & 0x1FF, 9);
+    if (dod >= -2048 && dod <= 2047)
+        return timeseriesWriteBits(payload, state.bits, 0b1110, 4) &&
+               timeseriesWriteBits(payload, state.bits, dod & 0xFFF, 12);
+    return timeseriesWriteBits(payload, state.bits, 0b1111, 4) &&
+           timeseriesWriteBits(payload, state.bits, static_cast<uint32_t>(dod), 32);
+}
+
+inline bool timeseriesWriteValue(TimeseriesEncoder &encoder, TimeseriesChannelState &channel, uint32_t value)
+{
+    uint8_t *payload = timeseriesPayload(encoder.block);
+    uint16_t &bits = encoder.state.bits;
+    uint32_t xored = value ^ channel.value;
+    channel.value = value;
+    if (xored == 0)
+        return timeseriesWriteBits(payload, bits, 0b0, 1);
+
+    uint8_t leading = __builtin_clz(xored);
+    uint8_t trailing = __builtin_ctz(xored);
+
+    if (channel.leading + channel.trailing > 0 && leading >= channel.leading && trailing >= channel.trailing)
+    {
+        uint8_t meaningful = 32 - channel.leading - channel.trailing;
+        return timeseriesWriteBits(payload, bits, 0b10, 2) &&
+               timeseriesWriteBits(payload, bits, xored >> channel.trailing, meaningful);
+    }
+
+    uint8_t meaningful = 32 - leading - trailing;
+    channel.leading = leading;
+    channel.trailing = trailing;
+    return timeseriesWriteBits(payload, bits, 0b11, 2) &&
+           timeseriesWriteBits(payload, bits, leading, 5) &&
+           timeseriesWriteBits(payload, bits, meaningful - 1, 5) &&
+           timeseriesWriteBits(payload, bits, xored >> trailing, meaningful);
+}
+
+/// @brief Appends a sample to the block.
+/// @return false if the sample doesn't fit the block (encoder is left unchanged)
+inline bool timeseriesAppend(TimeseriesEncoder &encoder, uint32_t timestamp, const float *values)
+{
+    const TimeseriesState saved = encoder.state;
+    auto &state = encoder.state;
+    uint8_t *payload = timeseriesPayload(encoder.block);
+
+    bool fits = true;
+    if (state.count == 0)
+    {
+        state.firstTimestamp = timestamp;
+        state.lastTimestamp = timestamp;
+        state.lastDelta = 1; // Samples are expected every second.
+        for (int i = 0; fits && i < TIMESERIES_CHANNELS; i++)
+        {
+            state.channels[i] = TimeseriesChannelState{timeseriesFloatBits(values[i]), 0, 0};
+            fits = timeseriesWriteBits(payload, state.bits, state.channels[i].value, 32);
+        }
+    }
+    else
+    {
+        fits = timeseriesWriteTimestamp(encoder, timestamp);
+        for (int i = 0; fits && i < TIMESERIES_CHANNELS; i++)
+            fits = timeseriesWriteValue(encoder, state.channels[i], timeseriesFloatBits(values[i]));
+    }
+
+    if (!fits)
+    {
+        state = saved;
+        return false;
+    }
+    state.count++;
+    return true;
+}
+
+/// @brief Fills the block header and checksum. Encoder must be reset before the next sample.
+inline void timeseriesSeal(TimeseriesEncoder &encoder, uint32_t sequence)
+{
+    const auto &state = encoder.state;
+    uint8_t *payload = timeseriesPayload(encoder.block);
+    size_t used = (state.bits + 7) / 8;
+    if (state.bits & 7)
+        payload[used - 1] &= 0xFF00 >> (state.bits & 7);
+    memset(payload + used, 0, TIMESERIES_PAYLOAD_SIZE - used);
+
+    TimeseriesBlockHeader header{TIMESERIES_MAGIC, TIMESERIES_VERSION, TIMESERIES_CHANNELS,
+                                 state.count, sequence, state.firstTimestamp, state.lastTimestamp,
+                                 state.bits, 0, 0};
+    memcpy(encoder.block, &header, sizeof(header));
+    header.crc = crc32Compute(encoder.block, TIMESERIES_BLOCK_SIZE);
+    memcpy(encoder.block, &header, sizeof(header));
+}
+
+/// @brief Sets block number and updates checksum of the sealed block.
+inline void timeseriesSetSequence(uint8_t *block, uint32_t sequence)
+{
+    TimeseriesBlockHeader header;
+    memcpy(&header, block, sizeof(header));
+    header.sequence = sequence;
+    header.crc = 0;
+    memcpy(block, &header, sizeof(header));
+    header.crc = crc32Compute(block, TIMESERIES_BLOCK_SIZE);
+    memcpy(block, &header, sizeof(header));
+}
+
+inline size_t timeseriesIndexOffset(uint32_t block) { return block * sizeof(TimeseriesIndexEntry); }
+
+inline bool timeseriesBlockIsValid(const uint8_t *block, TimeseriesBlockHeader &header)
+{
+    memcpy(&header, block, sizeof(header));
+    if (header.magic != TIMESERIES_MAGIC || header.version != TIMESERIES_VERSION ||
+        header.channels != TIMESERIES_CHANNELS || header.count == 0 ||
+        header.bits > TIMESERIES_PAYLOAD_BITS)
+        return false;
+
+    TimeseriesBlockHeader zeroed = header;
+    zeroed.crc = 0;
+    uint32_t crc = crc32Compute(&zeroed, sizeof(zeroed));
+    crc = crc32Compute(timeseriesPayload(block), TIMESERIES_PAYLOAD_SIZE, crc);
+    return crc == header.crc;
+}
+
+/// @brief Decodes all samples of a valid block.
+/// @param callback Called as callback(uint32_t timestamp, const float *values)
+/// @return false if the block is malformed
+template <typename Callback>
+bool timeseriesDecode(const uint8_t *block, Callback &&callback)
+{
+    TimeseriesBlockHeader header;
+    memcpy(&header, block, sizeof(header));
+    const uint8_t *payload = timeseriesPayload(block);
+    uint16_t position = 0;
+    uint32_t bits = 0;
+
+    TimeseriesChannelState channels[TIMESERIES_CHANNELS]{};
+    float values[TIMESERIES_CHANNELS];
+    uint32_t timestamp = header.firstTimestamp;
+    int32_t delta = 1;
+
+    for (uint16_t sample = 0; sample < header.count; sample++)
+    {
+        if (sample == 0)
+        {
+            for (int i = 0; i < TIMESERIES_CHANNELS; i++)
+            {
+                if (!timeseriesReadBits(payload, position, header.bits, channels[i].value, 32))
+                    return false;
+                values[i] = timeseriesBitsFloat(channels[i].value);
+            }
+            callback(timestamp, static_cast<const float *>(values));
+            continue;
+        }
+
+        uint8_t prefix = 0;
+        while (prefix < 4)
+        {
+            if (!timeseriesReadBits(payload, position, header.bits, bits, 1))
+                return false;
+            if (bits == 0)
+                break;
+            prefix++;
+        }
+        int32_t dod = 0;
+        static const uint8_t widths[5] = {0, 7, 9, 12, 32};
+        if (prefix > 0)
+        {
+            if (!timeseriesReadBits(payload, position, header.bits, bits, widths[prefix]))
+                return false;
+            dod = static_cast<int32_t>(bits);
+            if (widths[prefix] < 32 && (bits & (1u << (widths[prefix] - 1))))
+                dod -= 1 << widths[prefix]; // Sign extension.
+        }
+        delta += dod;
+        timestamp += delta;
+
+        for (int i = 0; i < TIMESERIES_CHANNELS; i++)
+        {
+            auto &channel = channels[i];
+            if (!timeseriesReadBits(payload, position, header.bits, bits, 1))
+                return false;
+            if (bits == 1)
+            {
+                uint32_t reuse;
+                if (!timeseriesReadBits(payload, position, header.bits, reuse, 1))
+                    return false;
+                if (reuse == 1)
+                {
+                    uint32_t leading, meaningful;
+                    if (!timeseriesReadBits(payload, position, header.bits, leading, 5) ||
+                        !timeseriesReadBits(payload, position, header.bits, meaningful, 5))
+                        return false;
+                    meaningful++;
+                    if (leading + meaningful > 32)
+                        return false;
+                    channel.leading = leading;
+                    channel.trailing = 32 - leading - meaningful;
+                }
+                uint8_t meaningful = 32 - channel.leading - channel.trailing;
+                uint32_t xored;
+                if (!timeseriesReadBits(payload, position, header.bits, xored, meaningful))
+                    return false;
+                channel.value ^= xored << channel.trailing;
+            }
+            values[i] = timeseriesBitsFloat(channel.value);
+        }
+        callback(timestamp, static_cast<const float *>(values));
+    }
+    return true;
+}
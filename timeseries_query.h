@@ -0,0 +1,372 @@
+#pragma once
+
+#include "csv_strings.h"
+#include "io_worker.h"
+#include "sdcard.h"
+#include "timeseries.h"
+#include "timeseries_format.h"
+#include <FS.h>
+#include <SD.h>
+#include <algorithm>
+#include <cstdarg>
+#include <esphome/core/hal.h>
+#include <esphome/core/time.h>
+#include <functional>
+
+#define TAG_TS_QUERY "Series Query"
+
+#define QUERY_CHUNK_SIZE 2048
+#define QUERY_ROW_SIZE 240         // Longest CSV row with all channels.
+#define QUERY_BLOCKS_PER_STEP 32   // Blocks (or missing days) read by one I/O job.
+#define QUERY_SECONDS_PER_DAY 86400
+
+namespace tsquery
+{
+  /// @brief Sends a chunk to the client. Returns false to retry later.
+  typedef std::function<bool(const char *, size_t)> PublishCallback;
+
+  /// @brief Time range query. Cursor is the next timestamp to return, so a client
+  /// can resume an interrupted query from the last received "next" value.
+  struct Query
+  {
+    bool active;
+    bool finished;
+    uint32_t id;
+    uint32_t from;
+    uint32_t to;
+    uint32_t step;
+    uint16_t mask;
+    uint32_t cursor;
+    uint32_t chunkNumber;
+    uint32_t rows;
+    uint32_t chunkRows;
+    uint32_t started;
+    uint32_t hintDay; // Day and block where the previous step stopped.
+    uint32_t hintBlock;
+    size_t length;
+    char chunk[QUERY_CHUNK_SIZE];
+  };
+
+  /// @brief Counters of queries
+  struct QueryStats
+  {
+    uint32_t queries;
+    uint32_t chunks;
+    uint32_t rows;
+    uint32_t blocksRead;
+    uint32_t invalidBlocks;
+    uint32_t lastDuration;
+  };
+
+  static Query query{};
+  static QueryStats stats{};
+  static PublishCallback publisher = nullptr;
+  static bool jobInFlight = false;
+  static bool chunkReady = false;
+  static uint32_t queryCounter = 0;
+  static uint8_t block[TIMESERIES_BLOCK_SIZE]; // I/O worker only.
+
+  /// @brief Parses comma-separated channel names (see TIMESERIES_CHANNEL_NAMES).
+  /// @return Channel mask, all channels for an empty list or 0 for unknown name
+  uint16_t parseMetrics(const char *metrics)
+  {
+    if (metrics == nullptr || metrics[0] == '\0' || strcmp(metrics, "all") == 0)
+      return (1 << TIMESERIES_CHANNELS) - 1;
+
+    uint16_t mask = 0;
+    const char *name = metrics;
+    while (*name != '\0')
+    {
+      const char *end = strchr(name, ',');
+      size_t length = end == nullptr ? strlen(name) : end - name;
+      int channel = -1;
+      for (int i = 0; i < TIMESERIES_CHANNELS; i++)
+      {
+        if (strlen(TIMESERIES_CHANNEL_NAMES[i]) == length &&
+            strncmp(TIMESERIES_CHANNEL_NAMES[i], name, length) == 0)
+          channel = i;
+      };
+      if (channel < 0)
+      {
+        ESP_LOGW(TAG_TS_QUERY, "Unknown metric: %.*s", static_cast<int>(length), name);
+        return 0;
+      }
+      mask |= 1 << channel;
+      name += length;
+      if (*name == ',')
+        name++;
+    };
+    return mask;
+  };
+
+  void appendText(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(query.chunk + query.length, sizeof(query.chunk) - query.length, format, args);
+    va_end(args);
+    if (length > 0)
+      query.length = std::min(query.length + length, sizeof(query.chunk) - 1);
+  };
+
+  bool readEntry(fs::File &index, uint32_t number, TimeseriesIndexEntry &entry)
+  {
+    return index.seek(timeseriesIndexOffset(number)) &&
+           index.read(reinterpret_cast<uint8_t *>(&entry), sizeof(entry)) == sizeof(entry);
+  };
+
+  /// @brief Finds the first block which ends at or after the timestamp.
+  /// Sequential reads are checked against the hint first, the others use binary search.
+  /// @return Block number or count if there is no such block
+  uint32_t findBlock(fs::File &index, uint32_t count, uint32_t timestamp, uint32_t hint)
+  {
+    TimeseriesIndexEntry entry;
+    if (hint < count && readEntry(index, hint, entry) && entry.lastTimestamp >= timestamp)
+    {
+      TimeseriesIndexEntry previous;
+      if (hint == 0 || (readEntry(index, hint - 1, previous) && previous.lastTimestamp < timestamp))
+        return hint;
+    }
+
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high)
+    {
+      uint32_t middle = low + (high - low) / 2;
+      if (!readEntry(index, middle, entry))
+        return count;
+      if (entry.lastTimestamp < timestamp)
+        low = middle + 1;
+      else
+        high = middle;
+    };
+    return low;
+  };
+
+  void appendRow(uint32_t timestamp, const float *values)
+  {
+    appendText("%u", timestamp);
+    for (int i = 0; i < TIMESERIES_CHANNELS; i++)
+    {
+      if (query.mask & (1 << i))
+        appendText(CSV_DELIMITER "%.3f", values[i]);
+    };
+    appendText("\n");
+  };
+
+  bool chunkIsFull() { return query.length + QUERY_ROW_SIZE >= sizeof(query.chunk); };
+
+  /// @brief Reads the day file from the cursor until the chunk is full or the day is over.
+  /// @param blocks Budget of block reads, decreased by the read blocks
+  void readDay(uint32_t &blocks)
+  {
+    uint32_t dayStart = query.cursor - query.cursor % QUERY_SECONDS_PER_DAY;
+    uint32_t dayEnd = dayStart + QUERY_SECONDS_PER_DAY;
+    auto day = esphome::ESPTime::from_epoch_utc(dayStart);
+    char path[64];
+    char indexPath[64];
+    sdcard::date_file(path, sizeof(path), day, TIMESERIES_DATE_MODE, TIMESERIES_FILE);
+    sdcard::date_file(indexPath, sizeof(indexPath), day, TIMESERIES_DATE_MODE, TIMESERIES_INDEX_FILE);
+
+    blocks--;
+    auto file = SD.open(path, FILE_READ);
+    auto index = file ? SD.open(indexPath, FILE_READ) : fs::File();
+    if (!file || !index)
+    {
+      if (file)
+        file.close();
+      query.cursor = dayEnd; // No data for the day.
+      return;
+    }
+
+    uint32_t count = std::min<uint32_t>(index.size() / sizeof(TimeseriesIndexEntry),
+                                        file.size() / TIMESERIES_BLOCK_SIZE);
+    uint32_t hint = query.hintDay == dayStart ? query.hintBlock : 0;
+    while (blocks > 0 && query.cursor < query.to && query.cursor < dayEnd && !chunkIsFull())
+    {
+      uint32_t number = findBlock(index, count, query.cursor, hint);
+      if (number >= count)
+      {
+        query.cursor = dayEnd;
+        break;
+      }
+
+      blocks--;
+      stats.blocksRead++;
+      TimeseriesBlockHeader header;
+      if (!file.seek(number * TIMESERIES_BLOCK_SIZE) ||
+          file.read(block, TIMESERIES_BLOCK_SIZE) != TIMESERIES_BLOCK_SIZE ||
+          !timeseriesBlockIsValid(block, header))
+      {
+        // Skip the block by its index entry, or the rest of the day if the entry is broken too.
+        stats.invalidBlocks++;
+        TimeseriesIndexEntry entry;
+        bool skip = readEntry(index, number, entry) && entry.lastTimestamp >= query.cursor;
+        query.cursor = skip ? entry.lastTimestamp + 1 : dayEnd;
+        hint = number + 1;
+        continue;
+      }
+
+      timeseriesDecode(block, [](uint32_t timestamp, const float *values)
+                       {
+                         if (timestamp < query.cursor || timestamp >= query.to || chunkIsFull())
+                           return;
+                         appendRow(timestamp, values);
+                         query.chunkRows++;
+                         query.cursor = timestamp + query.step; });
+      if (!chunkIsFull() && query.cursor <= header.lastTimestamp)
+        query.cursor = header.lastTimestamp + 1;
+      hint = query.cursor > header.lastTimestamp ? number + 1 : number;
+    };
+
+    query.hintDay = dayStart;
+    query.hintBlock = hint;
+    index.close();
+    file.close();
+  };
+
+  /// @brief Fills the next chunk. Runs on the I/O worker.
+  bool readStep()
+  {
+    if (!sdcard::claim())
+      return true; // Card is busy, the step will be repeated.
+
+    query.length = 0;
+    query.chunkRows = 0;
+    appendText("# query=%u chunk=%u\n", query.id, query.chunkNumber);
+    if (query.chunkNumber == 0)
+    {
+      appendText("timestamp");
+      for (int i = 0; i < TIMESERIES_CHANNELS; i++)
+      {
+        if (query.mask & (1 << i))
+          appendText(CSV_DELIMITER "%s", TIMESERIES_CHANNEL_NAMES[i]);
+      };
+      appendText("\n");
+    }
+
+    uint32_t blocks = QUERY_BLOCKS_PER_STEP;
+    while (blocks > 0 && query.cursor < query.to && !chunkIsFull())
+      readDay(blocks);
+    sdcard::free();
+
+    query.finished = query.cursor >= query.to;
+    if (query.finished)
+      appendText("# end rows=%u\n", query.rows + query.chunkRows);
+    else
+      appendText("# next=%u\n", query.cursor);
+    return true;
+  };
+
+  void loop();
+
+  void completeStep(ioworker::JobStatus status)
+  {
+    jobInFlight = false;
+    if (status != ioworker::JobStatus::JOB_DONE)
+    {
+      ESP_LOGE(TAG_TS_QUERY, "Query %u has been failed.", query.id);
+      query.active = false;
+      return;
+    }
+    // Steps over days without data are not published.
+    chunkReady = query.chunkRows > 0 || query.finished;
+    loop();
+  };
+
+  /// @brief Publishes ready chunks and starts reading of the next ones. Should be called from the main loop.
+  void loop()
+  {
+    if (!query.active)
+      return;
+
+    if (chunkReady)
+    {
+      if (!publisher(query.chunk, query.length))
+        return; // Client is not connected, retry later.
+      chunkReady = false;
+      query.chunkNumber++;
+      query.rows += query.chunkRows;
+      stats.chunks++;
+      stats.rows += query.chunkRows;
+      if (query.finished)
+      {
+        query.active = false;
+        stats.lastDuration = esphome::millis() - query.started;
+        ESP_LOGI(TAG_TS_QUERY, "Query %u: %u row(s) in %u chunk(s) have been sent in %u ms.",
+                 query.id, query.rows, query.chunkNumber, stats.lastDuration);
+        return;
+      }
+    }
+
+    if (jobInFlight)
+      return;
+
+    if (!ioworker::isStarted())
+    {
+      readStep();
+      completeStep(ioworker::JobStatus::JOB_DONE);
+      return;
+    }
+
+    jobInFlight = true;
+    if (!ioworker::submit("series query", []()
+                          { return readStep(); },
+                          completeStep, ioworker::JobPriority::PRIORITY_LOW))
+      jobInFlight = false;
+  };
+
+  /// @brief Starts a query. Only one query runs at a time.
+  /// @param from First timestamp of the range (UNIX time, inclusive)
+  /// @param to Last timestamp of the range (UNIX time, exclusive)
+  /// @param step Minimal interval between returned samples in seconds (1 for raw data)
+  /// @param metrics Comma-separated channel names, empty for all channels
+  /// @param publish Sends chunks to the client
+  bool start(uint32_t from, uint32_t to, uint32_t step, const char *metrics, PublishCallback &&publish)
+  {
+    if (query.active || jobInFlight)
+    {
+      ESP_LOGW(TAG_TS_QUERY, "Query %u is running. New query is rejected.", query.id);
+      return false;
+    }
+
+    uint16_t mask = parseMetrics(metrics);
+    if (mask == 0 || from >= to)
+    {
+      ESP_LOGW(TAG_TS_QUERY, "Invalid query parameters.");
+      return false;
+    }
+
+    query.active = true;
+    query.finished = false;
+    query.id = ++queryCounter;
+    query.from = from;
+    query.to = to;
+    query.step = step > 0 ? step : 1;
+    query.mask = mask;
+    query.cursor = from;
+    query.chunkNumber = 0;
+    query.rows = 0;
+    query.started = esphome::millis();
+    query.hintDay = 0;
+    query.hintBlock = 0;
+    publisher = std::move(publish);
+    chunkReady = false;
+    stats.queries++;
+    ESP_LOGI(TAG_TS_QUERY, "Query %u has been started: [%u, %u), step %u s.",
+             query.id, from, to, query.step);
+    loop();
+    return true;
+  };
+
+  /// @brief Stops the running query. A chunk which is being read is discarded.
+  void cancel()
+  {
+    if (!query.active)
+      return;
+    ESP_LOGI(TAG_TS_QUERY, "Query %u has been cancelled at %u.", query.id, query.cursor);
+    query.active = false;
+    chunkReady = false;
+  };
+
+}; // namespace tsquery
@@ -0,0 +1,104 @@
+// Converts binary daily data logs (datalog_.bin) to the CSV layout of datalog_.csv.
+//
+// Build: g++ -std=c++17 -O2 -o datalog2csv datalog2csv.cpp
+// Usage: datalog2csv [--no-header] [--day N] FILE...
+
+#include "../csv_strings.h"
+#include "../datalog_format.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static bool printRecord(const DatalogRecord &record)
+{
+    char date[16];
+    snprintf(date, sizeof(date), "%04u-%02u-%02u",
+             record.year, record.month, record.day);
+    return printf(CSV_SUMMARY_DATALINE_FORMAT, date CSV_SUMMARY_COLUMNS(CSV_SUMMARY_RECORD_ARG)) > 0;
+}
+
+static bool readRecord(FILE *file, uint8_t day, DatalogRecord &record)
+{
+    if (fseek(file, static_cast<long>(datalogRecordOffset(day)), SEEK_SET) != 0)
+        return false;
+    return fread(&record, sizeof(record), 1, file) == 1;
+}
+
+static int convertFile(const char *path, int day)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "%s: unable to open file.\n", path);
+        return 1;
+    }
+
+    DatalogHeader header{};
+    if (fread(&header, sizeof(header), 1, file) != 1 || !datalogHeaderIsValid(header))
+    {
+        fprintf(stderr, "%s: not a data log file or unsupported version (%u).\n",
+                path, header.version);
+        fclose(file);
+        return 1;
+    }
+
+    int first = day > 0 ? day : 1;
+    int last = day > 0 ? day : DATALOG_DAYS_PER_FILE;
+    int result = 0;
+    for (int i = first; i <= last; i++)
+    {
+        DatalogRecord record{};
+        if (!readRecord(file, static_cast<uint8_t>(i), record))
+        {
+            fprintf(stderr, "%s: file is truncated at day %d.\n", path, i);
+            result = 1;
+            break;
+        }
+        if ((record.flags & DATALOG_RECORD_VALID) == 0)
+            continue;
+        printRecord(record);
+    }
+
+    fclose(file);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    bool header = true;
+    int day = 0;
+    int files = 0;
+    int result = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-header") == 0)
+        {
+            header = false;
+        }
+        else if (strcmp(argv[i], "--day") == 0 && i + 1 < argc)
+        {
+            day = atoi(argv[++i]);
+            if (day < 1 || day > DATALOG_DAYS_PER_FILE)
+            {
+                fprintf(stderr, "Day must be in range 1..%d.\n", DATALOG_DAYS_PER_FILE);
+                return 2;
+            }
+        }
+        else
+        {
+            if (files++ == 0 && header)
+                printf("%s\n", CSV_SUMMARY_HEADER);
+            result |= convertFile(argv[i], day);
+        }
+    }
+
+    if (files == 0)
+    {
+        fprintf(stderr, "Usage: %s [--no-header] [--day N] FILE...\n", argv[0]);
+        return 2;
+    }
+    return result;
+}
@@ -0,0 +1,103 @@
+// Converts power-quality event files (pqevents.bin) to CSV.
+//
+// Build: g++ -std=c++17 -O2 -o pq2csv pq2csv.cpp
+// Usage: pq2csv [--no-header] FILE...
+
+#include "../csv_strings.h"
+#include "../pq_format.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+static void printHeader()
+{
+    printf("start" CSV_DELIMITER "phase" CSV_DELIMITER "type" CSV_DELIMITER "duration_ms"
+           CSV_DELIMITER "extreme_v" CSV_DELIMITER "sample_period_ms");
+    for (int i = 0; i < PQ_EVENT_PRE_SAMPLES; i++)
+        printf(CSV_DELIMITER "pre_%d", i + 1);
+    for (int i = 0; i < PQ_EVENT_POST_SAMPLES; i++)
+        printf(CSV_DELIMITER "post_%d", i + 1);
+    printf("\n");
+}
+
+static void printRecord(const PqEventRecord &record)
+{
+    char date[24];
+    time_t time = record.startTimestamp;
+    strftime(date, sizeof(date), CSV_EVENTLOG_DATE_FORMAT, gmtime(&time));
+    printf("%s" CSV_DELIMITER "%c" CSV_DELIMITER "%s" CSV_DELIMITER "%" PRIu32
+           CSV_DELIMITER "%.1f" CSV_DELIMITER "%u",
+           date, 'A' + record.phase, PQ_EVENT_TYPE_NAMES[record.type], record.duration,
+           record.extreme / 10.0, record.samplePeriod);
+    for (auto sample : record.pre)
+        printf(CSV_DELIMITER "%.1f", sample / 10.0);
+    for (auto sample : record.post)
+        printf(CSV_DELIMITER "%.1f", sample / 10.0);
+    printf("\n");
+}
+
+static int convertFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "%s: unable to open file.\n", path);
+        return 1;
+    }
+
+    PqEventRecord record;
+    long offset = 0;
+    int result = 0;
+    size_t count;
+    while ((count = fread(&record, 1, sizeof(record), file)) > 0)
+    {
+        if (count != sizeof(record))
+        {
+            fprintf(stderr, "%s: torn record at offset %ld is skipped.\n", path, offset);
+            result = 1;
+        }
+        else if (!pqEventIsValid(record))
+        {
+            fprintf(stderr, "%s: invalid record at offset %ld is skipped.\n", path, offset);
+            result = 1;
+        }
+        else
+        {
+            printRecord(record);
+        }
+        offset += count;
+    }
+
+    fclose(file);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    bool header = true;
+    int files = 0;
+    int result = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-header") == 0)
+        {
+            header = false;
+        }
+        else
+        {
+            if (files++ == 0 && header)
+                printHeader();
+            result |= convertFile(argv[i]);
+        }
+    }
+
+    if (files == 0)
+    {
+        fprintf(stderr, "Usage: %s [--no-header] FILE...\n", argv[0]);
+        return 2;
+    }
+    return result;
+}
@@ -0,0 +1,99 @@
+// Converts per-second time-series files (series.bin) to CSV.
+//
+// Build: g++ -std=c++17 -O2 -o ts2csv ts2csv.cpp
+// Usage: ts2csv [--no-header] FILE...
+
+#include "../csv_strings.h"
+#include "../timeseries_format.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+static void printHeader()
+{
+    printf("timestamp");
+    for (auto name : TIMESERIES_CHANNEL_NAMES)
+        printf(CSV_DELIMITER "%s", name);
+    printf("\n");
+}
+
+static void printSample(uint32_t timestamp, const float *values)
+{
+    char date[24];
+    time_t time = timestamp;
+    strftime(date, sizeof(date), CSV_EVENTLOG_DATE_FORMAT, gmtime(&time));
+    printf("%s", date);
+    for (int i = 0; i < TIMESERIES_CHANNELS; i++)
+        printf(CSV_DELIMITER "%.3f", static_cast<double>(values[i]));
+    printf("\n");
+}
+
+static int convertFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "%s: unable to open file.\n", path);
+        return 1;
+    }
+
+    uint8_t block[TIMESERIES_BLOCK_SIZE];
+    long offset = 0;
+    uint32_t expected = 0;
+    int result = 0;
+    size_t count;
+    while ((count = fread(block, 1, sizeof(block), file)) > 0)
+    {
+        TimeseriesBlockHeader header;
+        if (count != sizeof(block) || !timeseriesBlockIsValid(block, header))
+        {
+            fprintf(stderr, "%s: invalid block at offset %ld is skipped.\n", path, offset);
+            result = 1;
+        }
+        else if (header.sequence < expected)
+        {
+            // Stale blocks after the recovered end of file.
+            break;
+        }
+        else if (!timeseriesDecode(block, printSample))
+        {
+            fprintf(stderr, "%s: malformed block at offset %ld.\n", path, offset);
+            result = 1;
+        }
+        else
+        {
+            expected = header.sequence + 1;
+        }
+        offset += count;
+    }
+
+    fclose(file);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    bool header = true;
+    int files = 0;
+    int result = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-header") == 0)
+        {
+            header = false;
+            continue;
+        }
+        if (files++ == 0 && header)
+            printHeader();
+        result |= convertFile(argv[i]);
+    }
+
+    if (files == 0)
+    {
+        fprintf(stderr, "Usage: %s [--no-header] FILE...\n", argv[0]);
+        return 2;
+    }
+    return result;
+}
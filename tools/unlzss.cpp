@@ -0,0 +1,65 @@
+// Decompresses rotated event logs (/events/archive/*.lzs) to stdout.
+//
+// Build: g++ -std=c++17 -O2 -o unlzss unlzss.cpp
+// Usage: unlzss FILE...
+
+#include "../lzss.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int decompressFile(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "%s: unable to open file.\n", path);
+        return 1;
+    }
+
+    LzssHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || !lzssHeaderIsValid(header))
+    {
+        fprintf(stderr, "%s: not a compressed event log.\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    std::vector<uint8_t> in;
+    uint8_t chunk[4096];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        in.insert(in.end(), chunk, chunk + count);
+    fclose(file);
+
+    std::vector<uint8_t> out(header.originalSize);
+    long size = lzssDecode(in.data(), in.size(), out.data(), out.size());
+    if (size < 0 || static_cast<size_t>(size) != header.originalSize)
+    {
+        fprintf(stderr, "%s: file is corrupted (%ld of %u bytes decoded).\n",
+                path, size, header.originalSize);
+        return 1;
+    }
+
+    if (fwrite(out.data(), 1, out.size(), stdout) != out.size())
+    {
+        fprintf(stderr, "%s: unable to write output.\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+        return 2;
+    }
+
+    int result = 0;
+    for (int i = 1; i < argc; i++)
+        result |= decompressFile(argv[i]);
+    return result;
+}